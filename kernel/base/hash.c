@@ -25,9 +25,15 @@ void *ht_search(ht_t *ht, int64_t key)
     int64_t index = ht_hashcode(key);
     
     /* move in array until an empty */
-    while(ht->array[index].key != -1 && ht->array[index].data != NULL) {
-        if(ht->array[index].key == key)
-            return ht->array[index].data; 
+    while (true) {
+        ht_item_t *item = &ht->array[index];
+        int64_t k = __atomic_load_n(&item->key, __ATOMIC_ACQUIRE);
+        void *data = __atomic_load_n(&item->data, __ATOMIC_ACQUIRE);
+        if (k == -1 || data == NULL) break;
+
+        /* The item may be replaced between the loads, check key again */
+        if (k == key && __atomic_load_n(&item->key, __ATOMIC_ACQUIRE) == key)
+            return data;
    
         /* go to next cell */
         ++index;
@@ -64,8 +70,9 @@ bool ht_insert(ht_t *ht, int64_t key, void *data)
         }
     }
     
-    ht->array[index].key = key;
-    ht->array[index].data = data;
+    /* Publish data before key for lockless ht_search() */
+    __atomic_store_n(&ht->array[index].data, data, __ATOMIC_RELEASE);
+    __atomic_store_n(&ht->array[index].key, key, __ATOMIC_RELEASE);
 
     return true;
 }
@@ -82,8 +89,8 @@ void *ht_delete(ht_t *ht, int64_t key)
         if(ht->array[index].key == key) {
             void *temp = ht->array[index].data; 
             /* assign a dummy item at deleted position */
-            ht->array[index].key = -1; 
-            ht->array[index].data = NULL;
+            __atomic_store_n(&ht->array[index].key, -1, __ATOMIC_RELEASE);
+            __atomic_store_n(&ht->array[index].data, NULL, __ATOMIC_RELEASE);
             return temp;
         }
         
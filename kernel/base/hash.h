@@ -12,6 +12,7 @@ typedef struct {
 } ht_t;
 
 void ht_init(ht_t *ht);
+/* Lockless, while ht_insert() and ht_delete() are serialized by caller */
 void *ht_search(ht_t *ht, int64_t key);
 bool ht_insert(ht_t *ht, int64_t key, void *data);
 void *ht_delete(ht_t *ht, int64_t key);
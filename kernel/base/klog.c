@@ -8,6 +8,11 @@
   A kernel-level log system was implemented. As the first step, it
   mainly supports information display.
 
+  The timestamp of a record is taken from the monotonic clock before the
+  log lock, and its prefix is formatted outside the lock. The date part
+  changes once a second, so it is cached under a sequence lock and only
+  converted by localtime() when the second changes.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -15,17 +20,31 @@
 #include <stdbool.h>
 #include <kconfig.h>
 
+#include <libc/string.h>
 #include <base/klog.h>
 #include <base/time.h>
+#include <base/seqlock.h>
 #include <device/display/term.h>
-#include <sys/hpet.h>
+#include <sys/ktime.h>
 #include <sys/cmos.h>
 #include <sys/smp.h>
 #include <sys/serial.h>
 
 static klog_info_t klog_info = {0};
 static klog_info_t klog_cli = {0};
-static lock_t klog_info_lock = {0};
+static lock_t klog_info_lock = lock_new();
+
+/* "YYYY-MM-DD HH:MM:SS " of the last second a record was logged in */
+#define KLOG_DATE_LEN          20
+
+typedef struct {
+    seqlock_t lock;
+    uint64_t  sec;                  /* Monotonic second plus one, 0 if unset */
+    uint64_t  boot_time;
+    char      date[KLOG_DATE_LEN];
+} klog_date_t;
+
+static klog_date_t klog_date = {.lock = seqlock_new()};
 
 static uint64_t 
     klog_clear_times    = 0, 
@@ -162,6 +181,85 @@ static void klog_putint(int mode, int64_t n, int width, bool zero_filling)
     }
 }
 
+/* Write "n" as exactly "width" decimal digits and return the end */
+static char *klog_fmt_dec(char *buf, uint64_t n, int width)
+{
+    for (int i = width - 1; i >= 0; i--) {
+        buf[i] = '0' + n % 10;
+        n /= 10;
+    }
+    return buf + width;
+}
+
+static void klog_fmt_date(char *buf, uint64_t sec, uint64_t boot_time)
+{
+    tm_t tm = {0};
+
+    if (boot_time == 0) {
+        /* CMOS is not initialized yet */
+        cmos_rtc_t rt = cmos_read_rtc();
+        tm.year = rt.year - 1900;
+        tm.mon  = rt.month - 1;
+        tm.mday = rt.day;
+        tm.hour = rt.hours;
+        tm.min  = rt.minutes;
+        tm.sec  = rt.seconds;
+    } else {
+        time_t now_time = sec + boot_time;
+        localtime(&now_time, &tm);
+    }
+
+    buf = klog_fmt_dec(buf, 1900 + tm.year, 4);
+    *buf++ = '-';
+    buf = klog_fmt_dec(buf, tm.mon + 1, 2);
+    *buf++ = '-';
+    buf = klog_fmt_dec(buf, tm.mday, 2);
+    *buf++ = ' ';
+    buf = klog_fmt_dec(buf, tm.hour, 2);
+    *buf++ = ':';
+    buf = klog_fmt_dec(buf, tm.min, 2);
+    *buf++ = ':';
+    buf = klog_fmt_dec(buf, tm.sec, 2);
+    *buf++ = ' ';
+}
+
+/* Format the prefix of a record logged at "now_ns" on "cpu" into "buf" */
+static void klog_fmt_prefix(char *buf, uint64_t now_ns, cpu_t *cpu)
+{
+    uint64_t sec = now_ns / 1000000000;
+    uint64_t boot_time = cmos_boot_time();
+    bool hit;
+    uint64_t seq;
+
+    do {
+        seq = seqlock_read_begin(&klog_date.lock);
+        hit = (klog_date.sec == sec + 1 && klog_date.boot_time == boot_time);
+        if (hit) memcpy(buf, klog_date.date, KLOG_DATE_LEN);
+    } while (seqlock_read_retry(&klog_date.lock, seq));
+
+    if (!hit) {
+        klog_fmt_date(buf, sec, boot_time);
+
+        seqlock_write_begin(&klog_date.lock);
+        klog_date.sec = sec + 1;
+        klog_date.boot_time = boot_time;
+        memcpy(klog_date.date, buf, KLOG_DATE_LEN);
+        seqlock_write_end(&klog_date.lock);
+    }
+
+    buf += KLOG_DATE_LEN;
+    buf = klog_fmt_dec(buf, (now_ns / 1000000) % 1000, 3);
+    *buf++ = ' ';
+    if (cpu != NULL) {
+        buf = klog_fmt_dec(buf, cpu->cpu_id, 2);
+    } else {
+        *buf++ = '-';
+        *buf++ = '-';
+    }
+    *buf++ = ' ';
+    *buf = '\0';
+}
+
 void klog_init()
 {
     lock_lock(&klog_info_lock);
@@ -238,36 +336,14 @@ void klog_vprintf(klog_level_t level, const char* s, ...)
 #else
     if (level <= KLOG_LEVEL_VERBOSE) return;
 #endif
-    if (level < KLOG_LEVEL_UNK)    lock_lock(&klog_info_lock);
 
-    if (level < KLOG_LEVEL_UNK) {
-        uint64_t now_sec = hpet_get_nanos() / 1000000000;
-        uint64_t now_ms = (hpet_get_nanos() / 1000000) % 1000;
-
-        time_t boot_time = cmos_boot_time();
-        time_t now_time = now_sec + boot_time;
-
-        tm_t now_tm = {0};
-        localtime(&now_time, &now_tm);
-
-        if (boot_time == 0) {
-            cmos_rtc_t rt = cmos_read_rtc();
-            now_tm.year = rt.year - 1900;
-            now_tm.mon  = rt.month - 1;
-            now_tm.mday = rt.day;
-            now_tm.hour = rt.hours;
-            now_tm.min  = rt.minutes;
-            now_tm.sec  = rt.seconds;
-        }
+    /* Date, milliseconds and CPU, e.g., "2023-01-01 12:00:00 123 01 " */
+    char prefix[KLOG_DATE_LEN + 8];
 
-        klog_vprintf_wrapper(TERM_MODE_INFO, "%04d-%02d-%02d %02d:%02d:%02d %03d ",
-                     1900 + now_tm.year, now_tm.mon + 1, now_tm.mday,
-                     now_tm.hour, now_tm.min, now_tm.sec, now_ms);
-        if (cpu != NULL) {
-            klog_vprintf_wrapper(TERM_MODE_INFO, "%02d ", cpu->cpu_id);
-        } else {
-            klog_vprintf_wrapper(TERM_MODE_INFO, "-- ");
-        }
+    if (level < KLOG_LEVEL_UNK) {
+        klog_fmt_prefix(prefix, ktime_get_ns(), cpu);
+        lock_lock(&klog_info_lock);
+        klog_puts(TERM_MODE_INFO, prefix, 0);
     }
 
     switch (level) {
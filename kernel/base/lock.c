@@ -1,27 +1,277 @@
+/**-----------------------------------------------------------------------------
+
+ @file    lock.c
+ @brief   Implementation of queued spinlocks
+ @details
+ @verbatim
+
+  A free lock is taken by one compare-and-swap. Otherwise the CPU appends
+  its node to the queue by exchanging "tail", and spins on its own node
+  until the previous waiter passes the head to it. The head waits for the
+  owner to clear "locked", then takes the lock and hands the head over to
+  its successor (MCS lock).
+
+  A node is only used while its CPU is waiting, and interrupts are disabled
+  then, so one node per CPU is enough. Before SMP is initialized, CPUs spin
+  until the lock is free and not queued.
+
+  Lock statistics are kept in an open addressing table keyed by the file
+  name address and line of the acquisition site, and the class of the lock.
+  Slots are claimed by compare-and-swap and counters are updated atomically,
+  so no lock is taken for them.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+
 #include <base/lock.h>
+#include <base/lockstat.h>
 #include <base/klog.h>
+#include <sys/cpu.h>
+#include <sys/smp.h>
+
+#define LOCK_LOCKED     1
+
+typedef struct lock_node {
+    struct lock_node *next;
+    bool             wait;
+} __attribute__((aligned(64))) lock_node_t;
+
+static lock_node_t lock_nodes[CPU_MAX] = {0};
+
+static inline bool lock_try(lock_t *s)
+{
+    uint32_t val = 0;
+
+    return __atomic_compare_exchange_n(&s->val, &val, LOCK_LOCKED, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+/* Slow path, interrupts must be disabled */
+static void lock_queue(lock_t *s)
+{
+    uint16_t cpu_id = smp_initialized ? this_cpu_read(cpu_id) : CPU_MAX;
+
+    if (cpu_id >= CPU_MAX) {
+        while (!lock_try(s)) {
+            asm volatile("pause");
+        }
+        return;
+    }
+
+    lock_node_t *node = &lock_nodes[cpu_id];
+    uint16_t tail = cpu_id + 1;
+
+    node->next = NULL;
+    node->wait = true;
+
+    uint16_t prev = __atomic_exchange_n(&s->tail, tail, __ATOMIC_ACQ_REL);
+    if (prev != 0) {
+        __atomic_store_n(&lock_nodes[prev - 1].next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->wait, __ATOMIC_ACQUIRE)) {
+            asm volatile("pause");
+        }
+    }
+
+    /* Head of the queue, wait for the owner */
+    while (__atomic_load_n(&s->locked, __ATOMIC_ACQUIRE)) {
+        asm volatile("pause");
+    }
+
+    /* Nobody is queued behind, take the lock and empty the queue */
+    uint32_t val = (uint32_t)tail << 16;
+    if (__atomic_compare_exchange_n(&s->val, &val, LOCK_LOCKED, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    /* Only the head sets "locked" while the queue is not empty */
+    __atomic_store_n(&s->locked, LOCK_LOCKED, __ATOMIC_RELAXED);
+
+    lock_node_t *next;
+    while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == NULL) {
+        asm volatile("pause");
+    }
+    __atomic_store_n(&next->wait, false, __ATOMIC_RELEASE);
+}
+
+#ifdef ENABLE_LOCKSTAT
+
+#define LOCKSTAT_SITES  512
+
+typedef struct {
+    uint64_t   key;             /* Address of file name and line, or 0 */
+    const char *file;           /* Set after "class" */
+    uint64_t   line;
+    const char *class;
+    uint64_t   acquired;
+    uint64_t   contended;
+    uint64_t   spin_total;
+    uint64_t   spin_max;
+    uint64_t   hold_total;
+    uint64_t   hold_max;
+} lockstat_site_t;
+
+static lockstat_site_t lockstat_sites[LOCKSTAT_SITES] = {0};
+
+static lockstat_site_t *lockstat_find(lock_t *s, const char *fn, int ln)
+{
+    const char *class = s->class;
+    uint64_t key = ((uint64_t)fn << 16) | (uint16_t)ln;
+    size_t i = ((key ^ (uint64_t)class) * 0x9E3779B97F4A7C15ULL) >> 55;
+
+    for (size_t n = 0; n < LOCKSTAT_SITES; n++) {
+        lockstat_site_t *site = &lockstat_sites[(i + n) % LOCKSTAT_SITES];
+        uint64_t k = __atomic_load_n(&site->key, __ATOMIC_ACQUIRE);
+
+        if (k == 0 && __atomic_compare_exchange_n(&site->key, &k, key, false,
+                                                  __ATOMIC_ACQ_REL,
+                                                  __ATOMIC_ACQUIRE)) {
+            site->line = ln;
+            site->class = class;
+            __atomic_store_n(&site->file, fn, __ATOMIC_RELEASE);
+            return site;
+        }
+        if (k != key) continue;
+
+        /* Same site, the class is known once the claimer sets "file" */
+        while (__atomic_load_n(&site->file, __ATOMIC_ACQUIRE) == NULL) {
+            asm volatile("pause");
+        }
+        if (site->class == class) return site;
+    }
+
+    return NULL;
+}
+
+static void lockstat_max(uint64_t *p, uint64_t val)
+{
+    uint64_t old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (val > old && !__atomic_compare_exchange_n(p, &old, val, false,
+                                                     __ATOMIC_RELAXED,
+                                                     __ATOMIC_RELAXED));
+}
+
+/* Called by the new owner, "start" is when it began to spin */
+static void lockstat_acquired(lock_t *s, const char *fn, int ln,
+                              bool contended, uint64_t start)
+{
+    uint64_t now = read_tsc();
+    lockstat_site_t *site = lockstat_find(s, fn, ln);
+
+    s->site = site;
+    s->hold_start = now;
+    if (site == NULL) return;
+
+    __atomic_add_fetch(&site->acquired, 1, __ATOMIC_RELAXED);
+    if (contended) {
+        __atomic_add_fetch(&site->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&site->spin_total, now - start, __ATOMIC_RELAXED);
+        lockstat_max(&site->spin_max, now - start);
+    }
+}
+
+/* Called by the owner before the lock is released */
+static void lockstat_released(lock_t *s)
+{
+    lockstat_site_t *site = s->site;
+    if (site == NULL) return;
+
+    uint64_t hold = read_tsc() - s->hold_start;
+
+    __atomic_add_fetch(&site->hold_total, hold, __ATOMIC_RELAXED);
+    lockstat_max(&site->hold_max, hold);
+}
+
+/* Copy a path into "out" of "size" bytes, keep the end of a long one */
+static void lockstat_copy_path(char *out, size_t size, const char *path)
+{
+    if (path == NULL) path = "";
+
+    size_t len = strlen(path);
+    if (len >= size) path += len - (size - 1);
+    strcpy(out, path);
+}
+
+/*
+ * Copy statistics of the first used site whose index is not less than "id".
+ * Return index of that site, or -1 if there is none.
+ */
+int64_t lockstat_get(int64_t id, lockstat_t *out)
+{
+    for (; id >= 0 && id < LOCKSTAT_SITES; id++) {
+        lockstat_site_t *site = &lockstat_sites[id];
+        const char *fn = __atomic_load_n(&site->file, __ATOMIC_ACQUIRE);
+        if (fn == NULL) continue;
+
+        lockstat_copy_path(out->file, sizeof(out->file), fn);
+        lockstat_copy_path(out->class, sizeof(out->class), site->class);
+
+        out->line = site->line;
+        out->acquired = site->acquired;
+        out->contended = site->contended;
+        out->spin_total = site->spin_total;
+        out->spin_max = site->spin_max;
+        out->hold_total = site->hold_total;
+        out->hold_max = site->hold_max;
+        return id;
+    }
+
+    return -1;
+}
+
+/* Clear counters, sites are kept since held locks still point to them */
+void lockstat_reset(void)
+{
+    for (size_t i = 0; i < LOCKSTAT_SITES; i++) {
+        lockstat_site_t *site = &lockstat_sites[i];
+        __atomic_store_n(&site->acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->spin_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->spin_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->hold_total, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&site->hold_max, 0, __ATOMIC_RELAXED);
+    }
+}
+
+#else
+
+int64_t lockstat_get(int64_t id, lockstat_t *out)
+{
+    (void)id;
+    (void)out;
+
+    return -1;
+}
+
+void lockstat_reset(void)
+{
+}
+
+#endif
 
 void lock_lock_impl(lock_t *s, const char *fn, const int ln)
 {
     (void)fn;
     (void)ln;
 
-    asm volatile(
-        "pushfq;"
-        "cli;"
-        "lock btsl $0, %[lock];"
-        "jnc 2f;"
-        "1:"
-        "pause;"
-        "btl $0, %[lock];"
-        "jc 1b;"
-        "lock btsl $0, %[lock];"
-        "jc 1b;"
-        "2:"
-        "pop %[flags]"
-        : [lock] "=m"((s)->lock), [flags] "=m"((s)->rflags)
-        :
-        : "memory", "cc");
+    uint64_t rflags;
+
+    asm volatile("pushfq; pop %0; cli" : "=r"(rflags) : : "memory");
+
+#ifdef ENABLE_LOCKSTAT
+    bool contended = !lock_try(s);
+    uint64_t start = contended ? read_tsc() : 0;
+    if (contended) lock_queue(s);
+    lockstat_acquired(s, fn, ln, contended, start);
+#else
+    if (!lock_try(s)) lock_queue(s);
+#endif
+
+    s->rflags = rflags;
 }
 
 void lock_release_impl(lock_t *s, const char *fn, const int ln)
@@ -29,11 +279,64 @@ void lock_release_impl(lock_t *s, const char *fn, const int ln)
     (void)fn;
     (void)ln;
 
-    asm volatile("push %[flags];"
-                 "lock btrl $0, %[lock];"
-                    "popfq;"
-                 : [lock] "=m"((s)->lock)
-                 : [flags] "m"((s)->rflags)
-                 : "memory", "cc");
+    uint64_t rflags = s->rflags;
+
+#ifdef ENABLE_LOCKSTAT
+    lockstat_released(s);
+#endif
+
+    __atomic_store_n(&s->locked, 0, __ATOMIC_RELEASE);
+
+    asm volatile("push %0; popfq" : : "r"(rflags) : "memory", "cc");
+}
+
+/*
+ * The holder keeps interrupts enabled, so it must not be switched out while
+ * other tasks on its CPU spin for the lock. The preempt count defers context
+ * switches of the CPU until the lock is released. Before per-CPU data is
+ * ready there is no preemption and the count is not touched.
+ */
+void lock_lock_noirq_impl(lock_t *s, const char *fn, const int ln)
+{
+    (void)fn;
+    (void)ln;
+
+    bool counted = smp_initialized;
+    if (counted) this_cpu_add(preempt_count, 1);
+
+    bool contended = !lock_try(s);
+#ifdef ENABLE_LOCKSTAT
+    uint64_t start = contended ? read_tsc() : 0;
+#endif
+
+    /* Queue node of the CPU is shared with interrupt handlers */
+    if (contended) {
+        uint64_t rflags;
+
+        asm volatile("pushfq; pop %0; cli" : "=r"(rflags) : : "memory");
+        lock_queue(s);
+        asm volatile("push %0; popfq" : : "r"(rflags) : "memory", "cc");
+    }
+
+#ifdef ENABLE_LOCKSTAT
+    lockstat_acquired(s, fn, ln, contended, start);
+#endif
+
+    s->rflags = counted;
 }
 
+void lock_release_noirq_impl(lock_t *s, const char *fn, const int ln)
+{
+    (void)fn;
+    (void)ln;
+
+    bool counted = s->rflags;
+
+#ifdef ENABLE_LOCKSTAT
+    lockstat_released(s);
+#endif
+
+    __atomic_store_n(&s->locked, 0, __ATOMIC_RELEASE);
+
+    if (counted) this_cpu_add(preempt_count, -1);
+}
@@ -7,6 +7,22 @@
 
   e.g., lock new, lock and release.
 
+  Locks are queued spinlocks: waiters are served in arrival order, and each
+  of them spins on the queue node of its own CPU instead of the lock word.
+
+  lock_lock() disables interrupts and restores them in lock_release(), so it
+  can be used by interrupt handlers, and the holder is never preempted while
+  other tasks on its CPU spin for the lock. lock_lock_noirq() leaves
+  interrupts as they are and only disables preemption by the preempt count of
+  the CPU. It is only for locks which are never taken in interrupt context
+  and whose holders never sleep.
+
+  If ENABLE_LOCKSTAT is defined in kconfig.h, acquisitions, contention, spin
+  time and hold time are recorded for each lock class and acquisition site
+  ("file:line" of lock_lock), see lockstat.h. The class of a lock is the
+  "file:line" where lock_new() (or mutex_new() etc. which use it) set it up,
+  so all locks initialized by the same line are one class.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -16,16 +32,44 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <kconfig.h>
+
 typedef volatile struct {
-    int lock;
-    uint64_t rflags;
+    union {
+        uint32_t val;
+        struct {
+            uint8_t  locked;
+            uint8_t  reserved;
+            uint16_t tail;      /* Last queued CPU plus 1, or 0 */
+        };
+    };
+    uint64_t rflags;            /* Or whether lock_lock_noirq() raised the
+                                   preempt count */
+#ifdef ENABLE_LOCKSTAT
+    uint64_t hold_start;        /* TSC when the lock was taken */
+    void     *site;             /* Statistics of the site which took it */
+    const char *class;          /* Where it is initialized, or NULL */
+#endif
 } lock_t;
 
-#define lock_new()          (lock_t){0, 0}
+#define LOCK_STR_(x)        #x
+#define LOCK_STR(x)         LOCK_STR_(x)
+
+/* Initializer of a lock_t member, lock_new() is not constant there */
+#ifdef ENABLE_LOCKSTAT
+#define LOCK_INIT           {.val = 0, .class = __FILE__ ":" LOCK_STR(__LINE__)}
+#else
+#define LOCK_INIT           {.val = 0}
+#endif
+
+#define lock_new()          (lock_t)LOCK_INIT
 #define lock_lock(x)        lock_lock_impl(x, __FILE__, __LINE__)
 #define lock_release(x)     lock_release_impl(x, __FILE__, __LINE__)
 
+#define lock_lock_noirq(x)      lock_lock_noirq_impl(x, __FILE__, __LINE__)
+#define lock_release_noirq(x)   lock_release_noirq_impl(x, __FILE__, __LINE__)
+
 void lock_lock_impl(lock_t *s, const char *fn, const int ln);
 void lock_release_impl(lock_t *s, const char *fn, const int ln);
-
-
+void lock_lock_noirq_impl(lock_t *s, const char *fn, const int ln);
+void lock_release_noirq_impl(lock_t *s, const char *fn, const int ln);
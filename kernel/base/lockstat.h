@@ -0,0 +1,36 @@
+/**-----------------------------------------------------------------------------
+
+ @file    lockstat.h
+ @brief   Definition of lock statistics functions
+ @details
+ @verbatim
+
+  Statistics are only recorded if ENABLE_LOCKSTAT is defined in kconfig.h.
+  Otherwise lockstat_get() finds no site.
+
+  A site is counted separately for every lock class it takes. Locks which
+  are not initialized by lock_new() (e.g. cleared by memset) have no class.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+
+/* Statistics of a lock class at an acquisition site, in TSC cycles */
+typedef struct {
+    char     file[48];
+    uint64_t line;
+    char     class[48];         /* "file:line" of lock_new(), or empty */
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spin_total;
+    uint64_t spin_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+} lockstat_t;
+
+int64_t lockstat_get(int64_t id, lockstat_t *out);
+void lockstat_reset(void);
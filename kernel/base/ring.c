@@ -0,0 +1,81 @@
+/**-----------------------------------------------------------------------------
+
+ @file    ring.c
+ @brief   Implementation of bounded lock-free multi-producer single-consumer ring
+ @details
+ @verbatim
+
+  Every slot has a sequence number. A producer claims position "pos" by
+  compare-and-swap on "head" when the slot sequence equals "pos", writes the
+  value and releases the slot by setting the sequence to "pos + 1". The
+  consumer reads the slot at "tail" once its sequence is "tail + 1", and
+  hands it back to producers of the next round by setting "tail + size".
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <base/ring.h>
+
+void ring_init(ring_t *r, ring_slot_t *slots, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        slots[i].seq = i;
+        slots[i].val = 0;
+    }
+
+    r->head = 0;
+    r->tail = 0;
+    r->mask = size - 1;
+    r->slots = slots;
+}
+
+/* Return false if the ring is full */
+bool ring_push(ring_t *r, uint64_t val)
+{
+    uint64_t pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+
+    while (true) {
+        ring_slot_t *slot = &r->slots[pos & r->mask];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int64_t diff = (int64_t)(seq - pos);
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                slot->val = val;
+                __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Return false if the ring is empty */
+bool ring_pop(ring_t *r, uint64_t *val)
+{
+    uint64_t pos = r->tail;
+    ring_slot_t *slot = &r->slots[pos & r->mask];
+
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+        return false;
+    }
+
+    *val = slot->val;
+    __atomic_store_n(&slot->seq, pos + r->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&r->tail, pos + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/* A claimed slot may not be written yet, so it is only a hint */
+bool ring_empty(ring_t *r)
+{
+    return __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)
+           == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+}
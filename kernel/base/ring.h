@@ -0,0 +1,39 @@
+/**-----------------------------------------------------------------------------
+
+ @file    ring.h
+ @brief   Definition of bounded lock-free multi-producer single-consumer ring
+ @details
+ @verbatim
+
+  Any number of producers, including interrupt handlers, may push values
+  without taking a lock. Values are popped by one consumer at a time, so
+  consumers in more than one task must be serialized by the caller.
+
+  The number of slots must be a power of two. A full ring drops new values.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t seq;                   /* Round in which the slot is used */
+    uint64_t val;
+} ring_slot_t;
+
+typedef struct {
+    uint64_t    head __attribute__((aligned(64)));  /* Claimed by producers */
+    uint64_t    tail __attribute__((aligned(64)));  /* Moved by consumer */
+    uint64_t    mask;
+    ring_slot_t *slots;
+} ring_t;
+
+void ring_init(ring_t *r, ring_slot_t *slots, size_t size);
+bool ring_push(ring_t *r, uint64_t val);
+bool ring_pop(ring_t *r, uint64_t *val);
+bool ring_empty(ring_t *r);
@@ -0,0 +1,68 @@
+/**-----------------------------------------------------------------------------
+
+ @file    seqlock.h
+ @brief   Definition of sequence lock related functions
+ @details
+ @verbatim
+
+  A sequence lock protects small data which is read often and written
+  rarely. Readers take no lock: they read the data between two loads of
+  the sequence number and retry if a writer was active, i.e., if the
+  number was odd or has changed. Writers are serialized by the inner lock
+  and make the number odd while they change the data.
+
+    do {
+        seq = seqlock_read_begin(&sl);
+        ... copy the data ...
+    } while (seqlock_read_retry(&sl, seq));
+
+  Writers disable interrupts, so a reader on the same CPU never spins on an
+  unfinished write.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <base/lock.h>
+
+typedef struct {
+    uint64_t seq;                   /* Odd while a writer is active */
+    lock_t   lock;
+} seqlock_t;
+
+#define seqlock_new()       (seqlock_t){.seq = 0, .lock = LOCK_INIT}
+
+static inline uint64_t seqlock_read_begin(seqlock_t *sl)
+{
+    uint64_t seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1) {
+        asm volatile("pause");
+    }
+
+    return seq;
+}
+
+static inline bool seqlock_read_retry(seqlock_t *sl, uint64_t seq)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static inline void seqlock_write_begin(seqlock_t *sl)
+{
+    lock_lock(&sl->lock);
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqlock_write_end(seqlock_t *sl)
+{
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+    lock_release(&sl->lock);
+}
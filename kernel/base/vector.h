@@ -48,13 +48,22 @@
         (vec)->data[(vec)->len - 1] = elem;                         \
     }
 
+#define vec_insert(vec, index, elem)                                \
+    {                                                               \
+        vec_push_back(vec, elem);                                   \
+        for (size_t __i = (vec)->len - 1; __i > (index); __i--) {   \
+            (vec)->data[__i] = (vec)->data[__i - 1];                \
+        }                                                           \
+        (vec)->data[index] = elem;                                  \
+    }
+
 #define vec_length(vec)             (vec)->len
 #define vec_at(vec, index)          (vec)->data[index]
 
 #define vec_erase(vec, index)                                       \
     {                                                               \
         memcpy(&((vec)->data[index]), &((vec)->data[index + 1]),    \
-               sizeof((vec)->data[0]) * (vec)->len - index - 1);    \
+               sizeof((vec)->data[0]) * ((vec)->len - (index) - 1));\
         (vec)->len--;                                               \
     }
 
@@ -39,7 +39,7 @@ static const uint32_t font_colors[9] = {
 static term_info_t term_info = {0};
 static int term_active_mode = TERM_MODE_UNKNOWN; 
 static uint8_t term_cursor = 0;
-static lock_t term_lock = {0};
+static lock_t term_lock = lock_new();
 static bool term_need_redraw = false;
 
 static term_info_t term_cli = {0};
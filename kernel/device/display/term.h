@@ -30,6 +30,8 @@ void kdisplay(char* s);     /* Implemented in entry C file */
 #define FONT_WIDTH          8
 #define FONT_HEIGHT         15
 
+#define CURSOR_BLINK_MS     500
+
 typedef enum {
     CURSOR_INVISIBLE = 0,
     CURSOR_VISIBLE,
@@ -23,7 +23,7 @@
 #include <device/keyboard/keycode.h>
 #include <device/display/term.h>
 #include <base/klog.h>
-#include <base/lock.h>
+#include <base/ring.h>
 #include <base/time.h>
 #include <sys/isr_base.h>
 #include <sys/cpu.h>
@@ -32,13 +32,11 @@
 
 #define KB_BUFFER_SIZE    128
 
-static volatile uint8_t key_buffer[KB_BUFFER_SIZE + 1];
-static volatile uint8_t buffer_length = 0;
-static volatile uint8_t read_index = 0;
-static volatile uint8_t write_index = 0;
+/* Filled by the interrupt handler without lock */
+static ring_t key_ring;
+static ring_slot_t key_slots[KB_BUFFER_SIZE];
 
 static volatile keyboard_t ps2_kb = {0};
-static volatile lock_t kb_lock = lock_new();
 
 void keyboard_set_key(bool state, uint8_t keycode)
 {
@@ -77,7 +75,6 @@ static void keyboard_callback()
         /* Ctrl + Shift (Left) */
         if (ps2_kb.key_pressed[KB_LSHIFT] && ps2_kb.key_pressed[KB_LCTRL])
         {
-            lock_lock(&kb_lock);
             if (ch == '!' || ch == '1') {            /* Shift + '1' */
                 term_switch(TERM_MODE_CLI);
                 term_refresh(TERM_MODE_CLI);
@@ -85,63 +82,36 @@ static void keyboard_callback()
                 term_switch(TERM_MODE_INFO);
                 term_refresh(TERM_MODE_INFO);
             }
-            lock_release(&kb_lock);
             break;
         }
 
         if (ps2_kb.key_pressed[KB_LCTRL])
         {
-            if (buffer_length < KB_BUFFER_SIZE
-                && (ch == 'd' || ch == 'D'))
+            if (ch == 'd' || ch == 'D')
             {
-                lock_lock(&kb_lock);
-                key_buffer[write_index] = EOF; 
-                write_index++;
-                buffer_length++;
-                if (write_index == KB_BUFFER_SIZE) {
-                    write_index = 0;
-                }
-                lock_release(&kb_lock);
-                
+                ring_push(&key_ring, (uint8_t)EOF);
                 eb_publish(TID_NONE, EVENT_KEY_PRESSED, EOF);
                 klogd("keyboard: EOF recevied!\n");
                 break;
             }
         }
 
-        if (buffer_length < KB_BUFFER_SIZE) {
-            lock_lock(&kb_lock);
-            key_buffer[write_index] = ch;
-            write_index++;
-            buffer_length++;
-            if (write_index == KB_BUFFER_SIZE) {
-                write_index = 0;
-            }
-            lock_release(&kb_lock);
-        }
-
+        ring_push(&key_ring, (uint8_t)ch);
         eb_publish(TID_NONE, EVENT_KEY_PRESSED, ch);
         break;
     }
 }
 
+/* Return 0 if no key is buffered, only one task may call it at a time */
 uint8_t keyboard_get_key()
 {
-    if (buffer_length == 0) {
+    uint64_t ch = 0;
+
+    if (!ring_pop(&key_ring, &ch)) {
         return 0;
     }
-   
-    uint8_t ch = key_buffer[read_index];
- 
-    lock_lock(&kb_lock);
-    read_index++;
-    buffer_length--;
-    if (read_index == KB_BUFFER_SIZE) {
-        read_index = 0;
-    }
-    lock_release(&kb_lock);
-    
-    return ch;
+
+    return (uint8_t)ch;
 }
 
 static void mouse_wait(uint8_t type)
@@ -197,6 +167,8 @@ void keyboard_init()
 {
     isr_disable_interrupts();
 
+    ring_init(&key_ring, key_slots, KB_BUFFER_SIZE);
+
     /* don't let devices send data at the wrong time and mess up initialisation */
     port_outb(KEYBOARD_PORT_CMD, KEYBOARD_DISABLE_FIRST_PORT);
     port_outb(KEYBOARD_PORT_CMD, KEYBOARD_DISABLE_SECOND_PORT); /* ignored if not supported */
@@ -5,10 +5,12 @@
 #include <sys/isr_base.h>
 #include <sys/panic.h>
 #include <sys/pit.h>
+#include <sys/ktime.h>
 #include <device/storage/ata.h>
 #include <base/lock.h>
 #include <base/klog.h>
 #include <proc/sched.h>
+#include <proc/mutex.h>
 #include <fs/filebase.h>
 #include <fs/vfs.h>
 #include <fs/fat32.h>
@@ -28,7 +30,8 @@ static ata_device_t ata_primary_slave    = {.io_base = 0x1F0, .control = 0x3F6,
 static ata_device_t ata_secondary_master = {.io_base = 0x170, .control = 0x376, .slave = 0};
 static ata_device_t ata_secondary_slave  = {.io_base = 0x170, .control = 0x376, .slave = 1};
 
-static lock_t ata_lock;
+/* PIO transfers busy wait for the drive, so tasks sleep on the lock */
+static mutex_t ata_lock = mutex_new();
 
 /* Function Definition */
 static int ata_read_partition_map(ata_device_t* dev, char* devname);
@@ -117,8 +120,8 @@ static int ata_device_init(ata_device_t * dev)
     klogi("Waiting for ERR or DRQ.\n");
     /* Wait for ERR or DRQ */
     {
-        int timer = 0xFFFFFF;
-        while (timer--) {
+        uint64_t deadline = ktime_get_ns() + MILLIS_TO_NANOS(ATA_TIMEOUT_MS);
+        while (ktime_get_ns() < deadline) {
             status = port_inb(bus + ATA_REG_STATUS);
             if (status & ATA_SR_ERR) {
                 return 0;
@@ -138,8 +141,8 @@ c1:
             return 0;
         }
    
-        int timer2 = 0xFFFFFF;
-        while (timer2--) {
+        uint64_t deadline = ktime_get_ns() + MILLIS_TO_NANOS(ATA_TIMEOUT_MS);
+        while (ktime_get_ns() < deadline) {
             status = port_inb(bus + ATA_REG_STATUS);
             if ((status & ATA_SR_ERR))
                 return 0;
@@ -429,6 +432,8 @@ void ata_pio_read28(ata_device_t* dev, uint32_t lba, uint8_t sector_count, uint8
     uint16_t bus = dev->io_base;
     uint8_t slave = dev->slave;
 
+    mutex_lock(&ata_lock);
+
     ata_io_wait(dev);
 
     port_outb(bus + ATA_REG_HDDEVSEL,  0xE0 | slave << 4 | ((lba & 0x0f000000) >> 24));
@@ -451,6 +456,8 @@ void ata_pio_read28(ata_device_t* dev, uint32_t lba, uint8_t sector_count, uint8
     }
 
     ata_poll(dev, 0);
+
+    mutex_unlock(&ata_lock);
 }
 
 void ata_pio_write28(ata_device_t* dev, uint32_t lba, uint8_t sector_count, uint8_t* source)
@@ -458,6 +465,8 @@ void ata_pio_write28(ata_device_t* dev, uint32_t lba, uint8_t sector_count, uint
     uint16_t bus = dev->io_base;
     uint8_t slave = dev->slave;
 
+    mutex_lock(&ata_lock);
+
     ata_io_wait(dev);
 
     port_outb(bus + ATA_REG_HDDEVSEL,  0xE0 | slave << 4 | ((lba & 0x0f000000) >> 24));
@@ -487,6 +496,8 @@ void ata_pio_write28(ata_device_t* dev, uint32_t lba, uint8_t sector_count, uint
     ata_poll(dev, 0);
     port_outb(bus + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
     ata_poll(dev, 0);
+
+    mutex_unlock(&ata_lock);
 }
 
 int ata_read_partition_map(ata_device_t* dev, char* devname)
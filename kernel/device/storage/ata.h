@@ -79,6 +79,9 @@
 #define ATA_READ                0x00
 #define ATA_WRITE               0x01
 
+/* Time to wait for a device to respond when probing */
+#define ATA_TIMEOUT_MS          1000
+
 typedef struct {
     uint16_t base;
     uint16_t ctrl;
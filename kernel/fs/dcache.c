@@ -0,0 +1,203 @@
+/**-----------------------------------------------------------------------------
+
+ @file    dcache.c
+ @brief   Implementation of directory entry cache related functions
+ @details
+ @verbatim
+
+  The cache is a set-associative hash table. The bucket is selected by the
+  hash of the parent inode and the name, and every bucket has a fixed number
+  of slots, so the least recently used slot of a full bucket is evicted and
+  no memory is allocated at run time. Each bucket has its own lock.
+
+  A miss is filled by the path walker after it has scanned the children.
+  To avoid caching a result which has just become stale, the walker takes
+  the generation of the bucket before the scan, and dcache_insert() drops
+  the entry if dcache_add() or dcache_remove() has changed it since.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+
+#include <fs/dcache.h>
+#include <fs/filebase.h>
+#include <base/lock.h>
+#include <base/klog.h>
+
+typedef struct {
+    vfs_inode_t *parent;            /* NULL if the slot is free */
+    uint64_t    hash;
+    vfs_tnode_t *tnode;             /* NULL for a negative entry */
+    uint64_t    used;               /* Bucket clock of last use */
+    char        name[VFS_MAX_NAME_LEN];
+} dcache_entry_t;
+
+typedef struct {
+    lock_t         lock;
+    uint64_t       gen;             /* Changed when an entry is invalidated */
+    uint64_t       clock;
+    dcache_entry_t entries[DCACHE_BUCKET_WAYS];
+} dcache_bucket_t;
+
+static dcache_bucket_t dcache_buckets[DCACHE_BUCKETS] = {0};
+
+static uint64_t dcache_hits = 0, dcache_misses = 0;
+
+/* FNV-1a hash of the name, mixed with the parent inode */
+static uint64_t dcache_hash(vfs_inode_t *parent, const char *name)
+{
+    uint64_t h = 0xCBF29CE484222325ULL;
+
+    for (; *name != '\0'; name++) {
+        h ^= (uint8_t)*name;
+        h *= 0x100000001B3ULL;
+    }
+
+    return h ^ ((uint64_t)parent * 0x9E3779B97F4A7C15ULL);
+}
+
+static dcache_bucket_t *dcache_bucket(uint64_t hash)
+{
+    return &dcache_buckets[(hash ^ (hash >> 32)) & (DCACHE_BUCKETS - 1)];
+}
+
+/* Bucket lock must be held */
+static dcache_entry_t *dcache_find(dcache_bucket_t *b, vfs_inode_t *parent,
+                                   uint64_t hash, const char *name)
+{
+    for (size_t i = 0; i < DCACHE_BUCKET_WAYS; i++) {
+        dcache_entry_t *e = &b->entries[i];
+        if (e->parent == parent && e->hash == hash
+            && strncmp(e->name, name, sizeof(e->name)) == 0) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Look up "name" in folder "parent". Return true if it is cached, and
+ * "tnode" is NULL if the name is known not to exist. Otherwise "gen" is
+ * set for dcache_insert().
+ */
+bool dcache_lookup(vfs_inode_t *parent, const char *name,
+                   vfs_tnode_t **tnode, uint64_t *gen)
+{
+    uint64_t hash = dcache_hash(parent, name);
+    dcache_bucket_t *b = dcache_bucket(hash);
+    bool hit = false;
+
+    lock_lock(&b->lock);
+
+    dcache_entry_t *e = dcache_find(b, parent, hash, name);
+    if (e != NULL) {
+        e->used = ++b->clock;
+        *tnode = e->tnode;
+        hit = true;
+    } else {
+        *gen = b->gen;
+    }
+
+    lock_release(&b->lock);
+
+    __atomic_add_fetch(hit ? &dcache_hits : &dcache_misses, 1,
+                       __ATOMIC_RELAXED);
+
+    return hit;
+}
+
+/* Cache the result of a lookup which missed with generation "gen" */
+void dcache_insert(vfs_inode_t *parent, const char *name,
+                   vfs_tnode_t *tnode, uint64_t gen)
+{
+    uint64_t hash = dcache_hash(parent, name);
+    dcache_bucket_t *b = dcache_bucket(hash);
+
+    lock_lock(&b->lock);
+
+    if (b->gen != gen) goto exit;
+
+    dcache_entry_t *e = dcache_find(b, parent, hash, name);
+    if (e == NULL) {
+        /* Take a free slot, or evict the least recently used one */
+        e = &b->entries[0];
+        for (size_t i = 0; i < DCACHE_BUCKET_WAYS; i++) {
+            if (b->entries[i].parent == NULL) {
+                e = &b->entries[i];
+                break;
+            }
+            if (b->entries[i].used < e->used) e = &b->entries[i];
+        }
+        e->parent = parent;
+        e->hash = hash;
+        strncpy(e->name, name, sizeof(e->name) - 1);
+        e->name[sizeof(e->name) - 1] = '\0';
+    }
+    e->tnode = tnode;
+    e->used = ++b->clock;
+
+exit:
+    lock_release(&b->lock);
+}
+
+/* Set the entry of a child added to its parent folder */
+static void dcache_set(vfs_inode_t *parent, const char *name,
+                       vfs_tnode_t *tnode)
+{
+    uint64_t hash = dcache_hash(parent, name);
+    dcache_bucket_t *b = dcache_bucket(hash);
+
+    lock_lock(&b->lock);
+
+    b->gen++;
+    dcache_entry_t *e = dcache_find(b, parent, hash, name);
+    if (e != NULL) {
+        if (tnode != NULL) {
+            e->tnode = tnode;
+        } else {
+            e->parent = NULL;
+        }
+    }
+
+    lock_release(&b->lock);
+}
+
+/* Called after "tnode" is added to the children of its parent */
+void dcache_add(vfs_tnode_t *tnode)
+{
+    dcache_set(tnode->parent, tnode->name, tnode);
+}
+
+/* Called after "tnode" is removed from the children of its parent */
+void dcache_remove(vfs_tnode_t *tnode)
+{
+    dcache_set(tnode->parent, tnode->name, NULL);
+
+    /* The inode may be freed and reused, so forget its children */
+    if (IS_TRAVERSABLE(tnode->inode)) dcache_purge_dir(tnode->inode);
+}
+
+/* Drop all entries in folder "dir", e.g., when its inode is replaced */
+void dcache_purge_dir(vfs_inode_t *dir)
+{
+    for (size_t i = 0; i < DCACHE_BUCKETS; i++) {
+        dcache_bucket_t *b = &dcache_buckets[i];
+
+        lock_lock(&b->lock);
+        b->gen++;
+        for (size_t j = 0; j < DCACHE_BUCKET_WAYS; j++) {
+            if (b->entries[j].parent == dir) b->entries[j].parent = NULL;
+        }
+        lock_release(&b->lock);
+    }
+}
+
+void dcache_debug(void)
+{
+    klogd("DCACHE: %d hits and %d misses\n",
+          __atomic_load_n(&dcache_hits, __ATOMIC_RELAXED),
+          __atomic_load_n(&dcache_misses, __ATOMIC_RELAXED));
+}
@@ -0,0 +1,37 @@
+/**-----------------------------------------------------------------------------
+
+ @file    dcache.h
+ @brief   Definition of directory entry cache related functions
+ @details
+ @verbatim
+
+  The directory entry cache maps (parent inode, name) to the child tnode, so
+  a path component is resolved by one hash lookup instead of a scan over the
+  children of the parent. Names which do not exist are cached as negative
+  entries with a NULL tnode.
+
+  Code which adds a child to or removes it from a folder must call
+  dcache_add() or dcache_remove() after changing the children vector.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <fs/vfs.h>
+
+#define DCACHE_BUCKETS          512
+#define DCACHE_BUCKET_WAYS      4       /* Entries per bucket before eviction */
+
+bool dcache_lookup(vfs_inode_t *parent, const char *name,
+                   vfs_tnode_t **tnode, uint64_t *gen);
+void dcache_insert(vfs_inode_t *parent, const char *name,
+                   vfs_tnode_t *tnode, uint64_t gen);
+void dcache_add(vfs_tnode_t *tnode);
+void dcache_remove(vfs_tnode_t *tnode);
+void dcache_purge_dir(vfs_inode_t *dir);
+void dcache_debug(void);
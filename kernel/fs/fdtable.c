@@ -0,0 +1,251 @@
+/**-----------------------------------------------------------------------------
+
+ @file    fdtable.c
+ @brief   Implementation of file descriptor table related functions
+ @details
+ @verbatim
+
+  The table is a dense array which doubles when a descriptor beyond its end
+  is needed. The new array is allocated without the table lock held and
+  swapped in under it. Handles are only closed after the lock is released,
+  since closing the last reference may sleep on the VFS lock.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+#include <libc/errno.h>
+
+#include <fs/fdtable.h>
+#include <base/kmalloc.h>
+#include <base/klib.h>
+#include <sys/smp.h>
+
+void fdtable_init(fdtable_t *fdt)
+{
+    fdt->lock = lock_new();
+    fdt->size = 0;
+    fdt->fds = NULL;
+}
+
+/* Make sure the table has a slot for descriptor "fd" */
+static bool fdtable_grow(fdtable_t *fdt, int64_t fd)
+{
+    if (fd < 0 || fd >= FDTABLE_MAX) return false;
+
+    while (true) {
+        lock_lock(&fdt->lock);
+        size_t size = fdt->size;
+        lock_release(&fdt->lock);
+
+        if ((size_t)fd < size) return true;
+
+        size_t newsize = (size == 0) ? FDTABLE_INIT_SIZE : size * 2;
+        while (newsize <= (size_t)fd) newsize *= 2;
+        if (newsize > FDTABLE_MAX) newsize = FDTABLE_MAX;
+
+        fd_entry_t *fds = kmalloc(newsize * sizeof(fd_entry_t));
+        if (fds == NULL) return false;
+        memset(fds, 0, newsize * sizeof(fd_entry_t));
+
+        /* Somebody else may have grown it meanwhile */
+        lock_lock(&fdt->lock);
+        fd_entry_t *old = NULL;
+        if (fdt->size == size) {
+            if (size > 0) memcpy(fds, fdt->fds, size * sizeof(fd_entry_t));
+            old = fdt->fds;
+            fdt->fds = fds;
+            fdt->size = newsize;
+            fds = NULL;
+        }
+        lock_release(&fdt->lock);
+
+        if (old != NULL) kmfree(old);
+        if (fds != NULL) kmfree(fds);
+    }
+}
+
+/*
+ * Copy all descriptors of "src" into the empty table "dst". If "exec" is
+ * true, descriptors with FD_CLOEXEC are not copied.
+ */
+int64_t fdtable_copy(fdtable_t *dst, fdtable_t *src, bool exec)
+{
+    while (true) {
+        lock_lock(&src->lock);
+        size_t size = src->size;
+        lock_release(&src->lock);
+
+        if (size == 0) return 0;
+        if (!fdtable_grow(dst, size - 1)) {
+            cpu_set_errno(ENOMEM);
+            return -1;
+        }
+
+        lock_lock(&src->lock);
+        if (src->size != size) {
+            /* Grown while "dst" was allocated */
+            lock_release(&src->lock);
+            continue;
+        }
+        lock_lock(&dst->lock);
+        for (size_t fd = 0; fd < size; fd++) {
+            fd_entry_t e = src->fds[fd];
+            if (e.handle == VFS_INVALID_HANDLE) continue;
+            if (exec && (e.flags & FD_CLOEXEC)) continue;
+            dst->fds[fd].handle = vfs_dup(e.handle);
+            dst->fds[fd].flags = e.flags;
+        }
+        lock_release(&dst->lock);
+        lock_release(&src->lock);
+
+        return 0;
+    }
+}
+
+/* Close all descriptors and free the table */
+void fdtable_close_all(fdtable_t *fdt)
+{
+    lock_lock(&fdt->lock);
+    fd_entry_t *fds = fdt->fds;
+    size_t size = fdt->size;
+    fdt->fds = NULL;
+    fdt->size = 0;
+    lock_release(&fdt->lock);
+
+    for (size_t fd = 0; fd < size; fd++) {
+        if (fds[fd].handle != VFS_INVALID_HANDLE) vfs_close(fds[fd].handle);
+    }
+    if (fds != NULL) kmfree(fds);
+}
+
+/*
+ * Install the reference "handle" at the lowest free descriptor not less than
+ * "minfd", and return the descriptor. The reference is dropped on failure.
+ */
+int64_t fd_install(fdtable_t *fdt, vfs_handle_t handle, int64_t minfd,
+                   uint32_t flags)
+{
+    if (minfd < 0) minfd = 0;
+
+    while (true) {
+        lock_lock(&fdt->lock);
+        for (size_t fd = minfd; fd < fdt->size; fd++) {
+            if (fdt->fds[fd].handle == VFS_INVALID_HANDLE) {
+                fdt->fds[fd].handle = handle;
+                fdt->fds[fd].flags = flags;
+                lock_release(&fdt->lock);
+                return fd;
+            }
+        }
+        int64_t next = MAX((int64_t)fdt->size, minfd);
+        lock_release(&fdt->lock);
+
+        if (!fdtable_grow(fdt, next)) {
+            vfs_close(handle);
+            cpu_set_errno(EMFILE);
+            return -1;
+        }
+    }
+}
+
+/* Return the handle of "fd" with a reference taken, or VFS_INVALID_HANDLE */
+vfs_handle_t fd_get(fdtable_t *fdt, int64_t fd)
+{
+    vfs_handle_t handle = VFS_INVALID_HANDLE;
+
+    lock_lock(&fdt->lock);
+    if (fd >= 0 && (size_t)fd < fdt->size) {
+        handle = vfs_dup(fdt->fds[fd].handle);
+    }
+    lock_release(&fdt->lock);
+
+    return handle;
+}
+
+int64_t fd_close(fdtable_t *fdt, int64_t fd)
+{
+    vfs_handle_t handle = VFS_INVALID_HANDLE;
+
+    lock_lock(&fdt->lock);
+    if (fd >= 0 && (size_t)fd < fdt->size) {
+        handle = fdt->fds[fd].handle;
+        fdt->fds[fd].handle = VFS_INVALID_HANDLE;
+        fdt->fds[fd].flags = 0;
+    }
+    lock_release(&fdt->lock);
+
+    if (handle == VFS_INVALID_HANDLE) {
+        cpu_set_errno(EBADF);
+        return -1;
+    }
+
+    return vfs_close(handle);
+}
+
+/*
+ * Make "newfd" refer to the same open file as "fd", closing the file "newfd"
+ * referred to before. Return "newfd".
+ */
+int64_t fd_dup(fdtable_t *fdt, int64_t fd, int64_t newfd, uint32_t flags)
+{
+    if (!fdtable_grow(fdt, newfd)) {
+        cpu_set_errno(EBADF);
+        return -1;
+    }
+
+    vfs_handle_t old = VFS_INVALID_HANDLE;
+
+    lock_lock(&fdt->lock);
+    if (fd < 0 || (size_t)fd >= fdt->size
+        || fdt->fds[fd].handle == VFS_INVALID_HANDLE)
+    {
+        lock_release(&fdt->lock);
+        cpu_set_errno(EBADF);
+        return -1;
+    }
+    if (fd != newfd) {
+        old = fdt->fds[newfd].handle;
+        fdt->fds[newfd].handle = vfs_dup(fdt->fds[fd].handle);
+    }
+    fdt->fds[newfd].flags = flags;
+    lock_release(&fdt->lock);
+
+    if (old != VFS_INVALID_HANDLE) vfs_close(old);
+
+    return newfd;
+}
+
+int64_t fd_get_flags(fdtable_t *fdt, int64_t fd)
+{
+    int64_t flags = -1;
+
+    lock_lock(&fdt->lock);
+    if (fd >= 0 && (size_t)fd < fdt->size
+        && fdt->fds[fd].handle != VFS_INVALID_HANDLE)
+    {
+        flags = fdt->fds[fd].flags;
+    }
+    lock_release(&fdt->lock);
+
+    if (flags < 0) cpu_set_errno(EBADF);
+    return flags;
+}
+
+int64_t fd_set_flags(fdtable_t *fdt, int64_t fd, uint32_t flags)
+{
+    int64_t ret = -1;
+
+    lock_lock(&fdt->lock);
+    if (fd >= 0 && (size_t)fd < fdt->size
+        && fdt->fds[fd].handle != VFS_INVALID_HANDLE)
+    {
+        fdt->fds[fd].flags = flags;
+        ret = 0;
+    }
+    lock_release(&fdt->lock);
+
+    if (ret < 0) cpu_set_errno(EBADF);
+    return ret;
+}
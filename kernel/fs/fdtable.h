@@ -0,0 +1,54 @@
+/**-----------------------------------------------------------------------------
+
+ @file    fdtable.h
+ @brief   Definition of file descriptor table related functions
+ @details
+ @verbatim
+
+  Every process has a table of file descriptors which is indexed directly by
+  the descriptor number from 0. A slot holds a reference to a VFS handle, so
+  descriptors copied by dup or fork share the open file and its seek
+  position, and the file is closed when the last descriptor is closed.
+
+  fd_get() returns the handle with a reference taken, which must be dropped
+  by vfs_close() when the caller is done with it.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <base/lock.h>
+#include <fs/vfs.h>
+
+#define FD_CLOEXEC          1       /* Close the descriptor on execve */
+
+#define FDTABLE_INIT_SIZE   16
+#define FDTABLE_MAX         1024
+
+typedef struct {
+    vfs_handle_t handle;            /* VFS_INVALID_HANDLE if free */
+    uint32_t     flags;
+} fd_entry_t;
+
+typedef struct {
+    lock_t     lock;
+    size_t     size;                /* Number of slots in "fds" */
+    fd_entry_t *fds;
+} fdtable_t;
+
+void fdtable_init(fdtable_t *fdt);
+int64_t fdtable_copy(fdtable_t *dst, fdtable_t *src, bool exec);
+void fdtable_close_all(fdtable_t *fdt);
+
+int64_t fd_install(fdtable_t *fdt, vfs_handle_t handle, int64_t minfd,
+                   uint32_t flags);
+vfs_handle_t fd_get(fdtable_t *fdt, int64_t fd);
+int64_t fd_close(fdtable_t *fdt, int64_t fd);
+int64_t fd_dup(fdtable_t *fdt, int64_t fd, int64_t newfd, uint32_t flags);
+int64_t fd_get_flags(fdtable_t *fdt, int64_t fd);
+int64_t fd_set_flags(fdtable_t *fdt, int64_t fd, uint32_t flags);
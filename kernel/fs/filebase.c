@@ -9,6 +9,9 @@
   node) related functions, e.g., alloc, free and node to fd (file descriptor),
   path to node conversions.
 
+  Path components are looked up in the directory entry cache first, and the
+  children of a folder are only scanned on a cache miss.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -17,14 +20,11 @@
 #include <libc/errno.h>
 
 #include <fs/filebase.h>
+#include <fs/dcache.h>
 #include <base/kmalloc.h>
-#include <base/hash.h>
-#include <sys/hpet.h>
+#include <sys/ktime.h>
 #include <sys/cmos.h>
 
-/* List of opened files */
-extern ht_t vfs_openfiles;
-
 /* Allocate a tnode in memory */
 vfs_tnode_t *vfs_alloc_tnode(const char *name, vfs_inode_t *inode,
                              vfs_inode_t* parent)
@@ -62,26 +62,20 @@ vfs_inode_t *vfs_alloc_inode(vfs_node_type_t type, uint32_t perms,
     return inode;
 }
 
-/* Free a tnode, and the inode if needed */
+/* Free a tnode, and the inode if needed, after lockless path walkers */
 void vfs_free_nodes(vfs_tnode_t* tnode)
 {
     vfs_inode_t* inode = tnode->inode;
     if (inode->refcount <= 0)
-        kmfree(inode);
-    kmfree(tnode);
-}
-
-/* Return the node descriptor for a handle */
-vfs_node_desc_t* vfs_handle_to_fd(vfs_handle_t handle)
-{
-    return ht_search(&vfs_openfiles, handle);
+        rcu_kfree(inode);
+    rcu_kfree(tnode);
 }
 
 /* Convert a path to a node, creates the node if required */
 vfs_tnode_t* vfs_path_to_node(
     const char* path, uint8_t mode, vfs_node_type_t create_type)
 {
-    static char tmpbuff[VFS_MAX_PATH_LEN];
+    char tmpbuff[VFS_MAX_NAME_LEN] = {0};
     vfs_tnode_t* curr = &vfs_root;
 
     /*  Only work with absolute paths */
@@ -91,6 +85,9 @@ vfs_tnode_t* vfs_path_to_node(
     }
     path++; /* Skip the leading slash */
 
+    /* Walk the tree without lock, nodes are changed under vfs_lock by RCU */
+    rcu_read_lock();
+
     size_t pathlen = strlen(path), curr_index;
     bool foundnode = true;
     for (curr_index = 0; curr_index < pathlen;) {
@@ -99,25 +96,49 @@ vfs_tnode_t* vfs_path_to_node(
         for (i = 0; curr_index + i < pathlen; i++) {
             if (path[curr_index + i] == '/')
                 break;
+            if (i == sizeof(tmpbuff) - 1) {
+                rcu_read_unlock();
+                cpu_set_errno(ENAMETOOLONG);
+                return NULL;
+            }
             tmpbuff[i] = path[curr_index + i];
         }
         tmpbuff[i] = '\0';
         curr_index += i + 1;
 
-        /* Search for token in children of current node */
         foundnode = false;
-        if (!IS_TRAVERSABLE(curr->inode))
+        vfs_inode_t *inode = rcu_dereference(curr->inode);
+        if (!IS_TRAVERSABLE(inode))
             break;
-        for (size_t i = 0; i < curr->inode->child.len; i++) {
-            vfs_tnode_t* child = vec_at(&(curr->inode->child), i);
+
+        /* Try the dentry cache, a NULL node means the token doesn't exist */
+        vfs_tnode_t *cached = NULL;
+        uint64_t gen = 0;
+        if (dcache_lookup(inode, tmpbuff, &cached, &gen)) {
+            if (cached == NULL) break;
+            foundnode = true;
+            curr = cached;
+            continue;
+        }
+
+        /* Search for token in children of current node */
+        size_t num = vec_rcu_len(&inode->child);
+        vfs_tnode_t **children = vec_rcu_data(&inode->child);
+        for (size_t i = 0; i < num; i++) {
+            vfs_tnode_t* child = children[i];
+            if (child == NULL) continue;
             if (strncmp(child->name, tmpbuff, sizeof(child->name)) == 0) {
                 foundnode = true;
                 curr = child;
                 break;
             }
         }
+        dcache_insert(inode, tmpbuff, foundnode ? curr : NULL, gen);
+        if (!foundnode) break;
     }
 
+    rcu_read_unlock();
+
     /* Should we create the node */
     if (!foundnode) {
         /* Only folders can contain files */
@@ -133,7 +154,7 @@ vfs_tnode_t* vfs_path_to_node(
             vfs_inode_t* new_inode = vfs_alloc_inode(
                 create_type, 0/*777*/, 0, curr->inode->fs, curr->inode->mountpoint);
 
-            uint64_t now_sec = hpet_get_nanos() / 1000000000;
+            uint64_t now_sec = ktime_get_ns() / 1000000000;
 
             time_t boot_time = cmos_boot_time();
             time_t now_time = now_sec + boot_time;
@@ -142,7 +163,8 @@ vfs_tnode_t* vfs_path_to_node(
             vfs_tnode_t* new_tnode = 
                 vfs_alloc_tnode(tmpbuff, new_inode, curr->inode);
 
-            vec_push_back(&(curr->inode->child), new_tnode);
+            vec_push_back_rcu(&(curr->inode->child), new_tnode);
+            dcache_add(new_tnode);
             if (curr->inode->fs != NULL) curr->inode->fs->mknode(new_tnode);
             if (strncmp(path, "usr/local", 9) == 0
                 || strncmp(path, "/usr/bin", 8) == 0)
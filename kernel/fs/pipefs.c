@@ -4,11 +4,13 @@
 
 #include <fs/pipefs.h>
 #include <fs/filebase.h>
+#include <fs/dcache.h>
 #include <base/kmalloc.h>
 #include <base/klog.h>
 #include <base/klib.h>
 #include <sys/panic.h>
 #include <sys/mm.h>
+#include <proc/waitqueue.h>
 
 #define PIPE_BUFFER_SIZE    4096
 
@@ -26,15 +28,23 @@ vfs_fsinfo_t pipefs = {
     .read = pipefs_read,
     .getdent = NULL,
     .write = pipefs_write,
-    .ioctl = NULL
+    .ioctl = NULL,
+    .opened = pipefs_opened,
+    .closed = pipefs_closed
 };
 
-lock_t pipe_lock;
+/*
+ * Pipe operations only copy the buffer, so a spinlock is enough. Readers are
+ * called without vfs_lock, see vfs_read().
+ */
+lock_t pipe_lock = lock_new();
 
 /* Identifying information for a node */
 typedef struct {
     char    buff[PIPE_BUFFER_SIZE];
     int64_t size;
+    int64_t writers;                /* Open files which can write */
+    waitqueue_t readers;
 } pipefs_ident_t;
 
 static pipefs_ident_t *create_ident()
@@ -65,7 +75,7 @@ int64_t pipefs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
     pipefs_ident_t *id = this->ident;
     size_t rlen = 0;
 
-    if (id->size == 0 || len == 0) return 0;
+    if (len == 0) return 0;
 
     klogd("PIPEFS: read %d bytes to buffer 0x%x\n", len, buff);
 
@@ -74,7 +84,19 @@ int64_t pipefs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
     /* We do not use offset here */
     (void)offset;
 
-    /* Below codes depend on the conduction checking at beginning */
+    /* Wait for data while a writer is left, otherwise it is end of file */
+    while (id->size == 0 && id->writers > 0) {
+        waitqueue_prepare(&id->readers, 0);
+        lock_release(&pipe_lock);
+        waitqueue_wait(&id->readers, NULL);
+        lock_lock(&pipe_lock);
+    }
+
+    if (id->size == 0) {
+        lock_release(&pipe_lock);
+        return 0;
+    }
+
     rlen = id->size;
     if (rlen > len) rlen = len;
     memcpy(buff, id->buff, rlen);
@@ -117,9 +139,41 @@ int64_t pipefs_write(vfs_inode_t* this, size_t offset, size_t len,
 
     lock_release(&pipe_lock);
 
+    if (wlen > 0) waitqueue_wake_all(&id->readers, 0);
+
     return wlen;
 }
 
+static bool pipefs_can_write(vfs_openmode_t mode)
+{
+    return mode == VFS_MODE_WRITE || mode == VFS_MODE_READWRITE;
+}
+
+void pipefs_opened(vfs_inode_t *this, vfs_openmode_t mode)
+{
+    pipefs_ident_t *id = this->ident;
+
+    if (id == NULL || !pipefs_can_write(mode)) return;
+
+    lock_lock(&pipe_lock);
+    id->writers++;
+    lock_release(&pipe_lock);
+}
+
+/* Readers see end of file after the last writer is closed */
+void pipefs_closed(vfs_inode_t *this, vfs_openmode_t mode)
+{
+    pipefs_ident_t *id = this->ident;
+
+    if (id == NULL || !pipefs_can_write(mode)) return;
+
+    lock_lock(&pipe_lock);
+    bool last = (--id->writers == 0);
+    lock_release(&pipe_lock);
+
+    if (last) waitqueue_wake_all(&id->readers, 0);
+}
+
 int64_t pipefs_mknode(vfs_tnode_t* this)
 {
     this->inode->ident = create_ident();
@@ -131,6 +185,7 @@ int64_t pipefs_rmnode(vfs_tnode_t *this)
     pipefs_ident_t *id = (pipefs_ident_t*)this->inode->ident;
 
     if (id == NULL) goto err_exit;
+    vec_erase_all(&id->readers.tasks);
     kmfree(id);
 
     vfs_inode_t *parent = this->parent;
@@ -139,7 +194,8 @@ int64_t pipefs_rmnode(vfs_tnode_t *this)
         for (size_t i = 0; i < child_num; i++) {
             vfs_tnode_t *t = vec_at(&parent->child, i); 
             if (t == this) {
-                vec_erase(&parent->child, i); 
+                vec_erase_rcu(&parent->child, i);
+                dcache_remove(this);
                 return 0;
             }
         }
@@ -21,6 +21,8 @@ int64_t pipefs_rmnode(vfs_tnode_t *this);
 vfs_tnode_t* pipefs_open(vfs_inode_t *this, const char *path);
 int64_t pipefs_read(vfs_inode_t *this, size_t offset, size_t len, void *buff);
 int64_t pipefs_write(vfs_inode_t *this, size_t offset, size_t len, const void *buff);
+void pipefs_opened(vfs_inode_t *this, vfs_openmode_t mode);
+void pipefs_closed(vfs_inode_t *this, vfs_openmode_t mode);
 
 void pipefs_init(void);
 
@@ -2,6 +2,7 @@
 
 #include <fs/ramfs.h>
 #include <fs/filebase.h>
+#include <fs/dcache.h>
 #include <base/kmalloc.h>
 #include <base/klog.h>
 #include <base/klib.h>
@@ -327,7 +328,8 @@ int64_t ramfs_rmnode(vfs_tnode_t *this)
         for (size_t i = 0; i < child_num; i++) {
             vfs_tnode_t *t = vec_at(&parent->child, i); 
             if (t == this) {
-                vec_erase(&parent->child, i); 
+                vec_erase_rcu(&parent->child, i);
+                dcache_remove(this);
                 return 0;
             }
         }
@@ -84,7 +84,7 @@ vfs_fsinfo_t ttyfs = {
 };
 
 vfs_handle_t ttyfh = VFS_INVALID_HANDLE;
-lock_t tty_lock;
+mutex_t tty_lock = mutex_new();
 
 /* Identifying information for a node */
 typedef struct {
@@ -122,7 +122,7 @@ int64_t ttyfs_ioctl(vfs_inode_t *this, int64_t request, int64_t arg)
     ttyfs_ident_t *id = this->ident;
     int64_t ret = -1;
 
-    lock_lock(&tty_lock);
+    mutex_lock(&tty_lock);
 
     if (request == TIOCGWINSZ) {        /* 0x5413 */
         winsize_t *ws = (winsize_t*)arg;
@@ -148,7 +148,7 @@ int64_t ttyfs_ioctl(vfs_inode_t *this, int64_t request, int64_t arg)
         klogd("ttyfs_ioctl: TCSETS sets termios\n");
     }
 
-    lock_release(&tty_lock);
+    mutex_unlock(&tty_lock);
 
     if (ret < 0) cpu_set_errno(EINVAL);
 
@@ -166,7 +166,7 @@ int64_t ttyfs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
 {
     ttyfs_ident_t *id = this->ident;
 
-    lock_lock(&tty_lock);
+    mutex_lock(&tty_lock);
 
     /* Do not care about offset in current implementation */
     (void)offset;
@@ -174,11 +174,10 @@ int64_t ttyfs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
     /* If read less than len bytes, wait until there are enough data */
     while (id->isize < (int64_t)len) {
         event_para_t para = 0;
-        lock_release(&tty_lock);
-        lock_release(&vfs_lock);    /* If waiting, we need to release lock */
-        if (eb_subscribe(sched_get_tid(), EVENT_KEY_PRESSED, &para)) {
-            lock_lock(&tty_lock);
-
+        mutex_unlock(&tty_lock);    /* Writers may print while waiting */
+        bool pressed = eb_subscribe(sched_get_tid(), EVENT_KEY_PRESSED, &para);
+        mutex_lock(&tty_lock);
+        if (pressed) {
             /* We maximumly backtrace half of TTY_BUFFER_SIZE to determine
              * whether the backspace key should be accepted or not
              */
@@ -199,10 +198,7 @@ int64_t ttyfs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
                     kpanic("TTYFS: input buffer overflow\n");
                 }
             }
-        } else {
-            lock_lock(&tty_lock);
         }
-        lock_lock(&vfs_lock);
     }
 
     /* OK, data is enough! Read data from input buffer */
@@ -230,7 +226,7 @@ int64_t ttyfs_read(vfs_inode_t* this, size_t offset, size_t len, void *buff)
     id->icursor %= TTY_BUFFER_SIZE;
     id->isize   -= rlen;
 
-    lock_release(&tty_lock);
+    mutex_unlock(&tty_lock);
 
     return rlen;
 }
@@ -241,7 +237,7 @@ int64_t ttyfs_write(vfs_inode_t* this, size_t offset, size_t len,
     ttyfs_ident_t *id = this->ident;
     int64_t wlen = 0;
 
-    lock_lock(&tty_lock);
+    mutex_lock(&tty_lock);
 
     /* Do not care about offset in current implementation */
     (void)offset;
@@ -269,7 +265,7 @@ int64_t ttyfs_write(vfs_inode_t* this, size_t offset, size_t len,
         wlen = len;
     }
 
-    lock_release(&tty_lock);
+    mutex_unlock(&tty_lock);
 
     return wlen;
 }
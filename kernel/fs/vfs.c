@@ -23,6 +23,7 @@
 
 #include <fs/vfs.h>
 #include <fs/filebase.h>
+#include <fs/dcache.h>
 #include <fs/fat32.h>
 #include <fs/ramfs.h>
 #include <fs/ttyfs.h>
@@ -31,17 +32,14 @@
 #include <base/kmalloc.h>
 #include <base/lock.h>
 #include <base/vector.h>
-#include <base/hash.h>
+#include <sys/ktime.h>
 
 static bool vfs_initialized = false;
 
-/* VFS wide lock */
-lock_t vfs_lock = {0};
+/* VFS wide lock, held across disk I/O so it is a sleeping mutex */
+mutex_t vfs_lock = mutex_new();
 
 /* Stat structure related definitions */
-lock_t dev_lock = {0};
-lock_t ino_lock = {0};
-
 static dev_t next_new_dev_id = 1;
 static ino_t next_new_ino_id = 1;
 
@@ -51,35 +49,15 @@ vfs_tnode_t vfs_root = {0};
 /* List of installed filesystems */
 vec_new_static(vfs_fsinfo_t*, vfs_fslist);
 
-/* List of opened files */
-ht_t vfs_openfiles;
-
-/* New file handle */
-static size_t vfs_next_handle = VFS_MIN_HANDLE; 
-
 /* Stat structure related function implementations */
 dev_t vfs_new_dev_id(void)
 {
-    dev_t dev_id;
-
-    lock_lock(&dev_lock);
-    dev_id = next_new_dev_id;
-    next_new_dev_id++;
-    lock_release(&dev_lock);
-
-    return dev_id;    
+    return __atomic_fetch_add(&next_new_dev_id, 1, __ATOMIC_RELAXED);
 }
 
 ino_t vfs_new_ino_id(void)
 {
-    ino_t ino_id;
-
-    lock_lock(&ino_lock);
-    ino_id = next_new_ino_id;
-    next_new_ino_id++;
-    lock_release(&ino_lock);
-
-    return ino_id; 
+    return __atomic_fetch_add(&next_new_ino_id, 1, __ATOMIC_RELAXED);
 }
 
 static void dumpnodes_helper(vfs_tnode_t* from, int lvl)
@@ -98,21 +76,35 @@ void vfs_debug()
     kprintf("Dumping VFS nodes:\n");
     dumpnodes_helper(&vfs_root, 0);
     kprintf("Dumping done.\n");
+    dcache_debug();
 }
 
 void vfs_register_fs(vfs_fsinfo_t* fs)
 {
-    vec_push_back(&vfs_fslist, fs);
+    mutex_lock(&vfs_lock);
+    vec_push_back_rcu(&vfs_fslist, fs);
+    mutex_unlock(&vfs_lock);
 }
 
+/* Filesystems are never unregistered, so the result stays valid */
 vfs_fsinfo_t* vfs_get_fs(char* name)
 {
-    for (size_t i = 0; i < vfs_fslist.len; i++)
-        if (strncmp(name, vfs_fslist.data[i]->name, sizeof(((vfs_fsinfo_t) { 0 }).name)) == 0)
-            return vfs_fslist.data[i];
+    vfs_fsinfo_t* fs = NULL;
+
+    rcu_read_lock();
+    size_t num = vec_rcu_len(&vfs_fslist);
+    vfs_fsinfo_t** list = vec_rcu_data(&vfs_fslist);
+    for (size_t i = 0; i < num; i++) {
+        if (list[i] != NULL && strncmp(name, list[i]->name,
+                sizeof(((vfs_fsinfo_t) { 0 }).name)) == 0) {
+            fs = list[i];
+            break;
+        }
+    }
+    rcu_read_unlock();
 
-    kloge("Filesystem %s not found\n", name);
-    return NULL;
+    if (fs == NULL) kloge("Filesystem %s not found\n", name);
+    return fs;
 }
 
 void vfs_init()
@@ -133,9 +125,6 @@ void vfs_init()
     vfs_register_fs(&ttyfs);
     vfs_register_fs(&pipefs);
 
-    /* Init the hash list of open files */
-    ht_init(&vfs_openfiles);
-
     char* fn = "/";
 
     /* Mount RAMFS without device name (NULL) */
@@ -168,14 +157,14 @@ void vfs_init()
 int64_t vfs_create(char* path, vfs_node_type_t type)
 {
     int64_t status = 0;
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     vfs_tnode_t* tnode = vfs_path_to_node(path, CREATE | ERR_ON_EXIST, type);
     if (tnode == NULL) {
         status = -1;
     } else {
         /* Set the file time */
-        uint64_t now_sec = hpet_get_nanos() / 1000000000;
+        uint64_t now_sec = ktime_get_ns() / 1000000000;
         time_t boot_time = cmos_boot_time();
 
         time_t file_time = now_sec + boot_time;
@@ -189,14 +178,14 @@ int64_t vfs_create(char* path, vfs_node_type_t type)
         tnode->st.st_ctim.tv_nsec = 0;
     }
 
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return status;
 }
 
 /* Changes permissions of node */
 int64_t vfs_chmod(vfs_handle_t handle, int32_t newperms)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd)
         return -1;
 
@@ -215,7 +204,7 @@ int64_t vfs_chmod(vfs_handle_t handle, int32_t newperms)
 
 int64_t vfs_ioctl(vfs_handle_t handle, int64_t request, int64_t arg)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd)
         return -1; 
 
@@ -229,7 +218,7 @@ int64_t vfs_ioctl(vfs_handle_t handle, int64_t request, int64_t arg)
 /* Mounts a block device with specified filesystem at a path */
 int64_t vfs_mount(char* device, char* path, char* fsname)
 {
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     /* Get the fs info */
     vfs_fsinfo_t* fs = vfs_get_fs(fsname);
@@ -256,52 +245,55 @@ int64_t vfs_mount(char* device, char* path, char* fsname)
         kloge("'%s' is not an empty folder\n", path);
         goto fail;
     }
-    kmfree(at->inode);
-
-    /* Mount the fs */
-    at->inode = fs->mount(dev ? dev->inode : NULL);
-    at->inode->mountpoint = at;
+    /* Mount the fs, path walkers may still see the old inode */
+    vfs_inode_t* old = at->inode;
+    vfs_inode_t* inode = fs->mount(dev ? dev->inode : NULL);
+    inode->mountpoint = at;
+    rcu_assign_pointer(at->inode, inode);
+    dcache_purge_dir(old);
+    rcu_kfree(old);
 
     klogi("Mounted %s at %s as %s\n", device ? device : "<no-device>", path, fsname);
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return 0;
 fail:
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return -1;
 }
 
 /* Get the length of a file */
 int64_t vfs_tell(vfs_handle_t handle)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
-
-    if (!fd) { 
+    vfs_node_desc_t* fd = handle;
+    if (!fd)
         return 0;
-    } else {
-        vfs_inode_t* inode = fd->inode;
-        return inode->size;
-    }
+
+    return fd->inode->size;
 }
 
-/* Read specified number of bytes from a file */
+/*
+ * Read specified number of bytes from a file. Readers of tty device and pipes
+ * may sleep until data arrives, so they are called without vfs_lock. The node
+ * is kept by the open file, and they have no seek position.
+ */
 int64_t vfs_read(vfs_handle_t handle, size_t len, void* buff)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd) {
         return 0;
     }
 
-    lock_lock(&vfs_lock);
-
     vfs_inode_t* inode = fd->inode;
 
-    /*
-     * 1. Truncate if asking for more data than available
-     * 2. Return directly if remaining length is zero except tty device
-     */
-    if (fd->seek_pos + len > inode->size
-        && handle != ttyfh)
-    {
+    if (inode->fs == &ttyfs || inode->fs == &pipefs) {
+        int64_t status = inode->fs->read(inode, 0, len, buff);
+        return (status < 0) ? 0 : status;
+    }
+
+    mutex_lock(&vfs_lock);
+
+    /* Truncate if asking for more data than available */
+    if (fd->seek_pos + len > inode->size) {
         len = inode->size - fd->seek_pos;
         if (len == 0)
             goto end;
@@ -313,7 +305,7 @@ int64_t vfs_read(vfs_handle_t handle, size_t len, void* buff)
 
     fd->seek_pos += len;
 end:
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return (int64_t)len;
 }
 
@@ -324,7 +316,7 @@ int64_t vfs_unlink(char *path)
 {
     klogd("VFS: unlink %s\n", path);
 
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     /* Find the node and set st_nlink parameter */
     vfs_tnode_t* req = vfs_path_to_node(path, NO_CREATE, 0); 
@@ -351,18 +343,18 @@ int64_t vfs_unlink(char *path)
         }
     }
 
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return 0;
 
 fail:
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return -1;
 }
 
 /* Write specified number of bytes to file */
 int64_t vfs_write(vfs_handle_t handle, size_t len, const void* buff)
 {
-    vfs_node_desc_t* nd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* nd = handle;
     if (!nd)
         return 0;
 
@@ -372,7 +364,7 @@ int64_t vfs_write(vfs_handle_t handle, size_t len, const void* buff)
         return 0;
     }
 
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
     vfs_inode_t* inode = nd->inode;
 
     /* Expand file if writing more data than its size */
@@ -388,18 +380,18 @@ int64_t vfs_write(vfs_handle_t handle, size_t len, const void* buff)
     /* Set file size to stat data structure */
     nd->tnode->st.st_size = nd->inode->size;
 
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return (int64_t)len;
 }
 
 /* Seek to specified position in file */
 int64_t vfs_seek(vfs_handle_t handle, size_t pos, int64_t whence)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd)
         return -1;
 
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     int64_t offset = -1;
     switch (whence) {
@@ -420,7 +412,7 @@ int64_t vfs_seek(vfs_handle_t handle, size_t pos, int64_t whence)
         klogd("Seek position out of bounds: %d(0x%x):%d in len %d with "
               "offset %d\n",
               pos, pos, whence, fd->inode->size, fd->seek_pos);
-        lock_release(&vfs_lock);
+        mutex_unlock(&vfs_lock);
         return -1; 
     }
 
@@ -430,7 +422,7 @@ int64_t vfs_seek(vfs_handle_t handle, size_t pos, int64_t whence)
         ret = offset;
     }
 
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return ret;
 }
 
@@ -476,7 +468,7 @@ int64_t vfs_get_parent_dir(const char *path, char *parent, char *currdir)
 
 vfs_handle_t vfs_open(char* path, vfs_openmode_t mode)
 {
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     klogd("VFS: open %s with mode 0x%8x\n", path, mode);
 
@@ -517,42 +509,59 @@ vfs_handle_t vfs_open(char* path, vfs_openmode_t mode)
     nd->inode = req->inode;
     nd->seek_pos = 0;
     nd->mode = mode;
+    nd->refcount = 1;
+
+    if (req->inode->fs != NULL && req->inode->fs->opened != NULL) {
+        req->inode->fs->opened(req->inode, mode);
+    }
 
     /* If this is a symlink, we should set the real file size */
     /* TODO: Need to consider in the future */
     nd->tnode->st.st_size = req->inode->size;
 
     /* Return the handle */
-    vfs_handle_t fh = vfs_next_handle++;
+    vfs_handle_t fh = nd;
 
-    /* Add to current task */
-    ht_insert(&vfs_openfiles, fh, nd);
-    
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
 
     klogd("VFS: Open %s with mode 0x%x and return handle %d, nd = 0x%x\n",
           path, mode, fh, nd);
 
     return fh;
 fail:
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return VFS_INVALID_HANDLE;
 }
 
+/* Take another reference to an open file */
+vfs_handle_t vfs_dup(vfs_handle_t handle)
+{
+    if (handle != VFS_INVALID_HANDLE) {
+        __atomic_add_fetch(&handle->refcount, 1, __ATOMIC_RELAXED);
+    }
+
+    return handle;
+}
+
+/* Drop a reference to an open file, and close it with the last one */
 int64_t vfs_close(vfs_handle_t handle)
 {
     klogv("VFS: close file handle %d\n", handle);
 
-    lock_lock(&vfs_lock);
-
-    vfs_node_desc_t *fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t *fd = handle;
     if (!fd)
-        goto fail;
+        return -1;
 
-    fd->inode->refcount--;
-    kmfree(fd);
+    if (__atomic_sub_fetch(&fd->refcount, 1, __ATOMIC_ACQ_REL) > 0)
+        return 0;
 
-    ht_delete(&vfs_openfiles, handle);
+    mutex_lock(&vfs_lock);
+
+    if (fd->inode->fs != NULL && fd->inode->fs->closed != NULL) {
+        fd->inode->fs->closed(fd->inode, fd->mode);
+    }
+
+    fd->inode->refcount--;
 
     /* Remove this file if needed */
     if (fd->inode->refcount == 0 && fd->tnode->st.st_nlink == 0) {
@@ -562,20 +571,19 @@ int64_t vfs_close(vfs_handle_t handle)
         }
     }
 
-    lock_release(&vfs_lock);
+    kmfree(fd);
+
+    mutex_unlock(&vfs_lock);
     return 0;
-fail:
-    lock_release(&vfs_lock);
-    return -1;
 }
 
 int64_t vfs_refresh(vfs_handle_t handle)
 {
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd)
         return -1; 
 
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
     fd->inode->fs->refresh(fd->inode);
     for (size_t i = 0; ; i++) {
         vfs_dirent_t de;
@@ -589,7 +597,7 @@ int64_t vfs_refresh(vfs_handle_t handle)
         memcpy(&tn->inode->tm, &de.tm, sizeof(tm_t));
         tn->inode->size = de.size;
     }
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
 
     return 0;
 }
@@ -597,11 +605,11 @@ int64_t vfs_refresh(vfs_handle_t handle)
 /* Get next directory entry */
 int64_t vfs_getdent(vfs_handle_t handle, vfs_dirent_t* dirent) {
     int64_t status;
-    vfs_node_desc_t* fd = vfs_handle_to_fd(handle);
+    vfs_node_desc_t* fd = handle;
     if (!fd)
         return -1;
 
-    lock_lock(&vfs_lock);
+    mutex_lock(&vfs_lock);
 
     /* Can only traverse folders */
     if (!IS_TRAVERSABLE(fd->inode)) {
@@ -629,7 +637,7 @@ int64_t vfs_getdent(vfs_handle_t handle, vfs_dirent_t* dirent) {
     fd->seek_pos++;
 
 done:
-    lock_release(&vfs_lock);
+    mutex_unlock(&vfs_lock);
     return status;
 }
 
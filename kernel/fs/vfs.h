@@ -15,6 +15,10 @@
   inode. tnode is used to store tree information, e.g., parent node. node_desc
   data structure is used for every file operation, from fopen, fread to fclose. 
 
+  A handle points to the node_desc of an open file. It is reference counted:
+  vfs_dup() takes another reference, e.g., for a file descriptor copied by
+  dup or fork, and vfs_close() drops one and closes the file with the last.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -32,8 +36,7 @@
 #define VFS_MAX_NAME_LEN    256
 
 #define VFS_FDCWD           -100
-#define VFS_INVALID_HANDLE  -1
-#define VFS_MIN_HANDLE      100
+#define VFS_INVALID_HANDLE  NULL
 
 /* Options for file seek */
 #define SEEK_CUR            1
@@ -72,12 +75,13 @@ typedef struct {
     char d_name[1024];
 } dirent_t;
 
-/* VFS data structure definitions */
-typedef int64_t vfs_handle_t;
-
 /* Forward declaration */
 typedef struct vfs_inode_t vfs_inode_t;
 typedef struct vfs_tnode_t vfs_tnode_t;
+typedef struct vfs_node_desc_t vfs_node_desc_t;
+
+/* VFS data structure definitions */
+typedef vfs_node_desc_t *vfs_handle_t;
 
 typedef enum {
     VFS_NODE_FILE,
@@ -176,6 +180,9 @@ typedef struct vfs_fsinfo_t {
     int64_t (*refresh)(vfs_inode_t *this);
     int64_t (*getdent)(vfs_inode_t *this, size_t pos, vfs_dirent_t *dirent);
     int64_t (*ioctl)(vfs_inode_t *this, int64_t request, int64_t arg);
+    /* Called when a file of the node is opened and closed, may be NULL */
+    void (*opened)(vfs_inode_t *this, vfs_openmode_t mode);
+    void (*closed)(vfs_inode_t *this, vfs_openmode_t mode);
 } vfs_fsinfo_t;
 
 struct vfs_tnode_t {
@@ -199,7 +206,7 @@ struct vfs_inode_t {
     vec_struct(vfs_tnode_t*) child;
 };
 
-typedef struct {
+struct vfs_node_desc_t {
     char path[VFS_MAX_PATH_LEN];
     vfs_tnode_t *tnode;
     vfs_inode_t *inode;
@@ -207,7 +214,8 @@ typedef struct {
     size_t seek_pos;
     vfs_tnode_t *curr_dir_ent;
     size_t curr_dir_idx;
-} vfs_node_desc_t;
+    int64_t refcount;               /* Handles referring to the open file */
+};
 
 int64_t vfs_get_parent_dir(const char *path, char *parent, char *currdir);
 
@@ -217,6 +225,7 @@ vfs_fsinfo_t* vfs_get_fs(char *name);
 void vfs_debug();
 
 vfs_handle_t vfs_open(char *path, vfs_openmode_t mode);
+vfs_handle_t vfs_dup(vfs_handle_t handle);
 int64_t vfs_create(char *path, vfs_node_type_t type);
 int64_t vfs_close(vfs_handle_t handle);
 int64_t vfs_tell(vfs_handle_t handle);
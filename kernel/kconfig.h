@@ -7,6 +7,7 @@
 
 #undef  ENABLE_KLOG_DEBUG
 #undef  ENABLE_MEM_DEBUG
+#undef  ENABLE_LOCKSTAT
 #undef  ENABLE_BASH
 
 #ifndef ENABLE_BASH
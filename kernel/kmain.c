@@ -44,6 +44,8 @@
 #include <sys/acpi.h>
 #include <sys/apic.h>
 #include <sys/hpet.h>
+#include <sys/ktime.h>
+#include <sys/vdso.h>
 #include <sys/panic.h>
 #include <sys/pci.h>
 #include <sys/pit.h>
@@ -55,6 +57,7 @@
 #include <device/storage/ata.h>
 #include <proc/sched.h>
 #include <proc/syscall.h>
+#include <proc/eventbus.h>
 #include <fs/vfs.h>
 #include <fs/ramfs.h>
 #include <fs/ttyfs.h>
@@ -97,8 +100,12 @@ static volatile computer_info_t self_info = {0};
 
 _Noreturn void kcursor(task_id_t tid)
 {
+    uint64_t next = ktime_get_ns();
+
     while (true) {
-        sched_sleep(500);
+        /* Woken by its sleep timer at a fixed period without drift */
+        next += MILLIS_TO_NANOS(CURSOR_BLINK_MS);
+        while (ktime_get_ns() < next) sched_sleep_until(next);
 
         if (cursor_visible == CURSOR_INVISIBLE) {
             term_set_cursor('_');
@@ -170,6 +177,9 @@ void kmain(void)
     klogi("Init PIT...\n");
     pit_init();
 
+    klogi("Init event bus...\n");
+    eb_init();
+
     klogi("Init keyboard...\n");
     keyboard_init();
 
@@ -179,9 +189,15 @@ void kmain(void)
     klogi("Init HPET...\n");
     hpet_init();
 
+    klogi("Init clocksource...\n");
+    ktime_init();
+
     klogi("Init CMOS...\n");
     cmos_init();
 
+    klogi("Init vDSO...\n");
+    vdso_init();
+
     klogi("Init APIC...\n");
     apic_init();
 
@@ -295,9 +311,9 @@ void kmain(void)
         NULL
     };
 
-    sched_execve(DEFAULT_SHELL_APP, argv, envp, "/root"); 
+    sched_execve(DEFAULT_SHELL_APP, argv, envp, "/root", false); 
 #else 
-    sched_execve(DEFAULT_SHELL_APP, NULL, NULL, "/root");
+    sched_execve(DEFAULT_SHELL_APP, NULL, NULL, "/root", false);
 #endif
 
     cpu_t *cpu = smp_get_current_cpu(false);
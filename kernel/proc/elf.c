@@ -79,7 +79,7 @@ int64_t elf_load(
             m.paddr = VIRT_TO_PHYS(elf_buff);
             m.np = NUM_PAGES(elf_len);
 
-            vec_push_back(&task->mmap_list, m); 
+            vec_push_back(&task->addrspace->mmap_list, m); 
         }
         vfs_close(f);
     }
@@ -115,7 +115,7 @@ int64_t elf_load(
     m.paddr = VIRT_TO_PHYS(phdr);
     m.np = NUM_PAGES(hdr.phnum * sizeof(elf_phdr_t));
 
-    vec_push_back(&task->mmap_list, m); 
+    vec_push_back(&task->addrspace->mmap_list, m); 
 
     phaddr = (uint64_t*)kmalloc(hdr.phnum * sizeof(uint64_t));
     if (phaddr == NULL)                 goto err_exit;
@@ -125,7 +125,7 @@ int64_t elf_load(
     m.paddr = VIRT_TO_PHYS(phaddr);
     m.np = NUM_PAGES(hdr.phnum * sizeof(uint64_t));
 
-    vec_push_back(&task->mmap_list, m); 
+    vec_push_back(&task->addrspace->mmap_list, m); 
 
     for (size_t i = 0; i < hdr.phnum; i++) {
         phaddr[i] = (uint64_t)NULL;
@@ -223,7 +223,7 @@ int64_t elf_load(
         m1.np = page_count;
         m1.flags = pf;
 
-        vec_push_back(&task->mmap_list, m1);
+        vec_push_back(&task->addrspace->mmap_list, m1);
 
         memcpy((void*)PHYS_TO_VIRT(addr + misalign), elf_buff + phdr[i].offset,
                phdr[i].filesz);
@@ -243,7 +243,7 @@ int64_t elf_load(
     m.paddr = VIRT_TO_PHYS(shdr);
     m.np = NUM_PAGES(hdr.shnum * sizeof(elf_shdr_t));
 
-    vec_push_back(&task->mmap_list, m); 
+    vec_push_back(&task->addrspace->mmap_list, m); 
 
     aux->shdr = (uint64_t)shdr;
     memcpy(shdr, elf_buff + hdr.shoff, hdr.shnum * sizeof(elf_shdr_t));
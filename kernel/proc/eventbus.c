@@ -1,37 +1,81 @@
-#include <sys/hpet.h>
-#include <base/vector.h>
+/**-----------------------------------------------------------------------------
+
+ @file    eventbus.c
+ @brief   Implementation of event bus related functions
+ @details
+ @verbatim
+
+  Subscribers of a type take turns to pop its ring under the queue lock,
+  which is never taken in interrupt context. A subscriber which finds the
+  ring empty sleeps on the wait queue. An event published after the check
+  stays in the ring, and eb_dispatch() wakes the queue as long as the ring
+  is not empty and somebody waits, so the wakeup is late but never lost.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <sys/ktime.h>
 #include <base/lock.h>
+#include <base/ring.h>
 #include <proc/eventbus.h>
+#include <proc/waitqueue.h>
 #include <proc/sched.h>
 
-vec_new_static(event_t, eb_publishers);
-vec_new_static(event_t, eb_subscribers);
+#define EB_TYPE_NUM     (EVENT_KEY_PRESSED + 1)
+
+typedef struct {
+    ring_t      ring;               /* Published events not received yet */
+    ring_slot_t slots[EB_RING_SIZE];
+    lock_t      lock;               /* Serializes subscribers */
+    waitqueue_t waiters;
+} eb_queue_t;
+
+static eb_queue_t eb_queues[EB_TYPE_NUM] = {0};
 
-static lock_t eb_lock;
 static bool eb_debug = false;
 
+void eb_init(void)
+{
+    for (size_t i = 0; i < EB_TYPE_NUM; i++) {
+        ring_init(&eb_queues[i].ring, eb_queues[i].slots, EB_RING_SIZE);
+    }
+}
+
+/* Wake subscribers of the types which have pending events */
+void eb_dispatch(void)
+{
+    for (size_t i = 0; i < EB_TYPE_NUM; i++) {
+        eb_queue_t *q = &eb_queues[i];
+        if (ring_empty(&q->ring)) continue;
+        if (__atomic_load_n(&q->waiters.tasks.len, __ATOMIC_RELAXED) == 0) {
+            continue;
+        }
+        waitqueue_wake_all(&q->waiters, 0);
+    }
+}
+
 bool eb_publish(task_id_t tid, event_type_t type, event_para_t para)
 {
     if (type != EVENT_KEY_PRESSED) {
         return false;
     }
 
-    event_t e = {
-        .pub_tid = tid,
-        .sub_tid = TID_MAX,
-        .type = type,
-        .para = para};
-
-    e.timestamp = hpet_get_nanos();
+    if (!ring_push(&eb_queues[type].ring, para)) {
+        return false;
+    }
 
-    lock_lock(&eb_lock);
-    vec_push_back(&eb_publishers, e);
-    lock_release(&eb_lock);    
+    /* Interrupt handlers leave the wakeup to eb_dispatch() */
+    uint64_t rflags;
+    asm volatile("pushfq; pop %0" : "=r"(rflags));
+    if (rflags & 0x200) {
+        eb_dispatch();
+    }
 
     if (eb_debug) {
         klogi("EB: task id %d published  para 0x%8x with type 0x%8x "
               "and millis %d, ticks %d\n",
-              tid, para, type, hpet_get_millis(), sched_get_ticks());
+              tid, para, type, ktime_get_ms(), sched_get_ticks());
     }
 
     return true;
@@ -44,51 +88,22 @@ bool eb_subscribe(task_id_t tid, event_type_t type, event_para_t *para)
         return false;
     }
 
-    event_t e = { 
-        .pub_tid = TID_MAX,
-        .sub_tid = tid,
-        .type = type,
-        .para = 0};
+    eb_queue_t *q = &eb_queues[type];
 
-    e.timestamp = hpet_get_nanos();
-
-    lock_lock(&eb_lock);
-    vec_push_back(&eb_subscribers, e); 
-    lock_release(&eb_lock);  
-
-    e = sched_wait_event(e);
-    *para = e.para;
+    lock_lock(&q->lock);
+    while (!ring_pop(&q->ring, para)) {
+        waitqueue_prepare(&q->waiters, 0);
+        lock_release(&q->lock);
+        waitqueue_wait(&q->waiters, NULL);
+        lock_lock(&q->lock);
+    }
+    lock_release(&q->lock);
 
     if (eb_debug) {
         klogi("EB: task id %d subscribed para 0x%8x with type 0x%8x "
               "and millis %d, ticks %d\n",
-              tid, e.para, type, hpet_get_millis(), sched_get_ticks());
+              tid, *para, type, ktime_get_ms(), sched_get_ticks());
     }
 
     return true;
 }
-
-bool eb_dispatch(void)
-{
-    lock_lock(&eb_lock);
-
-    while (true) {
-        if (vec_length(&eb_publishers) > 0) {
-            event_t e = vec_at(&eb_publishers, 0);
-            if (e.type != EVENT_KEY_PRESSED) {
-                vec_erase(&eb_publishers, 0);
-                continue;
-            }
-            if (sched_resume_event(e)) {
-                vec_erase(&eb_publishers, 0);
-            }
-            break;
-        } else {
-            break;
-        }
-    }   
-    lock_release(&eb_lock);
-
-    return true;
-}
-
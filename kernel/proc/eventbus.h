@@ -1,9 +1,28 @@
+/**-----------------------------------------------------------------------------
+
+ @file    eventbus.h
+ @brief   Definition of event bus related functions
+ @details
+ @verbatim
+
+  Every event type has a bounded lock-free ring for published events and a
+  wait queue for subscribers. Publishing does not take any lock, so it can
+  be done by interrupt handlers. Waiting subscribers are woken in batches by
+  eb_dispatch() on context switch, or at once if the publisher runs with
+  interrupts enabled. Every event is received by one subscriber.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
 #pragma once
 
 /* Event related data structures are defined in task.h */
 #include <proc/task.h>
 
+#define EB_RING_SIZE    256
+
+void eb_init(void);
 bool eb_publish(task_id_t tid, event_type_t type, event_para_t para);
 bool eb_subscribe(task_id_t tid, event_type_t type, event_para_t *para);
-bool eb_dispatch(void);
-
+void eb_dispatch(void);
@@ -0,0 +1,106 @@
+/**-----------------------------------------------------------------------------
+
+ @file    futex.c
+ @brief   Implementation of futex related functions
+ @details
+ @verbatim
+
+  The value at user address is compared with the expected one under the
+  bucket lock, and the waiter is queued before the lock is released. A waker
+  changes the value before calling futex_wake() which needs the same bucket
+  lock, so the wakeup cannot be lost.
+
+  Timeout is implemented by the wakeup time of scheduler. A timed out waiter
+  is still in the bucket and removes itself.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/errno.h>
+
+#include <base/lock.h>
+#include <base/vector.h>
+#include <proc/futex.h>
+#include <proc/sched.h>
+#include <sys/ktime.h>
+
+static futex_bucket_t futex_buckets[FUTEX_HASH_SIZE] = {0};
+
+static futex_bucket_t *futex_get_bucket(addrspace_t *as, uint64_t uaddr)
+{
+    uint64_t key = ((uint64_t)as >> 4) ^ (uaddr >> 3);
+
+    key ^= key >> 17;
+    key *= 0x9E3779B97F4A7C15ULL;
+
+    return &futex_buckets[(key >> 32) % FUTEX_HASH_SIZE];
+}
+
+int64_t futex_wait(task_t *t, int64_t *uaddr, int64_t expected,
+                   uint64_t timeout)
+{
+    futex_bucket_t *b = futex_get_bucket(t->addrspace, (uint64_t)uaddr);
+    bool timedout = false;
+
+    lock_lock(&b->lock);
+
+    if (*uaddr != expected) {
+        lock_release(&b->lock);
+        cpu_set_errno(EAGAIN);
+        return -1;
+    }
+
+    futex_waiter_t w = {
+        .as = t->addrspace,
+        .uaddr = (uint64_t)uaddr,
+        .task = t};
+
+    vec_push_back(&b->waiters, w);
+    sched_prepare_sleep((timeout > 0) ? ktime_get_ns() + timeout : 0);
+
+    lock_release(&b->lock);
+
+    sched_yield();
+
+    lock_lock(&b->lock);
+    for (size_t i = 0; i < vec_length(&b->waiters); i++) {
+        if (vec_at(&b->waiters, i).task == t) {
+            vec_erase(&b->waiters, i);
+            timedout = true;
+            break;
+        }
+    }
+    lock_release(&b->lock);
+
+    if (timedout) {
+        cpu_set_errno(ETIMEDOUT);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Return the number of woken tasks */
+int64_t futex_wake(task_t *t, int64_t *uaddr, int64_t num)
+{
+    futex_bucket_t *b = futex_get_bucket(t->addrspace, (uint64_t)uaddr);
+    int64_t woken = 0;
+
+    lock_lock(&b->lock);
+
+    for (size_t i = 0; i < vec_length(&b->waiters) && woken < num; ) {
+        futex_waiter_t w = vec_at(&b->waiters, i);
+        if (w.as == t->addrspace && w.uaddr == (uint64_t)uaddr) {
+            vec_erase(&b->waiters, i);
+            sched_wakeup(w.task, 0);
+            woken++;
+        } else {
+            i++;
+        }
+    }
+
+    lock_release(&b->lock);
+
+    return woken;
+}
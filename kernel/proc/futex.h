@@ -0,0 +1,39 @@
+/**-----------------------------------------------------------------------------
+
+ @file    futex.h
+ @brief   Definition of futex related functions
+ @details
+ @verbatim
+
+  Futex (fast userspace mutex) lets userspace locks sleep in kernel only when
+  they are contended. Waiters are kept in hashed buckets keyed by address space
+  and user virtual address. futex_wait() reads the user word, so the caller
+  must check that it is mapped user memory of the task.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <proc/task.h>
+
+#define FUTEX_HASH_SIZE         64
+#define FUTEX_WAKE_ALL          INT64_MAX
+
+typedef struct {
+    addrspace_t     *as;
+    uint64_t        uaddr;
+    task_t          *task;
+} futex_waiter_t;
+
+typedef struct {
+    lock_t lock;
+    vec_struct(futex_waiter_t) waiters;
+} futex_bucket_t;
+
+int64_t futex_wait(task_t *t, int64_t *uaddr, int64_t expected,
+                   uint64_t timeout);
+int64_t futex_wake(task_t *t, int64_t *uaddr, int64_t num);
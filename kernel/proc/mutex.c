@@ -0,0 +1,123 @@
+/**-----------------------------------------------------------------------------
+
+ @file    mutex.c
+ @brief   Implementation of sleeping mutex and semaphore
+ @details
+ @verbatim
+
+  The state is changed under the inner spinlock, and waiters follow the wait
+  queue usage in waitqueue.h, so a release between the check and the sleep
+  is not lost. Release wakes one waiter, which competes with new comers and
+  goes back to sleep if it loses.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <proc/mutex.h>
+#include <proc/sched.h>
+
+/* Owner of a mutex taken before any task runs */
+#define MUTEX_OWNER_BOOT    ((void*)1)
+
+bool mutex_trylock(mutex_t *m)
+{
+    task_t *t = sched_get_current_task();
+    bool ret = false;
+
+    lock_lock(&m->lock);
+    if (m->owner == NULL) {
+        m->owner = (t != NULL) ? (void*)t : MUTEX_OWNER_BOOT;
+        ret = true;
+    }
+    lock_release(&m->lock);
+
+    return ret;
+}
+
+void mutex_lock(mutex_t *m)
+{
+    for (int i = 0; i < MUTEX_SPIN_COUNT; i++) {
+        if (__atomic_load_n(&m->owner, __ATOMIC_RELAXED) == NULL
+            && mutex_trylock(m)) {
+            return;
+        }
+        asm volatile("pause");
+    }
+
+    task_t *t = sched_get_current_task();
+
+    lock_lock(&m->lock);
+    while (m->owner != NULL) {
+        if (t == NULL) {
+            /* No task to put to sleep, keep spinning */
+            lock_release(&m->lock);
+            asm volatile("pause");
+        } else {
+            waitqueue_prepare(&m->waiters, 0);
+            lock_release(&m->lock);
+            waitqueue_wait(&m->waiters, NULL);
+        }
+        lock_lock(&m->lock);
+    }
+    m->owner = (t != NULL) ? (void*)t : MUTEX_OWNER_BOOT;
+    lock_release(&m->lock);
+}
+
+void mutex_unlock(mutex_t *m)
+{
+    lock_lock(&m->lock);
+    m->owner = NULL;
+    waitqueue_wake_one(&m->waiters, 0);
+    lock_release(&m->lock);
+}
+
+bool semaphore_trydown(semaphore_t *s)
+{
+    bool ret = false;
+
+    lock_lock(&s->lock);
+    if (s->count > 0) {
+        s->count--;
+        ret = true;
+    }
+    lock_release(&s->lock);
+
+    return ret;
+}
+
+void semaphore_down(semaphore_t *s)
+{
+    for (int i = 0; i < MUTEX_SPIN_COUNT; i++) {
+        if (__atomic_load_n(&s->count, __ATOMIC_RELAXED) > 0
+            && semaphore_trydown(s)) {
+            return;
+        }
+        asm volatile("pause");
+    }
+
+    task_t *t = sched_get_current_task();
+
+    lock_lock(&s->lock);
+    while (s->count <= 0) {
+        if (t == NULL) {
+            lock_release(&s->lock);
+            asm volatile("pause");
+        } else {
+            waitqueue_prepare(&s->waiters, 0);
+            lock_release(&s->lock);
+            waitqueue_wait(&s->waiters, NULL);
+        }
+        lock_lock(&s->lock);
+    }
+    s->count--;
+    lock_release(&s->lock);
+}
+
+void semaphore_up(semaphore_t *s)
+{
+    lock_lock(&s->lock);
+    s->count++;
+    waitqueue_wake_one(&s->waiters, 0);
+    lock_release(&s->lock);
+}
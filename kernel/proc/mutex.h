@@ -0,0 +1,54 @@
+/**-----------------------------------------------------------------------------
+
+ @file    mutex.h
+ @brief   Definition of sleeping mutex and semaphore
+ @details
+ @verbatim
+
+  A mutex is for long critical sections, e.g., disk I/O or terminal output.
+  Locking spins for a short while since the holder may be about to release
+  it on another CPU, then the task sleeps on the wait queue of the mutex.
+  The holder runs with interrupts enabled and can be preempted.
+
+  Mutexes must not be taken in interrupt context or with a spinlock held.
+  Before the scheduler starts there is no task to put to sleep, so they
+  fall back to spinning.
+
+  A semaphore works in the same way and allows "count" holders.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <base/lock.h>
+#include <proc/waitqueue.h>
+
+#define MUTEX_SPIN_COUNT    100
+
+typedef struct {
+    lock_t      lock;           /* Protects owner and waiters */
+    void        *owner;         /* Holder task, NULL if it is free */
+    waitqueue_t waiters;
+} mutex_t;
+
+typedef struct {
+    lock_t      lock;           /* Protects count and waiters */
+    int64_t     count;
+    waitqueue_t waiters;
+} semaphore_t;
+
+#define mutex_new()         (mutex_t){.owner = NULL, .lock = LOCK_INIT}
+#define semaphore_new(n)    (semaphore_t){.count = (n), .lock = LOCK_INIT}
+
+void mutex_lock(mutex_t *m);
+bool mutex_trylock(mutex_t *m);
+void mutex_unlock(mutex_t *m);
+
+void semaphore_down(semaphore_t *s);
+bool semaphore_trydown(semaphore_t *s);
+void semaphore_up(semaphore_t *s);
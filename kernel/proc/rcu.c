@@ -0,0 +1,163 @@
+/**-----------------------------------------------------------------------------
+
+ @file    rcu.c
+ @brief   Implementation of read-copy-update (RCU) related functions
+ @details
+ @verbatim
+
+  Grace periods are numbered. A callback queued by call_rcu() waits for the
+  grace period after the current one, which starts only after it is queued.
+  Grace periods are started lazily by the first CPU which passes a quiescent
+  state while callbacks are waiting, so nothing is done while RCU is idle.
+
+  Every CPU reports a quiescent state from do_context_switch(). It remembers
+  the last grace period it has reported, so the check is one load unless a
+  new grace period has started. The last CPU to report completes the grace
+  period and runs the finished callbacks without any lock held.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <proc/rcu.h>
+#include <proc/sched.h>
+#include <base/kmalloc.h>
+#include <base/lock.h>
+#include <sys/cpu.h>
+#include <sys/smp.h>
+
+typedef struct {
+    uint64_t nesting;               /* Depth of read-side sections */
+    uint64_t rflags;                /* Saved by the outermost section */
+    uint64_t qs_gp;                 /* Last grace period reported */
+} __attribute__((aligned(64))) rcu_cpu_t;
+
+typedef struct {
+    rcu_head_t head;
+    void       *ptr;
+} rcu_kfree_t;
+
+static rcu_cpu_t rcu_cpus[CPU_MAX] = {0};
+
+static lock_t rcu_lock = lock_new();
+static uint64_t rcu_gp_started = 0;
+static uint64_t rcu_gp_done = 0;
+static uint16_t rcu_gp_pending = 0;     /* CPUs yet to report */
+
+/* Callbacks ordered by grace period */
+static rcu_head_t *rcu_cbs = NULL;
+static rcu_head_t **rcu_cbs_tail = &rcu_cbs;
+
+/*
+ * Interrupts must be disabled. Tasks only run after SMP is initialized, so
+ * before that only the boot CPU gets here.
+ */
+static rcu_cpu_t *rcu_this_cpu(void)
+{
+    uint16_t cpu_id = smp_initialized ? this_cpu_read(cpu_id) : 0;
+
+    if (cpu_id >= CPU_MAX) return &rcu_cpus[0];
+    return &rcu_cpus[cpu_id];
+}
+
+void rcu_read_lock(void)
+{
+    uint64_t rflags;
+
+    asm volatile("pushfq; pop %0; cli" : "=r"(rflags) : : "memory");
+
+    rcu_cpu_t *rc = rcu_this_cpu();
+    if (rc->nesting++ == 0) rc->rflags = rflags;
+}
+
+void rcu_read_unlock(void)
+{
+    rcu_cpu_t *rc = rcu_this_cpu();
+
+    if (--rc->nesting == 0) {
+        asm volatile("push %0; popfq" : : "r"(rc->rflags) : "memory", "cc");
+    }
+}
+
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head))
+{
+    head->func = func;
+    head->next = NULL;
+
+    lock_lock(&rcu_lock);
+    head->gp = rcu_gp_started + 1;
+    *rcu_cbs_tail = head;
+    rcu_cbs_tail = &head->next;
+    lock_release(&rcu_lock);
+}
+
+static void rcu_kfree_func(rcu_head_t *head)
+{
+    rcu_kfree_t *f = container_of(head, rcu_kfree_t, head);
+
+    kmfree(f->ptr);
+    kmfree(f);
+}
+
+/* Free memory after all readers which may see it are done */
+void rcu_kfree(void *ptr)
+{
+    rcu_kfree_t *f = kmalloc(sizeof(rcu_kfree_t));
+
+    if (f == NULL) return;      /* Leak it rather than free it too early */
+
+    f->ptr = ptr;
+    call_rcu(&f->head, rcu_kfree_func);
+}
+
+/* Report a quiescent state of the CPU, interrupts must be disabled */
+void rcu_note_qs(uint16_t cpu_id)
+{
+    rcu_cpu_t *rc = &rcu_cpus[cpu_id];
+    rcu_head_t *done = NULL;
+
+    /* Reported already, and there is no grace period to start */
+    uint64_t started = __atomic_load_n(&rcu_gp_started, __ATOMIC_ACQUIRE);
+    if (rc->qs_gp == started
+        && (started != __atomic_load_n(&rcu_gp_done, __ATOMIC_RELAXED)
+            || __atomic_load_n(&rcu_cbs, __ATOMIC_RELAXED) == NULL)) {
+        return;
+    }
+
+    lock_lock(&rcu_lock);
+
+    if (rc->qs_gp != rcu_gp_started) {
+        rc->qs_gp = rcu_gp_started;
+        if (rcu_gp_pending > 0) rcu_gp_pending--;
+    } else if (rcu_gp_started == rcu_gp_done && rcu_cbs != NULL) {
+        /* Start a new grace period, this CPU has passed it already */
+        const smp_info_t *smp_info = smp_get_info();
+        rcu_gp_started++;
+        rcu_gp_pending = smp_info->num_cpus - 1;
+        rc->qs_gp = rcu_gp_started;
+    }
+
+    if (rcu_gp_started != rcu_gp_done && rcu_gp_pending == 0) {
+        rcu_gp_done = rcu_gp_started;
+
+        /* Detach the callbacks whose grace period has completed */
+        rcu_head_t **tail = &rcu_cbs;
+        while (*tail != NULL && (*tail)->gp <= rcu_gp_done) {
+            tail = &(*tail)->next;
+        }
+        if (tail != &rcu_cbs) {
+            done = rcu_cbs;
+            rcu_cbs = *tail;
+            *tail = NULL;
+            if (rcu_cbs == NULL) rcu_cbs_tail = &rcu_cbs;
+        }
+    }
+
+    lock_release(&rcu_lock);
+
+    while (done != NULL) {
+        rcu_head_t *next = done->next;
+        done->func(done);
+        done = next;
+    }
+}
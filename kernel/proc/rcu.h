@@ -0,0 +1,95 @@
+/**-----------------------------------------------------------------------------
+
+ @file    rcu.h
+ @brief   Definition of read-copy-update (RCU) related functions
+ @details
+ @verbatim
+
+  RCU lets readers of read-mostly structures go without any lock. Writers
+  are serialized by their own lock, publish new versions with release
+  stores, and free the old ones by call_rcu() after a grace period, i.e.,
+  after every CPU has passed a quiescent state.
+
+  Readers run between rcu_read_lock() and rcu_read_unlock() with interrupts
+  disabled, so they can not be switched out, and a context switch is a
+  quiescent state of the CPU. Read-side sections may nest, but they must
+  not sleep or take a mutex.
+
+    rcu_read_lock();
+    p = rcu_dereference(gp);
+    ... use p ...
+    rcu_read_unlock();
+
+  Vectors of pointers can be read under RCU as well. Writers change them by
+  vec_push_back_rcu() and vec_erase_rcu() only, and readers read the length
+  by vec_rcu_len() before the data by vec_rcu_data(), skipping NULL items.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <base/vector.h>
+
+typedef struct rcu_head_t {
+    struct rcu_head_t *next;
+    void (*func)(struct rcu_head_t *head);
+    uint64_t gp;                    /* Grace period to wait for */
+} rcu_head_t;
+
+#define rcu_dereference(p)          __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v)    __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+#define container_of(ptr, type, member)                             \
+    ((type*)((uint8_t*)(ptr) - offsetof(type, member)))
+
+#define vec_rcu_len(vec)    __atomic_load_n(&(vec)->len, __ATOMIC_ACQUIRE)
+#define vec_rcu_data(vec)   __atomic_load_n(&(vec)->data, __ATOMIC_ACQUIRE)
+
+/* The old array is freed after a grace period instead of realloc */
+#define vec_push_back_rcu(vec, elem)                                \
+    {                                                               \
+        size_t __n = (vec)->len;                                    \
+        size_t __sz = sizeof((vec)->data[0]);                       \
+        if ((vec)->capacity < (__n + 1) * __sz) {                   \
+            size_t __cap = (__n + 1) * __sz * VECTOR_RESIZE_FACTOR; \
+            typeof((vec)->data) __d = kmalloc(__cap);               \
+            typeof((vec)->data) __old = (vec)->data;                \
+            if (__n > 0) memcpy(__d, __old, __n * __sz);            \
+            (vec)->capacity = __cap;                                \
+            rcu_assign_pointer((vec)->data, __d);                   \
+            if (__old != NULL) rcu_kfree(__old);                    \
+        }                                                           \
+        (vec)->data[__n] = elem;                                    \
+        rcu_assign_pointer((vec)->len, __n + 1);                    \
+    }
+
+/*
+ * The items are copied to a new array whose last slot is NULL, so a reader
+ * which got the old length sees either a valid item or NULL.
+ */
+#define vec_erase_rcu(vec, index)                                   \
+    {                                                               \
+        size_t __n = (vec)->len;                                    \
+        size_t __sz = sizeof((vec)->data[0]);                       \
+        typeof((vec)->data) __d = kmalloc((vec)->capacity);         \
+        typeof((vec)->data) __old = (vec)->data;                    \
+        memcpy(__d, __old, (index) * __sz);                         \
+        memcpy(&__d[index], &__old[(index) + 1],                    \
+               (__n - (index) - 1) * __sz);                         \
+        __d[__n - 1] = NULL;                                        \
+        rcu_assign_pointer((vec)->data, __d);                       \
+        rcu_assign_pointer((vec)->len, __n - 1);                    \
+        rcu_kfree(__old);                                           \
+    }
+
+void rcu_read_lock(void);
+void rcu_read_unlock(void);
+void call_rcu(rcu_head_t *head, void (*func)(rcu_head_t *head));
+void rcu_kfree(void *ptr);
+void rcu_note_qs(uint16_t cpu_id);
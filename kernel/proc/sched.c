@@ -7,6 +7,44 @@
 
   Context Switching, Scheduling Algorithms etc.
 
+  Every CPU has its own task queue. A task stays in the queue of the CPU it
+  last ran on ("last_cpu") to keep the cache warm, and it is only picked by
+  the CPUs in its affinity mask. Tasks are moved between CPUs by the load
+  balancer which runs periodically and when a CPU has nothing to run. The
+  load of a CPU is taken from a counter of the ready tasks in its queue, which
+  is updated when a task is queued, removed or made ready.
+
+  An exited task becomes a zombie until its parent collects the exit code by
+  waitpid, which sleeps on the wait queue of parent. Tasks without parent and
+  collected zombies are put into the reaper list after an RCU grace period,
+  and idle tasks free them. Tasks are found by tid through the lookup table
+  in tid.c.
+
+  Idle CPUs are tracked in an atomic mask. When a task becomes runnable, an
+  idle CPU which is allowed to run it (or the CPU running a lower priority
+  task) is kicked by a reschedule IPI instead of waiting for its next tick.
+  If idle CPUs wait with MONITOR/MWAIT, setting the "need_resched" flag is
+  enough to wake them and no IPI is sent.
+
+  Real-time tasks (SCHED_FIFO and SCHED_RR) share the queues with normal
+  ones, but the runnable one of the highest real-time priority is always
+  picked first, and the earliest queued one among equals. A preempted
+  real-time task is put back at the head of the queue, except a SCHED_RR
+  task whose time slice is used up. To keep them from starving the system,
+  real-time tasks may only use SCHED_RT_RUNTIME of every SCHED_RT_PERIOD on
+  each CPU. After that they are scheduled round robin with normal tasks
+  until the period ends.
+
+  Statistics of context switches and run-queue wait time are kept per CPU
+  and only updated by the owning CPU, so collecting them does not bounce
+  cache lines between CPUs.
+
+  Syscalls run on the kernel stack of each task with interrupts enabled, so
+  a task may be preempted or sleep in any syscall. A vfork child borrows
+  address space and user stack of its parent, which sleeps in the syscall
+  until the child calls execve or exits. Preemption is deferred while the
+  task holds a lock taken by lock_lock_noirq().
+
   History:
   Apr 20, 2022 - 1. Redesign the task queue based on vector data structue.
                  2. Scheduler starts working after all processors are launched
@@ -17,6 +55,7 @@
  **-----------------------------------------------------------------------------
  */
 #include <libc/string.h>
+#include <libc/errno.h>
 
 #include <base/klog.h>
 #include <base/lock.h>
@@ -25,17 +64,42 @@
 #include <base/vector.h>
 #include <proc/sched.h>
 #include <proc/elf.h>
+#include <proc/tid.h>
+#include <proc/rcu.h>
 #include <proc/eventbus.h>
+#include <proc/syscall.h>
+#include <fs/ttyfs.h>
 #include <sys/smp.h>
 #include <sys/timer.h>
 #include <sys/apic.h>
 #include <sys/hpet.h>
+#include <sys/ktime.h>
+#include <sys/vdso.h>
+#include <sys/hrtimer.h>
 #include <sys/pit.h>
 #include <sys/isr_base.h>
+#include <sys/idt.h>
 #include <sys/panic.h>
 #include <sys/cpu.h>
+#include <sys/fpu.h>
+#include <sys/idle.h>
+
+#define TIMESLICE_DEFAULT       HRTIMER_TICK_NS
+
+/* Ticks between two periodic load balancing */
+#define SCHED_BALANCE_INTERVAL  16
+
+/* A task which ran in recent ticks is cache hot and should not migrate */
+#define SCHED_MIGRATION_COST    4
 
-#define TIMESLICE_DEFAULT       MILLIS_TO_NANOS(1)
+/* Time slice of SCHED_RR tasks in ticks */
+#define SCHED_RR_TICKS          10
+
+/* Real-time tasks can use at most RUNTIME of every PERIOD on a CPU */
+#define SCHED_RT_PERIOD         MILLIS_TO_NANOS(1000)
+#define SCHED_RT_RUNTIME        MILLIS_TO_NANOS(950)
+
+#define sched_is_rt(t)          ((t)->policy != SCHED_OTHER)
 
 lock_t sched_lock = lock_new();
 
@@ -45,28 +109,53 @@ static uint64_t tasks_coordinate[CPU_MAX] = {0};
 
 static volatile uint16_t cpu_num = 0;
 
-vec_new_static(task_t*, tasks_active);
+typedef vec_struct(task_t*) task_queue_t;
+
+/* Real-time bandwidth of a CPU in current period */
+typedef struct {
+    uint64_t period_start;
+    uint64_t runtime;
+    bool     throttled;
+} sched_rt_t;
+
+static task_queue_t tasks_queue[CPU_MAX] = {0};
+static size_t tasks_nr_ready[CPU_MAX] = {0};    /* TASK_READY ones in queue */
+
+static cpumask_t sched_idle_mask = {0};
+static idle_flag_t sched_need_resched[CPU_MAX] = {0};
+static uint8_t sched_lapic_id[CPU_MAX] = {0};
+static uint8_t sched_ipi_vector = 0;
+static task_queue_t tasks_reaper = {0};
+static sched_stat_t sched_stats[CPU_MAX] = {0};
+static sched_rt_t sched_rt[CPU_MAX] = {0};
+
+/* Protect parent and child relationship, taken before sched_lock */
+static lock_t wait_lock = lock_new();
 
 extern void enter_context_switch(void* v);
 extern void exit_context_switch(task_t* next, uint64_t cr3val);
 extern void force_context_switch(void);
 extern void fork_context_switch(void);
+extern void resched_context_switch(void* v);
 
 void sched_debug(bool showlog)
 {
     lock_lock(&sched_lock);
 
-    size_t task_num = vec_length(&tasks_active);
+    size_t task_num = 0;
+
+    for (size_t k = 0; k < CPU_MAX; k++) {
+        for (size_t i = 0; i < vec_length(&tasks_queue[k]); i++) {
+            task_t *t  = vec_at(&tasks_queue[k], i);
+            if (t->tid < 1)
+                kpanic("SCHED: task list corrupted (%d 0x%x)\n", showlog, t);
+        }
+        task_num += vec_length(&tasks_queue[k]);
+    }
 
     if (showlog)
         klogd("SCHED: Totally %d active tasks\n", task_num);
 
-    for (size_t i = 0; i < task_num; i++) {
-        task_t *t  = vec_at(&tasks_active, i);
-        if (t->tid < 1)
-            kpanic("SCHED: task list corrupted (%d 0x%x)\n", showlog, t);
-    }
-
     for (size_t k = 0; k < CPU_MAX; k++) {
         if (tasks_running[k] != NULL && tasks_running[k] != tasks_idle[k]) {
             if (showlog) {
@@ -83,7 +172,7 @@ void sched_debug(bool showlog)
             }
         }
 
-        if (tasks_idle[k]->tid < 1) {
+        if (tasks_idle[k] != NULL && tasks_idle[k]->tid < 1) {
             kpanic("SCHED: idle task on CPU %d corrupted (%d 0x%x)\n",
                 k, showlog, tasks_idle[k]);
         }
@@ -101,19 +190,11 @@ _Noreturn static void task_idle_proc(task_id_t tid)
         /* 1. Free resouces of dead tasks in idle task */
         task_t *t = NULL;
 
-        /* Step 1.1: Find a dead task */
+        /* Step 1.1: Take a dead task from reaper list */
         lock_lock(&sched_lock);
-        size_t task_num = vec_length(&tasks_active);
-        if (task_num > 0) {
-            for (size_t i = 0; i < task_num; i++) {
-                t = vec_at(&tasks_active, i);
-                if (t->status == TASK_DEAD) {
-                    vec_erase(&tasks_active, i);
-                    break;
-                } else {
-                    t = NULL;
-                }
-            }
+        if (vec_length(&tasks_reaper) > 0) {
+            t = vec_at(&tasks_reaper, 0);
+            vec_erase(&tasks_reaper, 0);
         }
         lock_release(&sched_lock);
 
@@ -124,29 +205,429 @@ _Noreturn static void task_idle_proc(task_id_t tid)
             task_free(t);
         } else {
             /* If we cannot find dead tasks, then fall into sleep */
-            asm volatile ("hlt");
+            idle_flag_t *f = &sched_need_resched[this_cpu_read(cpu_id)];
+            idle_wait(f);
+            if (f->flag) {
+                force_context_switch();
+            }
+        }
+    }
+}
+
+static bool sched_task_runnable(task_t *t, uint64_t now)
+{
+    if (t->status == TASK_READY) return true;
+    if (t->status == TASK_SLEEPING) {
+        if ((t->wakeup_time > 0) && (now >= t->wakeup_time)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Queue task "t" on "cpu_id", sched_lock must be held */
+static void sched_queue_insert(uint16_t cpu_id, task_t *t, bool head)
+{
+    t->last_cpu = cpu_id;
+    t->queued = true;
+    if (t->status == TASK_READY) tasks_nr_ready[cpu_id]++;
+
+    if (head) {
+        vec_insert(&tasks_queue[cpu_id], 0, t);
+    } else {
+        vec_push_back(&tasks_queue[cpu_id], t);
+    }
+}
+
+/* Take the task at "index" out of the queue of "cpu_id" */
+static task_t *sched_queue_remove(uint16_t cpu_id, size_t index)
+{
+    task_t *t = vec_at(&tasks_queue[cpu_id], index);
+
+    vec_erase(&tasks_queue[cpu_id], index);
+    t->queued = false;
+    if (t->status == TASK_READY) tasks_nr_ready[cpu_id]--;
+
+    return t;
+}
+
+/* Make a sleeping task ready, sched_lock must be held */
+static void sched_set_ready(task_t *t, uint64_t ready_time)
+{
+    hrtimer_try_cancel(&t->sleep_timer);
+    t->wakeup_time = 0;
+    t->ready_time = ready_time;
+    t->status = TASK_READY;
+    if (t->queued) tasks_nr_ready[t->last_cpu]++;
+}
+
+/* Number of runnable tasks of a CPU, including the running one */
+static size_t sched_get_load(uint16_t cpu_id)
+{
+    size_t load = tasks_nr_ready[cpu_id];
+
+    if (tasks_running[cpu_id] != NULL
+        && tasks_running[cpu_id] != tasks_idle[cpu_id])
+    {
+        load++;
+    }
+
+    return load;
+}
+
+/* Find the least loaded CPU in the affinity mask of task */
+static uint16_t sched_select_cpu(task_t *t)
+{
+    uint16_t cpu_id = CPU_MAX;
+    size_t min_load = SIZE_MAX;
+
+    for (size_t k = 0; k < CPU_MAX; k++) {
+        if (tasks_idle[k] == NULL || !cpumask_test(&t->cpumask, k)) continue;
+        size_t load = sched_get_load(k);
+        if (load < min_load) {
+            min_load = load;
+            cpu_id = k;
+        }
+    }
+
+    /* No CPU in the mask is running scheduler yet */
+    if (cpu_id == CPU_MAX) {
+        const smp_info_t *smp_info = smp_get_info();
+        cpu_id = 0;
+        for (size_t k = 0; smp_info != NULL && k < smp_info->num_cpus; k++) {
+            if (cpumask_test(&t->cpumask, smp_info->cpus[k].cpu_id)) {
+                cpu_id = smp_info->cpus[k].cpu_id;
+                break;
+            }
+        }
+    }
+
+    return cpu_id;
+}
+
+static void sched_mark_idle(uint16_t cpu_id, bool idle)
+{
+    uint64_t bit = 1ULL << (cpu_id % 64);
+
+    if (idle) {
+        __atomic_fetch_or(&sched_idle_mask.bits[cpu_id / 64], bit,
+                          __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(&sched_idle_mask.bits[cpu_id / 64], ~bit,
+                           __ATOMIC_RELEASE);
+    }
+}
+
+/* Find an idle CPU in the mask, or return CPU_MAX */
+static uint16_t sched_find_idle_cpu(const cpumask_t *mask)
+{
+    for (size_t i = 0; i < CPU_MAX / 64; i++) {
+        uint64_t bits = __atomic_load_n(&sched_idle_mask.bits[i],
+                                        __ATOMIC_ACQUIRE) & mask->bits[i];
+        if (bits != 0) return i * 64 + __builtin_ctzll(bits);
+    }
+
+    return CPU_MAX;
+}
+
+/* Whether task "t" should preempt the running task "curr" */
+static bool sched_preempts(task_t *t, task_t *curr)
+{
+    if (sched_is_rt(t) || sched_is_rt(curr)) {
+        return t->rt_priority > curr->rt_priority;
+    }
+
+    return t->priority < curr->priority;
+}
+
+/*
+ * Let a CPU reschedule now for a newly runnable task, sched_lock must be
+ * held. An idle CPU pulls the task by load balancing if it is queued on
+ * another CPU.
+ */
+static void sched_kick(task_t *t)
+{
+    const smp_info_t *smp_info = smp_get_info();
+    uint16_t target = t->last_cpu;
+
+    if (target >= CPU_MAX || !cpumask_test(&sched_idle_mask, target)) {
+        uint16_t idle = sched_find_idle_cpu(&t->cpumask);
+        bool preempt = target < CPU_MAX && tasks_running[target] != NULL
+                       && sched_preempts(t, tasks_running[target]);
+
+        /* A real-time task preempts in place instead of waiting for a pull */
+        if (idle != CPU_MAX && !(preempt && sched_is_rt(t))) {
+            target = idle;
+        } else if (!preempt) {
+            return;
+        }
+    }
+
+    sched_need_resched[target].flag = true;
+
+    /* Store above wakes the idle CPU waiting by MWAIT */
+    if (target == this_cpu_read(cpu_id)
+        || (cpumask_test(&sched_idle_mask, target) && idle_wake_by_store()))
+    {
+        return;
+    }
+
+    if (sched_ipi_vector == 0 || smp_info == NULL
+        || smp_info->num_cpus != cpu_num) {
+        return;
+    }
+
+    apic_send_ipi(sched_lapic_id[target], sched_ipi_vector,
+                  APIC_IPI_TYPE_FIXED);
+}
+
+/* Hide a dead task from lookup and let idle tasks free it */
+static void sched_reap_rcu(rcu_head_t *head)
+{
+    task_t *t = container_of(head, task_t, rcu);
+
+    lock_lock(&sched_lock);
+    vec_push_back(&tasks_reaper, t);
+    lock_release(&sched_lock);
+}
+
+/* Free the task after readers which may have found it by tid are done */
+static void sched_reap(task_t *t)
+{
+    tid_unpublish(t);
+    call_rcu(&t->rcu, sched_reap_rcu);
+}
+
+/* Resume the parent blocked in vfork by task "t", sched_lock must be held */
+static void sched_vfork_done(task_t *t)
+{
+    task_t *parent = tid_lookup(t->vfork_ptid);
+
+    t->vfork_ptid = TID_NONE;
+    if (parent == NULL) return;
+
+    /* The address space is returned to the process of parent */
+    vdso_set_tid(parent->addrspace, parent->pid);
+
+    parent->vfork_ctid = TID_NONE;
+    if (parent->status == TASK_SLEEPING) {
+        sched_set_ready(parent, ktime_get_ns());
+        sched_kick(parent);
+    }
+}
+
+/* Account the time a task waited in run queue before it is switched in */
+static void sched_account_wait(sched_stat_t *st, uint64_t wait)
+{
+    uint64_t us = wait / 1000;
+    size_t bucket = (us < 2) ? 0 : 63 - __builtin_clzll(us);
+
+    if (bucket >= SCHEDSTAT_BUCKETS) bucket = SCHEDSTAT_BUCKETS - 1;
+
+    st->wait_hist[bucket]++;
+    st->wait_count++;
+    st->wait_ns += wait;
+    if (wait > st->wait_max_ns) st->wait_max_ns = wait;
+}
+
+/* Put the task into the queue of its last CPU if allowed */
+static void sched_enqueue(task_t *t, bool newtask)
+{
+    uint16_t cpu_id = t->last_cpu;
+
+    if (newtask || cpu_id >= CPU_MAX || tasks_idle[cpu_id] == NULL
+        || !cpumask_test(&t->cpumask, cpu_id))
+    {
+        cpu_id = sched_select_cpu(t);
+    }
+
+    sched_queue_insert(cpu_id, t, false);
+}
+
+/*
+ * Put a switched out task back. A preempted real-time task stays at the head
+ * of the queue until its SCHED_RR time slice is used up.
+ */
+static void sched_requeue(task_t *t, uint16_t cpu_id, int64_t mode)
+{
+    bool head = false;
+
+    if (sched_is_rt(t) && t->status == TASK_READY && !sched_rt[cpu_id].throttled
+        && (mode == SCHED_SWITCH_TICK || mode == SCHED_SWITCH_RESCHED))
+    {
+        head = true;
+        if (t->policy == SCHED_RR && mode == SCHED_SWITCH_TICK) {
+            if (t->rt_ticks > 0) t->rt_ticks--;
+            if (t->rt_ticks == 0) {
+                t->rt_ticks = SCHED_RR_TICKS;
+                head = false;
+            }
         }
     }
+
+    if (head && cpumask_test(&t->cpumask, cpu_id)) {
+        sched_queue_insert(cpu_id, t, true);
+    } else {
+        sched_enqueue(t, false);
+    }
+}
+
+/* Account real-time runtime of a CPU and throttle it if over the budget */
+static void sched_rt_update(uint16_t cpu_id, uint64_t now)
+{
+    sched_rt_t *rt = &sched_rt[cpu_id];
+
+    if (now - rt->period_start >= SCHED_RT_PERIOD) {
+        rt->period_start = now;
+        rt->runtime = 0;
+        rt->throttled = false;
+    } else if (!rt->throttled && rt->runtime >= SCHED_RT_RUNTIME) {
+        rt->throttled = true;
+        sched_stats[cpu_id].rt_throttled++;
+    }
+}
+
+/*
+ * Pick the real-time task of the highest priority if "rt" is true, or round
+ * robin in the queue of current CPU.
+ */
+static task_t *sched_pick(uint16_t cpu_id, bool rt, uint64_t now)
+{
+    task_queue_t *q = &tasks_queue[cpu_id];
+    size_t task_num = vec_length(q);
+
+    if (rt) {
+        size_t index = SIZE_MAX;
+
+        for (size_t i = 0; i < task_num; i++) {
+            task_t *t = vec_at(q, i);
+            if (!sched_is_rt(t) || !cpumask_test(&t->cpumask, cpu_id)
+                || !sched_task_runnable(t, now)) continue;
+            if (index == SIZE_MAX
+                || t->rt_priority > vec_at(q, index)->rt_priority) index = i;
+        }
+
+        if (index != SIZE_MAX) return sched_queue_remove(cpu_id, index);
+    }
+
+    for (size_t i = 0; i < task_num; i++) {
+        task_t *t = sched_queue_remove(cpu_id, 0);
+
+        /* The affinity mask was changed, move it to another CPU */
+        if (!cpumask_test(&t->cpumask, cpu_id)) {
+            sched_enqueue(t, false);
+            continue;
+        }
+        if (sched_task_runnable(t, now)) return t;
+
+        sched_queue_insert(cpu_id, t, false);
+    }
+
+    return NULL;
 }
 
 /*
- * Context switch has 3 situations which are determined by parameter "mode":
- * [0]: triggered by timer cycle.
- * [1]: triggered by task itself which needs to fall in sleep.
- * [2]: triggered by fork which needs to create a clone.
+ * Pull one task from the busiest CPU. The periodic balancing only moves
+ * cache-cold tasks when the imbalance is at least 2, and an idle CPU also
+ * takes a cache-hot task if there is no cold one. A waiting real-time task
+ * is always taken first.
+ */
+static void sched_balance(uint16_t cpu_id, bool idle, uint64_t now)
+{
+    uint16_t busiest = cpu_id;
+    size_t max_load = 0;
+    size_t local_load = sched_get_load(cpu_id);
+
+    for (size_t k = 0; k < CPU_MAX; k++) {
+        if (k == cpu_id || vec_length(&tasks_queue[k]) == 0) continue;
+        size_t load = sched_get_load(k);
+        if (load > max_load) {
+            max_load = load;
+            busiest = k;
+        }
+    }
+
+    if (busiest == cpu_id || max_load < local_load + 2) return;
+
+    task_queue_t *q = &tasks_queue[busiest];
+    size_t index = SIZE_MAX;
+
+    for (size_t i = 0; i < vec_length(q); i++) {
+        task_t *t = vec_at(q, i);
+        if (!sched_task_runnable(t, now) || !cpumask_test(&t->cpumask, cpu_id))
+            continue;
+        if (sched_is_rt(t)) {
+            index = i;
+            break;
+        }
+        if (tasks_coordinate[busiest] - t->last_tick >= SCHED_MIGRATION_COST) {
+            index = i;
+            break;
+        }
+        if (idle && index == SIZE_MAX) index = i;
+    }
+
+    if (index != SIZE_MAX) {
+        task_t *t = sched_queue_remove(busiest, index);
+        sched_queue_insert(cpu_id, t, false);
+    }
+}
+
+/*
+ * Context switch has 4 situations which are determined by parameter "mode":
+ * [0]: SCHED_SWITCH_TICK, triggered by timer cycle.
+ * [1]: SCHED_SWITCH_SLEEP, triggered by task itself which needs to fall in
+ *      sleep.
+ * [2]: SCHED_SWITCH_FORK, triggered by fork which needs to create a clone.
+ * [3]: SCHED_SWITCH_RESCHED, triggered by reschedule IPI from another CPU.
  *
  */
 void do_context_switch(void* stack, int64_t mode)
 {
-    const smp_info_t* smp_info = smp_get_info();
-    if (smp_info == NULL)               return;
+    /* Run expired timers, and the timer must be programmed again */
+    bool tick = (mode == SCHED_SWITCH_TICK) ? hrtimer_interrupt() : false;
 
     /* Make sure that all CPUs initialization finished */
-    if (smp_info->num_cpus != cpu_num)  return;
+    const smp_info_t* smp_info = smp_get_info();
+    if (smp_info == NULL || smp_info->num_cpus != cpu_num) {
+        if (mode == SCHED_SWITCH_TICK || mode == SCHED_SWITCH_RESCHED) {
+            apic_send_eoi();
+        }
+        return;
+    }
 
-    /* Firstly all events on event bus should be processed */
+    /*
+     * A lock taken by lock_lock_noirq() is held, so other tasks of this CPU
+     * may spin for it. Switch at the next interrupt after it is released.
+     */
+    if ((mode == SCHED_SWITCH_TICK || mode == SCHED_SWITCH_RESCHED)
+        && this_cpu_read(preempt_count) != 0) {
+        sched_need_resched[this_cpu_read(cpu_id)].flag = true;
+        apic_send_eoi();
+        return;
+    }
+
+    /* No read-side section of RCU spans an interrupt */
+    rcu_note_qs(this_cpu_read(cpu_id));
+
+    /* Wake subscribers of events published by interrupt handlers */
     eb_dispatch();
 
+    /* Refine the TSC rate of the clocksource */
+    if (this_cpu_read(is_bsp)) ktime_update();
+
+    /*
+     * Only timers expired and the time slice is not over. Resume the current
+     * task unless a woken task should preempt it.
+     */
+    if (mode == SCHED_SWITCH_TICK && !tick) {
+        if (!sched_need_resched[this_cpu_read(cpu_id)].flag) {
+            apic_send_eoi();
+            return;
+        }
+        mode = SCHED_SWITCH_RESCHED;
+    }
+
     lock_lock(&sched_lock);
 
     cpu_t *cpu = smp_get_current_cpu(true);
@@ -157,69 +638,97 @@ void do_context_switch(void* stack, int64_t mode)
 
     uint16_t cpu_id = cpu->cpu_id;
     uint64_t ticks = tasks_coordinate[cpu_id];
+    uint64_t now = ktime_get_ns();
+    sched_stat_t *st = &sched_stats[cpu_id];
 
     task_t *curr = tasks_running[cpu_id];
     task_t *next = NULL;
 
+    if (mode >= 0 && mode < SCHED_SWITCH_MODES) st->switches[mode]++;
+
     if (curr) {
         curr->tstack_top = stack;
         curr->last_tick = ticks;
         curr->errno = cpu->errno;
+        fpu_switch_out(curr, cpu_id);
+
+        if (now > curr->run_start) {
+            curr->runtime += now - curr->run_start;
+            if (curr == tasks_idle[cpu_id]) st->idle_ns += now - curr->run_start;
+            if (sched_is_rt(curr)) {
+                sched_rt[cpu_id].runtime += now - curr->run_start;
+                st->rt_ns += now - curr->run_start;
+            }
+        }
+        sched_rt_update(cpu_id, now);
 
-        if (curr->status == TASK_RUNNING)
+        if (curr->status == TASK_RUNNING) {
             curr->status = TASK_READY;
+            curr->ready_time = now;
+        }
 
-        if ((uint64_t)curr != (uint64_t)tasks_idle[cpu_id]) {
-            /* TODO: Need to add macros for mode 2 etc. */
-            if (mode == 2) {
+        if ((uint64_t)curr == (uint64_t)tasks_idle[cpu_id]) {
+            /* Idle task is never queued */
+        } else if (curr->status == TASK_ZOMBIE) {
+            /* Only found by tid until parent collects it */
+        } else if (curr->status == TASK_DEAD) {
+            sched_reap(curr);
+        } else {
+            if (mode == SCHED_SWITCH_FORK) {
                 task_t *curr_fork = task_fork(curr);
-                vec_push_back(&tasks_active, curr_fork);
+                if (curr_fork != NULL) {
+                    curr_fork->ready_time = now;
+                    tid_publish(curr_fork);
+                    sched_enqueue(curr_fork, true);
+                }
             }
-            vec_push_back(&tasks_active, curr);
+            sched_requeue(curr, cpu_id, mode);
         }
 
     }
     tasks_running[cpu_id] = NULL;
     curr = NULL;
 
-    uint64_t loop_size = 0;
-    while (true) {
-        if (vec_length(&tasks_active) > 0) {
-            next = vec_at(&tasks_active, 0);
-            vec_erase(&tasks_active, 0);
-        } else {
-            next = NULL;
-            break;
-        }
-        if (next->status == TASK_READY) break;
-        if (next->status == TASK_SLEEPING) {
-            if ((hpet_get_nanos() >= next->wakeup_time)
-                && (next->wakeup_time > 0)) {
-                break;
-            }
-        }
-        vec_push_back(&tasks_active, next);
-        /* If the whole task list is visited, exit with NULL task */
-        loop_size++;
-        if (loop_size >= vec_length(&tasks_active)) {
-            next = NULL;
-            break;
-        }
+    if (ticks % SCHED_BALANCE_INTERVAL == 0) {
+        sched_balance(cpu_id, false, now);
+    }
+
+    bool rt = !sched_rt[cpu_id].throttled;
+
+    next = sched_pick(cpu_id, rt, now);
+    if (next == NULL) {
+        sched_balance(cpu_id, true, now);
+        next = sched_pick(cpu_id, rt, now);
     }
 
     if (next == NULL) {
         next = tasks_idle[cpu_id];
     }
 
+    if (next != tasks_idle[cpu_id]) {
+        /* A task woken by timeout has been ready since "wakeup_time" */
+        uint64_t ready = (next->status == TASK_SLEEPING)
+                         ? next->wakeup_time : next->ready_time;
+        if (ready != 0 && now > ready) sched_account_wait(st, now - ready);
+    }
+
     next->status = TASK_RUNNING;
+    next->run_start = now;
+    next->nr_switches++;
+    next->last_cpu = cpu_id;
     tasks_running[cpu_id] = next;
+    cpu->curr_task = next;
+    sched_mark_idle(cpu_id, next == tasks_idle[cpu_id]);
+    sched_need_resched[cpu_id].flag = false;
+    fpu_switch_in(next, cpu_id);
 
     cpu->errno = next->errno;
     cpu->tss.rsp0 = (uint64_t)(next->kstack_limit + STACK_SIZE);
+    cpu->kernel_rsp = cpu->tss.rsp0;
 
     tasks_coordinate[cpu_id]++;
     
-    if (mode == 0) {
+    if (mode == SCHED_SWITCH_TICK || mode == SCHED_SWITCH_RESCHED) {
         apic_send_eoi();
     }
 
@@ -250,19 +759,13 @@ void do_context_switch(void* stack, int64_t mode)
 
 task_id_t sched_get_tid()
 {
-    cpu_t* cpu = smp_get_current_cpu(false);
-    if (cpu == NULL) {
+    task_t* curr = sched_get_current_task();
+    if (curr == NULL) {
         return TID_MAX;
     }   
- 
-    lock_lock(&sched_lock);
 
-    uint16_t cpu_id = cpu->cpu_id;
-    task_t* curr = tasks_running[cpu_id];
     task_id_t tid = curr->tid;
 
-    lock_release(&sched_lock);
-
     if (tid < 1) kpanic("SCHED: %s returns corrupted tid\n", __func__);
 
     return tid;
@@ -277,8 +780,8 @@ task_id_t sched_fork(void)
  
     lock_lock(&sched_lock);
 
-    uint16_t cpu_id = cpu->cpu_id;
-    task_t *curr = tasks_running[cpu_id];
+    /* Task may have migrated since "cpu" was read, look it up now */
+    task_t *curr = sched_get_current_task();
     task_id_t tid = TID_MAX;
     if (curr) {
         if (curr->tid < 1) {
@@ -295,20 +798,69 @@ task_id_t sched_fork(void)
 }
 
 void sched_sleep(time_t millis)
+{
+    sched_sleep_until(ktime_get_ns() + MILLIS_TO_NANOS(millis));
+}
+
+void sched_nanosleep(uint64_t nanos)
+{
+    sched_sleep_until(ktime_get_ns() + nanos);
+}
+
+/* Sleep until "deadline" of ktime_get_ns(), or an earlier wakeup */
+void sched_sleep_until(uint64_t deadline)
 {
     cpu_t* cpu = smp_get_current_cpu(false);
     if (cpu == NULL) {
-        hpet_sleep(millis);
+        uint64_t now = ktime_get_ns();
+        if (deadline > now) hpet_nanosleep(deadline - now);
         return;
     }
- 
+
+    sched_prepare_sleep(deadline);
+    force_context_switch();
+}
+
+/* Timer of a task sleeping with timeout, in timer interrupt */
+static void sched_sleep_timeout(hrtimer_t *timer)
+{
+    task_t *t = container_of(timer, task_t, sleep_timer);
+
     lock_lock(&sched_lock);
+    if (t->status == TASK_SLEEPING && t->wakeup_time > 0
+        && ktime_get_ns() >= t->wakeup_time) {
+        /* It has been ready since "wakeup_time" */
+        sched_set_ready(t, t->wakeup_time);
+        sched_kick(t);
+    }
+    lock_release(&sched_lock);
+}
 
-    uint16_t cpu_id = cpu->cpu_id;
-    task_t *curr = tasks_running[cpu_id];
+/*
+ * Mark current task as sleeping without switching out. The task will be
+ * scheduled again after it is woken by sched_wakeup() or "wakeup_time" (if
+ * it is not zero) is reached.
+ */
+task_t *sched_prepare_sleep(uint64_t wakeup_time)
+{
+    cpu_t* cpu = smp_get_current_cpu(false);
+    if (cpu == NULL) {
+        return NULL;
+    }
+
+    lock_lock(&sched_lock);
+
+    task_t *curr = sched_get_current_task();
     if (curr) {
-        curr->wakeup_time = hpet_get_nanos() + MILLIS_TO_NANOS(millis);
+        curr->wakeup_time = wakeup_time;
+        if (wakeup_time > 0) {
+            curr->sleep_timer.func = sched_sleep_timeout;
+            hrtimer_start(&curr->sleep_timer, wakeup_time);
+        } else {
+            hrtimer_try_cancel(&curr->sleep_timer);
+        }
         curr->wakeup_event.type = EVENT_UNDEFINED;
+        curr->wakeup_event.para = 0;
         curr->status = TASK_SLEEPING;
         if (curr->tid < 1) {
             kpanic("SCHED: %s meets corrupted tid\n", __func__);
@@ -317,164 +869,340 @@ void sched_sleep(time_t millis)
 
     lock_release(&sched_lock);
 
-    force_context_switch();
+    return curr;
 }
 
-static task_status_t sched_get_task_status_impl(task_id_t tid)
+void sched_wakeup(task_t *t, event_para_t para)
 {
-    task_t *ntask = NULL;
-    task_status_t status = TASK_UNKNOWN;
-    bool has_child = false; 
+    lock_lock(&sched_lock);
 
-    size_t i;
-    for (i = 0; i < vec_length(&tasks_active); i++) {
-        task_t *t = vec_at(&tasks_active, i); 
-        if (t) {
-            if (t->tid == tid) {
-                status = t->status;
-                ntask = t;
-            }
-            if (t->ptid == tid) {
-                if(t->status != TASK_DEAD && t->status != TASK_UNKNOWN) {
-                    has_child = true;
-                } else if(sched_get_task_status_impl(t->tid) == TASK_RUNNING) {
-                    has_child = true;
-                }
-            }
-        }   
-    }
-    for (i = 0; i < CPU_MAX && !has_child; i++) {
-        task_t *t = tasks_running[i];
-        if (t) {
-            if (t->tid == tid) {
-                status = t->status;
-                ntask = t;
-            }
-            if (t->ptid == tid) {
-                if(t->status != TASK_DEAD && t->status != TASK_UNKNOWN) {
-                    has_child = true;
-                } else if(sched_get_task_status_impl(t->tid) == TASK_RUNNING) {
-                    has_child = true;
-                }
-            }
-        }   
+    t->wakeup_event.para = para;
+    if (t->status == TASK_SLEEPING) {
+        sched_set_ready(t, ktime_get_ns());
+        sched_kick(t);
     }
 
-    if (!has_child) {
-        if (ntask != NULL) {
-            if (ntask->status == TASK_DEAD) status = TASK_UNKNOWN;
-        }
-    } else {
-        status = TASK_RUNNING;
-    }
+    lock_release(&sched_lock);
+}
 
-    return status;
+void sched_yield(void)
+{
+    force_context_switch();
 }
 
-task_status_t sched_get_task_status(task_id_t tid)
+/* Free a zombie, it is freed later if still on its CPU */
+static void sched_release_zombie(task_t *t)
 {
-    task_status_t status = TASK_UNKNOWN;
+    t->status = TASK_DEAD;
+    if (tasks_running[t->last_cpu] != t) {
+        sched_reap(t);
+    }
+}
 
-    lock_lock(&sched_lock);
-    status = sched_get_task_status_impl(tid);
-    lock_release(&sched_lock);
+/* Detach children of an exiting task, its zombie children are freed */
+static void sched_orphan_children(task_t *t)
+{
+    for (size_t i = 0; i < vec_length(&t->child_list); i++) {
+        task_t *c = tid_lookup(vec_at(&t->child_list, i));
+        if (c == NULL || c->ptid != t->tid) continue;
 
-    return status;
+        c->ptid = TID_NONE;
+        if (c->status == TASK_ZOMBIE) sched_release_zombie(c);
+    }
+    vec_erase_all(&t->child_list);
 }
 
 void sched_exit(int64_t status)
 {
-    (void)status;
-
     cpu_t* cpu = smp_get_current_cpu(false);
     if (cpu == NULL) {
         return;
     }   
- 
+
+    /* Close the files before the parent is woken, closing may sleep */
+    task_t *t = sched_get_current_task();
+    if (t != NULL) task_put_files(t);
+
+    lock_lock(&wait_lock);
     lock_lock(&sched_lock);
 
-    uint16_t cpu_id = cpu->cpu_id;
-    task_t *curr = tasks_running[cpu_id];
+    task_t *curr = sched_get_current_task();
+    task_t *parent = NULL;
     if (curr) {
-        curr->status = TASK_DEAD;
         if (curr->tid < 1) {
             kpanic("SCHED: %s meets corrupted tid\n", __func__);
         }
+
+        curr->exit_code = status;
+        sched_orphan_children(curr);
+
+        if (curr->ptid != TID_NONE && curr->ptid != TID_MAX) {
+            parent = tid_lookup(curr->ptid);
+        }
+        if (parent != NULL) {
+            curr->status = TASK_ZOMBIE;
+        } else {
+            curr->ptid = TID_NONE;
+            curr->status = TASK_DEAD;
+        }
+
+        /* No longer uses the user stack, the parent of vfork can run */
+        if (curr->vfork_ptid != TID_NONE) sched_vfork_done(curr);
     }   
 
     lock_release(&sched_lock);
 
+    if (parent != NULL) {
+        waitqueue_wake_all(&parent->wait_child, curr->tid);
+    }
+
+    lock_release(&wait_lock);
+
     force_context_switch();
 }
 
-bool sched_resume_event(event_t event)
+/*
+ * Create a child which borrows address space and user stack of current task,
+ * and sleep until the child calls execve or exits. Return tid of the child.
+ */
+task_id_t sched_vfork(void)
 {
-    bool ret = false;
+    task_t *tp = sched_get_current_task();
+    if (tp == NULL) return TID_MAX;
 
     lock_lock(&sched_lock);
-    for (size_t i = 0; i < vec_length(&tasks_active); i++) {
-        task_t *t = vec_at(&tasks_active, i);
-        if (t) {
-            if (t->status == TASK_SLEEPING
-                && t->wakeup_event.type == event.type)
-            {
-                t->status = TASK_READY;
-                t->wakeup_event.para = event.para;
-                ret = true;
+    task_t *tc = task_vfork(tp);
+    lock_release(&sched_lock);
+
+    if (tc == NULL) return TID_MAX;
+
+    task_id_t tid = tc->tid;
+    tp->vfork_ctid = tid;
+
+    /* The child is a new process running on the address space of caller */
+    vdso_set_tid(tc->addrspace, tc->pid);
+
+    sched_add(tc);
+
+    while (true) {
+        lock_lock(&sched_lock);
+        if (tp->vfork_ctid == TID_NONE) {
+            lock_release(&sched_lock);
+            break;
+        }
+        tp->wakeup_time = 0;
+        tp->status = TASK_SLEEPING;
+        lock_release(&sched_lock);
+
+        force_context_switch();
+    }
+
+    return tid;
+}
+
+/*
+ * Wait for a child task ("pid" is -1 for any child) to exit and collect its
+ * exit code. Return tid of the child, 0 if "nohang" is true and no child has
+ * exited, or -1 if there is no such child.
+ */
+int64_t sched_waitpid(int64_t pid, int64_t *status, bool nohang)
+{
+    task_t *curr = sched_get_current_task();
+    int64_t ret = -1;
+
+    if (curr == NULL) return -1;
+
+    lock_lock(&wait_lock);
+
+    while (true) {
+        bool has_child = false;
+        task_t *z = NULL;
+
+        lock_lock(&sched_lock);
+
+        if (pid != -1) {
+            task_t *t = tid_lookup(pid);
+            if (t != NULL && t->ptid == curr->tid) {
+                has_child = true;
+                if (t->status == TASK_ZOMBIE) z = t;
+            }
+        } else {
+            for (size_t i = 0; i < vec_length(&curr->child_list); i++) {
+                task_t *t = tid_lookup(vec_at(&curr->child_list, i));
+                if (t == NULL || t->ptid != curr->tid) continue;
+                has_child = true;
+                if (t->status == TASK_ZOMBIE) {
+                    z = t;
+                    break;
+                }
             }
         }
+
+        if (z != NULL) {
+            ret = z->tid;
+            if (status != NULL) *status = z->exit_code;
+            vec_erase_val(&curr->child_list, z->tid);
+            sched_release_zombie(z);
+        } else {
+            ret = has_child ? 0 : -1;
+        }
+
+        lock_release(&sched_lock);
+
+        if (z != NULL || !has_child || nohang) break;
+
+        waitqueue_prepare(&curr->wait_child, 0);
+        lock_release(&wait_lock);
+        waitqueue_wait(&curr->wait_child, NULL);
+        lock_lock(&wait_lock);
     }
-    lock_release(&sched_lock);
+
+    lock_release(&wait_lock);
 
     return ret;
 }
 
-event_t sched_wait_event(event_t event)
+/*
+ * Set CPU affinity mask of a task. The task is moved to an allowed CPU when
+ * it is scheduled next time. Return -1 with ESRCH if there is no such task,
+ * or EINVAL if no CPU in the mask is online.
+ */
+int64_t sched_set_affinity(task_id_t tid, const cpumask_t *mask)
 {
-    event_t e = {0};
-    cpu_t* cpu = smp_get_current_cpu(false);
-    if (cpu == NULL) {
-        return e;
-    }   
-   
+    bool online = false;
+    int64_t ret = 0;
+
     lock_lock(&sched_lock);
 
-    uint16_t cpu_id = cpu->cpu_id;
-    task_t* curr = tasks_running[cpu_id];
-    curr->wakeup_time = 0;
-    curr->wakeup_event = event;
-    curr->status = TASK_SLEEPING;
+    for (size_t k = 0; k < CPU_MAX; k++) {
+        if (tasks_idle[k] != NULL && cpumask_test(mask, k)) {
+            online = true;
+            break;
+        }
+    }
 
-    if (curr->tid < 1)
-        kpanic("SCHED: %s meets corrupted tid\n", __func__);
+    task_t *t = tid_lookup(tid);
+    if (t == NULL || t->status == TASK_DEAD) {
+        cpu_set_errno(ESRCH);
+        ret = -1;
+    } else if (!online) {
+        cpu_set_errno(EINVAL);
+        ret = -1;
+    } else {
+        t->cpumask = *mask;
+    }
 
     lock_release(&sched_lock);
 
-    force_context_switch();
+    return ret;
+}
 
-    return curr->wakeup_event;
+/*
+ * Set scheduling policy and real-time priority ("priority" is ignored for
+ * SCHED_OTHER) of a task. It takes effect when the task is scheduled next.
+ */
+bool sched_set_policy(task_id_t tid, uint8_t policy, uint8_t priority)
+{
+    lock_lock(&sched_lock);
+
+    task_t *t = tid_lookup(tid);
+    if (t != NULL && t->status != TASK_DEAD) {
+        t->policy = policy;
+        t->rt_priority = (policy == SCHED_OTHER) ? 0 : priority;
+        t->rt_ticks = SCHED_RR_TICKS;
+        if (t->status == TASK_READY) sched_kick(t);
+    } else {
+        t = NULL;
+    }
+
+    lock_release(&sched_lock);
+
+    return (t != NULL);
 }
 
-task_t* sched_get_current_task()
+bool sched_get_affinity(task_id_t tid, cpumask_t *mask)
 {
-    cpu_t* cpu = smp_get_current_cpu(false);
+    rcu_read_lock();
 
-    if (cpu == NULL) {
+    task_t *t = tid_lookup(tid);
+    if (t != NULL) *mask = t->cpumask;
+
+    rcu_read_unlock();
+
+    return (t != NULL);
+}
+
+/* Per-CPU pointer is read by one instruction, no lock is needed */
+task_t* sched_get_current_task()
+{
+    if (!smp_initialized) {
         return NULL;
     }
 
-    return tasks_running[cpu->cpu_id];
+    return this_cpu_read(curr_task);
 }
 
-uint64_t sched_get_ticks()
+/*
+ * Copy statistics of the first online CPU whose id is not less than "cpu_id".
+ * Return id of that CPU, or CPU_MAX if there is none.
+ */
+uint16_t sched_get_cpu_stat(uint16_t cpu_id, sched_stat_t *out)
 {
-    cpu_t* cpu = smp_get_current_cpu(false);
+    lock_lock(&sched_lock);
 
-    if (cpu == NULL) {
+    for (; cpu_id < CPU_MAX; cpu_id++) {
+        if (tasks_idle[cpu_id] != NULL) {
+            *out = sched_stats[cpu_id];
+            break;
+        }
+    }
+
+    lock_release(&sched_lock);
+
+    return cpu_id;
+}
+
+/*
+ * Copy statistics of the first task whose tid is not less than "tid". Return
+ * tid of that task, or TID_NONE if there is none.
+ */
+task_id_t sched_get_task_stat(task_id_t tid, task_stat_t *out)
+{
+    task_t *t = NULL;
+
+    rcu_read_lock();
+
+    for (; tid < TID_LIMIT; tid++) {
+        t = tid_lookup(tid);
+        if (t == NULL) continue;
+
+        out->tid = t->tid;
+        out->ptid = t->ptid;
+        out->cpu = t->last_cpu;
+        out->status = t->status;
+        out->runtime_ns = t->runtime;
+        out->switches = t->nr_switches;
+        uint64_t now = ktime_get_ns();
+        if (t->status == TASK_RUNNING && now > t->run_start) {
+            out->runtime_ns += now - t->run_start;
+        }
+        strncpy(out->name, t->name, sizeof(out->name) - 1);
+        out->name[sizeof(out->name) - 1] = '\0';
+        break;
+    }
+
+    rcu_read_unlock();
+
+    return (t == NULL) ? TID_NONE : tid;
+}
+
+uint64_t sched_get_ticks()
+{
+    if (!smp_initialized) {
         return 0;
     }
 
-    return tasks_coordinate[cpu->cpu_id];
+    return tasks_coordinate[this_cpu_read(cpu_id)];
 }
 
 void sched_init(const char *name, uint16_t cpu_id)
@@ -482,13 +1210,19 @@ void sched_init(const char *name, uint16_t cpu_id)
     lock_lock(&sched_lock);
     tasks_idle[cpu_id] = task_make(name, task_idle_proc, 255,
                                    TASK_KERNEL_MODE, NULL);
+    tid_publish(tasks_idle[cpu_id]);
+    sched_lapic_id[cpu_id] = this_cpu_read(lapic_id);
+    if (sched_ipi_vector == 0) {
+        sched_ipi_vector = idt_get_available_vector();
+        idt_set_handler(sched_ipi_vector, resched_context_switch);
+    }
     lock_release(&sched_lock);
 
+    /* Ticks of every TIMESLICE_DEFAULT are programmed by hrtimer */
     apic_timer_init(); 
-    apic_timer_set_period(TIMESLICE_DEFAULT);
-    apic_timer_set_mode(APIC_TIMER_MODE_PERIODIC);
     apic_timer_set_handler(enter_context_switch);
     apic_timer_start();
+    hrtimer_cpu_init();
 
     cpu_num++;
 
@@ -515,19 +1249,23 @@ task_t *sched_new(const char *name, void (*entry)(task_id_t), bool usermode)
 void sched_add(task_t *t)
 {
     lock_lock(&sched_lock);
-    vec_push_back(&tasks_active, t); 
+    t->ready_time = ktime_get_ns();
+    tid_publish(t);
+    sched_enqueue(t, true);
+    if (t->status == TASK_READY) sched_kick(t);
     lock_release(&sched_lock);
 }
 
-task_t *sched_execve(
-    const char *path, const char *argv[], const char *envp[], const char *cwd)
+/* Load an executable into a new task which is not linked or queued yet */
+static task_t *sched_load(
+    task_t *tp, const char *path, const char *argv[], const char *envp[],
+    const char *cwd)
 {
     klogi("SCHED: execute \"%s\" in \"%s\" directory\n", path, cwd);
 
     auxval_t aux = {0};
     uint64_t entry = 0;
 
-    task_t *tp = sched_get_current_task();
     task_t *tc = NULL;
 
     char *tname = (char*)path;
@@ -541,16 +1279,18 @@ task_t *sched_execve(
     lock_lock(&sched_lock);
     tc = task_make(tname, NULL, 0, TASK_USER_MODE,
                    tp == NULL ? NULL : tp->addrspace);
-    if (tp != NULL) {
-        for (size_t i = 0; i < vec_length(&tp->dup_list); i++) {
-            file_dup_t dup = vec_at(&tp->dup_list, i);  
-            vec_push_back(&tc->dup_list, dup);
-            klogd("SCHED: fh pair for tid %d's child task %d - (%d, %d)\n",
-                  tp->tid, tc->tid, dup.fh, dup.newfh);
-        }
-    } 
     lock_release(&sched_lock);
 
+    if (tp != NULL && tp->mode == TASK_USER_MODE) {
+        /* Inherit descriptors of the caller except close-on-exec ones */
+        fdtable_copy(&tc->files->fdt, &tp->files->fdt, true);
+    } else if (ttyfh != VFS_INVALID_HANDLE) {
+        /* Started by the kernel, standard I/O goes to the terminal */
+        for (int64_t fd = STDIN; fd <= STDERR; fd++) {
+            fd_install(&tc->files->fdt, vfs_dup(ttyfh), fd, 0);
+        }
+    }
+
     if (elf_load(tc, path, &entry, &aux)) {
         /* Need to release memory for task "tc" */
         task_free(tc);
@@ -562,7 +1302,7 @@ task_t *sched_execve(
     /* TODO: Do not check whether aux.entry == entry any more */
     uint64_t *stack = (uint64_t*)PHYS_TO_VIRT(tc->tstack_top);
 
-    if (cwd != NULL) strcpy(tc->cwd, cwd);
+    if (cwd != NULL) strcpy(tc->files->cwd, cwd);
 
     uint8_t *sa = (uint8_t*)tc->tstack_top;
     size_t nenv = 0, nargs = 0;
@@ -665,13 +1405,95 @@ task_t *sched_execve(
 
     klogd("SCHED: finished initialization with entry 0x%x\n", entry);
 
+    return tc;
+}
+
+/*
+ * Make "tc" a child of "tp", or let it take over tid, parent and children of
+ * "tp" if "replace" is true.
+ */
+static void sched_link(task_t *tp, task_t *tc, bool replace)
+{
+    lock_lock(&wait_lock);
     lock_lock(&sched_lock);
-    if (tp != NULL) {
+    if (tp != NULL && replace) {
+        task_id_t tid = tc->tid;
+
+        tc->tid = tp->tid;
+        tc->ptid = tp->ptid;
+        tc->pid = tc->tid;
+        tp->tid = tid;
+        tp->ptid = TID_NONE;
+        tp->pid = tid;
+
+        tc->child_list = tp->child_list;
+        memset(&tp->child_list, 0, sizeof(tp->child_list));
+
+        tc->policy = tp->policy;
+        tc->rt_priority = tp->rt_priority;
+        tc->rt_ticks = tp->rt_ticks;
+
+        /* The old tid must never be looked up as the husk */
+        tid_publish(tc);
+        vdso_set_tid(tc->addrspace, tc->pid);
+
+        klogi("SCHED: task %d replaces old image (now tid %d)\n",
+              tc->tid, tp->tid);
+    } else if (tp != NULL) {
         klogi("SCHED: child tid %d and parent tid %d\n", tc->tid, tp->tid);
         vec_push_back(&tp->child_list, tc->tid);
         tc->ptid = tp->tid;
     }
     lock_release(&sched_lock);
+    lock_release(&wait_lock);
+}
+
+/*
+ * Load an executable into a new task. If "replace" is true, the new task takes
+ * over tid, parent and children of the caller, which is supposed to exit then.
+ */
+task_t *sched_execve(
+    const char *path, const char *argv[], const char *envp[], const char *cwd,
+    bool replace)
+{
+    task_t *tp = sched_get_current_task();
+    task_t *tc = sched_load(tp, path, argv, envp, cwd);
+    if (tc == NULL) return NULL;
+
+    sched_link(tp, tc, replace);
+
+    task_debug(tc, true);
+
+    sched_add(tc);
+
+    return tc;
+}
+
+/*
+ * Load an executable into a child of current task without copying the
+ * caller. File actions are applied to the descriptors of child in order
+ * before it runs: SPAWN_ACTION_DUP makes "newfd" a copy of "fd" like dup2,
+ * and SPAWN_ACTION_CLOSE closes "fd".
+ */
+task_t *sched_spawn(
+    const char *path, const char *argv[], const char *envp[], const char *cwd,
+    const spawn_action_t *actions, size_t num)
+{
+    task_t *tp = sched_get_current_task();
+    task_t *tc = sched_load(tp, path, argv, envp, cwd);
+    if (tc == NULL) return NULL;
+
+    /* Child is not visible to others yet */
+    for (size_t i = 0; i < num; i++) {
+        const spawn_action_t *a = &actions[i];
+        if (a->type == SPAWN_ACTION_DUP) {
+            fd_dup(&tc->files->fdt, a->fd, a->newfd, 0);
+        } else if (a->type == SPAWN_ACTION_CLOSE) {
+            fd_close(&tc->files->fdt, a->fd);
+        }
+    }
+
+    sched_link(tp, tc, false);
 
     task_debug(tc, true);
 
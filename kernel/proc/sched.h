@@ -16,21 +16,94 @@
 #include <proc/task.h>
 #include <base/time.h>
 
+/* Reasons of context switch, the "mode" of do_context_switch() */
+#define SCHED_SWITCH_TICK       0
+#define SCHED_SWITCH_SLEEP      1
+#define SCHED_SWITCH_FORK       2
+#define SCHED_SWITCH_RESCHED    3
+#define SCHED_SWITCH_MODES      4
+
+/*
+ * Scheduling policies. Runnable real-time tasks (SCHED_FIFO and SCHED_RR) of
+ * higher priority always run before lower ones and all SCHED_OTHER tasks.
+ */
+#define SCHED_OTHER             0
+#define SCHED_FIFO              1
+#define SCHED_RR                2
+
+#define SCHED_RT_PRIO_MIN       1
+#define SCHED_RT_PRIO_MAX       32
+
+/*
+ * Bucket k counts waits in [2^k, 2^(k+1)) us. The first bucket also counts
+ * shorter waits and the last one all longer waits.
+ */
+#define SCHEDSTAT_BUCKETS       16
+
+#define SCHEDSTAT_CPU           0
+#define SCHEDSTAT_TASK          1
+
+/* Per-CPU statistics, only written by the CPU itself */
+typedef struct {
+    uint64_t switches[SCHED_SWITCH_MODES];
+    uint64_t idle_ns;
+    uint64_t rt_ns;         /* Time used by real-time tasks */
+    uint64_t rt_throttled;  /* Times real-time tasks were throttled */
+    uint64_t wait_ns;       /* Total run-queue wait time */
+    uint64_t wait_max_ns;
+    uint64_t wait_count;
+    uint64_t wait_hist[SCHEDSTAT_BUCKETS];
+} __attribute__((aligned(64))) sched_stat_t;
+
+typedef struct {
+    uint64_t tid;
+    uint64_t ptid;
+    uint64_t cpu;
+    uint64_t status;
+    uint64_t runtime_ns;
+    uint64_t switches;
+    char     name[64];
+} task_stat_t;
+
+#define SPAWN_ACTION_DUP        1
+#define SPAWN_ACTION_CLOSE      2
+#define SPAWN_ACTION_MAX        16
+
+/* File action applied to the child of spawn before it runs */
+typedef struct {
+    int64_t type;
+    int64_t fd;
+    int64_t newfd;      /* Only used by SPAWN_ACTION_DUP */
+} spawn_action_t;
+
 void sched_debug(bool showlog);
 
 void sched_init(const char *name, uint16_t cpu_id);
 task_t *sched_new(const char *name, void (*entry)(task_id_t), bool usermode);
 void sched_add(task_t *t);
 void sched_sleep(time_t ms);
+void sched_nanosleep(uint64_t nanos);
+void sched_sleep_until(uint64_t deadline);
+task_t *sched_prepare_sleep(uint64_t wakeup_time);
+void sched_wakeup(task_t *t, event_para_t para);
+void sched_yield(void);
 task_id_t sched_fork(void);
+task_id_t sched_vfork(void);
 void sched_exit(int64_t status);
-event_t sched_wait_event(event_t event);
-bool sched_resume_event(event_t event);
 task_t *sched_get_current_task(void);
 uint16_t sched_get_cpu_num(void);
 uint64_t sched_get_ticks(void);
 task_id_t sched_get_tid(void);
-task_status_t sched_get_task_status(task_id_t tid);
+int64_t sched_waitpid(int64_t pid, int64_t *status, bool nohang);
+int64_t sched_set_affinity(task_id_t tid, const cpumask_t *mask);
+bool sched_get_affinity(task_id_t tid, cpumask_t *mask);
+bool sched_set_policy(task_id_t tid, uint8_t policy, uint8_t priority);
+uint16_t sched_get_cpu_stat(uint16_t cpu_id, sched_stat_t *out);
+task_id_t sched_get_task_stat(task_id_t tid, task_stat_t *out);
 
 task_t *sched_execve(
-    const char *path, const char *argv[], const char *envp[], const char *cwd);
+    const char *path, const char *argv[], const char *envp[], const char *cwd,
+    bool replace);
+task_t *sched_spawn(
+    const char *path, const char *argv[], const char *envp[], const char *cwd,
+    const spawn_action_t *actions, size_t num);
@@ -3,12 +3,19 @@
 global enter_context_switch
 global exit_context_switch
 global force_context_switch
+global resched_context_switch
 global fork_context_switch
 
 extern do_context_switch
 extern lock_release
 
+;
+; Interrupt entries swap GS bases if they interrupt user mode, and every
+; iretq swaps them back if it returns to user mode, see swapgs_if_user.
+; Kernel frames built by force/fork_context_switch never need the swap.
+;
 enter_context_switch:
+    swapgs_if_user 8
     push_all
 
     mov rdi, rsp
@@ -17,7 +24,23 @@ enter_context_switch:
     ; Will call exit_context_switch in the end of implementation
     call do_context_switch
 
-    add rsp, 120
+    ; Returned before the scheduler starts, resume the interrupted code
+    pop_all
+    swapgs_if_user 8
+    iretq
+
+; Handler of reschedule IPI
+resched_context_switch:
+    swapgs_if_user 8
+    push_all
+
+    mov rdi, rsp
+    mov rsi, 3
+
+    call do_context_switch
+
+    pop_all
+    swapgs_if_user 8
     iretq
 
 exit_context_switch:
@@ -31,6 +54,8 @@ exit_context_switch:
 
     pop_all
 
+    ; The frame of next task decides if it returns to user mode
+    swapgs_if_user 8
     iretq
 
 force_context_switch:
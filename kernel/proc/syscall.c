@@ -5,17 +5,23 @@
 #include <libc/errno.h>
 
 #include <sys/cpu.h>
+#include <sys/ktime.h>
 #include <sys/idt.h>
 #include <sys/apic.h>
 #include <sys/panic.h>
 #include <sys/isr_base.h>
 #include <base/klog.h>
+#include <base/klib.h>
+#include <base/lockstat.h>
 #include <base/vector.h>
 #include <proc/task.h>
 #include <proc/sched.h>
 #include <proc/syscall.h>
+#include <proc/wait.h>
+#include <proc/futex.h>
 #include <proc/eventbus.h>
 #include <fs/filebase.h>
+#include <fs/dcache.h>
 #include <fs/vfs.h>
 #include <fs/ttyfs.h>
 #include <device/keyboard/keyboard.h>
@@ -27,7 +33,7 @@ extern int64_t syscall_handler();
 
 typedef int64_t (*syscall_ptr_t)(void);
 
-extern lock_t vfs_lock;
+extern mutex_t vfs_lock;
 extern lock_t sched_lock;
 
 static bool debug_info = false;
@@ -118,7 +124,7 @@ uint64_t k_vm_map(uint64_t *hint, uint64_t length, uint64_t prot,
     if (debug_info) {
         klogi("k_vm_map: tid %d #%d 0x%x(PML4 0x%x) map 0x%x to 0x%x with %d "
               "pages, prot 0x%x, flags 0x%x\n",
-              t->tid, vec_length(&t->mmap_list), as, as->PML4, phys_ptr, ptr,
+              t->tid, vec_length(&as->mmap_list), as, as->PML4, phys_ptr, ptr,
               np, prot, flags);
     }
 
@@ -129,9 +135,9 @@ uint64_t k_vm_map(uint64_t *hint, uint64_t length, uint64_t prot,
     m.np = NUM_PAGES(length);
     m.flags = pf;
 
-    lock_lock(&sched_lock);
-    vec_push_back(&t->mmap_list, m);
-    lock_release(&sched_lock);
+    lock_lock(&as->lock);
+    vec_push_back(&as->mmap_list, m);
+    lock_release(&as->lock);
 
     return ptr;
 
@@ -174,6 +180,15 @@ err_exit:
     return -1;
 }
 
+/* Return the handle of descriptor "fd" of current task with a reference */
+static vfs_handle_t get_handle(int64_t fd)
+{
+    task_t *t = sched_get_current_task();
+
+    if (t == NULL || t->files == NULL) return VFS_INVALID_HANDLE;
+    return fd_get(&t->files->fdt, fd);
+}
+
 static int get_full_path(int64_t dirfh, const char *path, char *full_path)
 {
     /* Clean the full path buffer */
@@ -183,20 +198,20 @@ static int get_full_path(int64_t dirfh, const char *path, char *full_path)
         /* Get the parent path name from TCB (task control block) */
         task_t *t = sched_get_current_task();
         if (t != NULL) {
-            if (path[0] != '/' ) strcpy(full_path, t->cwd);
+            if (path[0] != '/' ) strcpy(full_path, t->files->cwd);
         } else {
             cpu_set_errno(EINVAL);
             return -1;
         }
     } else if ((int32_t)dirfh >= (int32_t)0) {
         /* Get the parent path name from dirfh */
-        vfs_node_desc_t *tnode = vfs_handle_to_fd((vfs_handle_t)dirfh);
-        if (tnode != NULL) {
-            if (path[0] == '.') strcpy(full_path, tnode->path);
-        } else {
+        vfs_handle_t dh = get_handle(dirfh);
+        if (dh == VFS_INVALID_HANDLE) {
             cpu_set_errno(EINVAL);
             return -1;
         }
+        if (path[0] == '.') strcpy(full_path, dh->path);
+        vfs_close(dh);
     }
 
     if (strcmp(path, ".") == 0) {
@@ -272,10 +287,17 @@ static int get_full_path(int64_t dirfh, const char *path, char *full_path)
 
 int64_t k_openat(int64_t dirfh, char *path, int64_t flags, int64_t mode)
 {
+    task_t *t = sched_get_current_task();
+
     /* "mode" is always zero */
     (void)mode;
     cpu_set_errno(0);
 
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        return -1;
+    }
+
     char full_path[VFS_MAX_PATH_LEN] = {0};
     if (get_full_path(dirfh, path, full_path) < 0) {
         cpu_set_errno(EINVAL);
@@ -340,7 +362,15 @@ int64_t k_openat(int64_t dirfh, char *path, int64_t flags, int64_t mode)
     }
 
     klogi("k_openat: dirfh 0x%x, path %s and flags 0x%x\n", dirfh, path, flags);
-    return vfs_open(full_path, openmode);
+
+    vfs_handle_t fh = vfs_open(full_path, openmode);
+    if (fh == VFS_INVALID_HANDLE) {
+        cpu_set_errno(ENOENT);
+        return -1;
+    }
+
+    return fd_install(&t->files->fdt, fh, 0,
+                      (flags & O_CLOEXEC) ? FD_CLOEXEC : 0);
 }
 
 int64_t k_unlink(char *path)
@@ -384,14 +414,18 @@ int64_t k_unlink(char *path)
         return -1;
     }
 
+    mutex_lock(&vfs_lock);
     vfs_inode_t *pi = tnode->parent;
     for (size_t i = 0; i < vec_length(&(pi->child)); i++) {
         if (vec_at(&(pi->child), i) == tnode) {
-            vec_erase(&(pi->child), i);
+            vec_erase_rcu(&(pi->child), i);
+            dcache_remove(tnode);
+            mutex_unlock(&vfs_lock);
             klogi("k_unlink: path %s", path);
             return 0;
         }
     }
+    mutex_unlock(&vfs_lock);
 
     cpu_set_errno(ENOENT);
     return -1;
@@ -401,13 +435,15 @@ int64_t k_seek(int64_t fh, int64_t offset, int64_t whence)
 {
     cpu_set_errno(0);
 
-    if (fh == STDIN || fh == STDOUT || fh == STDERR) {
-        klogd("k_seek: fh %d(0x%x), offset %d, whence %d\n",
-              fh, fh, offset, whence);
-        return 0;
+    vfs_handle_t h = get_handle(fh);
+    if (h == VFS_INVALID_HANDLE) {
+        cpu_set_errno(EBADF);
+        return -1;
     }
 
-    int64_t ret = vfs_seek(fh, offset, whence);
+    /* The terminal is not seekable */
+    int64_t ret = (h == ttyfh) ? 0 : vfs_seek(h, offset, whence);
+    vfs_close(h);
 
     klogd("k_seek: fh %d(0x%x), offset %d, whence %d and return %d\n",
           fh, fh, offset, whence, ret);
@@ -419,125 +455,62 @@ int64_t k_seek(int64_t fh, int64_t offset, int64_t whence)
 int64_t k_close(int64_t fh)
 {
     task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
     klogd("k_close: close file handle %d\n", fh);
 
-    if (fh == STDIN || fh == STDOUT || fh == STDERR) {
-        return 0;
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        return -1;
     }
 
-    if (t != NULL) {
-        lock_lock(&vfs_lock);
-        /* Check whether there is file redirection */
-        for (size_t i = 0; i < vec_length(&t->dup_list); i++) {
-            file_dup_t dup = vec_at(&t->dup_list, i); 
-            if (dup.newfh == fh) {
-                vec_erase(&t->dup_list, i);
-                break;
-            }   
-        }
-        lock_release(&vfs_lock);
-    }
- 
-    return vfs_close(fh);
+    return fd_close(&t->files->fdt, fh);
 }
 
 int64_t k_read(int64_t fh, void* buf, size_t count)
 {
-    task_t *t = sched_get_current_task();
     cpu_set_errno(0);
 
-    if (fh == STDIN) {
-        bool found = false;
-        vfs_handle_t oldfh = -1; 
-        if (t != NULL) {
-            lock_lock(&vfs_lock);
-            /* Check whether it is redirected from some file */
-            for (size_t i; i < vec_length(&t->dup_list); i++) {
-                file_dup_t dup = vec_at(&t->dup_list, i);
-                if (dup.newfh == fh) {
-                    oldfh = dup.fh;
-                    found = true;
-                    break;
-                } else if (dup.fh == fh) {
-                    oldfh = dup.newfh;
-                    found = true;
-                }
-            }
-            lock_release(&vfs_lock);
-        }
-        if (found) {
-            int64_t ret = vfs_read(oldfh, count, buf);
-            return ret;
-        } else if (ttyfh != VFS_INVALID_HANDLE) {
-            return vfs_read(ttyfh, count, buf);
-        }
-        cpu_set_errno(EINVAL);
-        return -1;
-    } else if (fh >= VFS_MIN_HANDLE) {
-        int64_t len = vfs_read(fh, count, buf);
-        return len;
-    } else {
+    vfs_handle_t h = get_handle(fh);
+    if (h == VFS_INVALID_HANDLE) {
         cpu_set_errno(EBADF);
         return -1;
     }
+
+    int64_t len = vfs_read(h, count, buf);
+    vfs_close(h);
+
+    return len;
 }
 
 int64_t k_write(int64_t fh, const void* buf, size_t count)
 {
-    task_t *t = sched_get_current_task();
     cpu_set_errno(0);
 
-    if (fh == STDOUT || fh == STDERR) {
-        bool found = false;
-        vfs_handle_t oldfh = -1; 
-        if (t != NULL) {
-            lock_lock(&vfs_lock);
-            /* Check whether it is redirected from some file */
-            for (size_t i; i < vec_length(&t->dup_list); i++) {
-                file_dup_t dup = vec_at(&t->dup_list, i); 
-                if (dup.newfh == fh) {
-                    oldfh = dup.fh;
-                    found = true;
-                    break;
-                } else if (dup.fh == fh) {
-                    oldfh = dup.newfh;
-                    found = true;
-                    break;
-                }
-            }
-            lock_release(&vfs_lock);
-        }   
-        if (found) {
-            klogd("k_write: write %d bytes to oldfh %d <- fh %d\n",
-                  count, oldfh, fh); 
-            int64_t ret = vfs_write(oldfh, count, buf);
-            return ret;
-        } else if (ttyfh != VFS_INVALID_HANDLE) {
-            if (debug_info) {
-                for (size_t i = 0; i < count; i++) {
-                    char c = ((char*)buf)[i];
-                    if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
-                        || (c >= 'A' && c <= 'Z') || c == '[')
-                    {
-                        klogd("k_write: write [%c]\n", c);
-                    } else {
-                        klogd("k_write: write [0x%2x]\n", c);
-                    }
-                }
+    vfs_handle_t h = get_handle(fh);
+    if (h == VFS_INVALID_HANDLE) {
+        kloge("k_write: invalid file handler fh=%d\n", fh);
+        cpu_set_errno(EBADF);
+        return -1;
+    }
+
+    if (debug_info && h == ttyfh) {
+        for (size_t i = 0; i < count; i++) {
+            char c = ((char*)buf)[i];
+            if ((c >= '0' && c <= '9') || (c >= 'a' && c <= 'z')
+                || (c >= 'A' && c <= 'Z') || c == '[')
+            {
+                klogd("k_write: write [%c]\n", c);
+            } else {
+                klogd("k_write: write [0x%2x]\n", c);
             }
-            return vfs_write(ttyfh, count, buf);
-        } else {
-            return 0;
         }
     }
 
-    if (fh < 3) {
-        kloge("k_write: invalid file handler fh=%d\n", fh);
-        cpu_set_errno(EPERM);
-        return -1;
-    }
+    int64_t len = vfs_write(h, count, buf);
+    vfs_close(h);
 
-    return vfs_write(fh, count, buf);
+    return len;
 }
 
 void k_set_fs_base(uint64_t val)
@@ -553,18 +526,21 @@ int64_t k_ioctl(int64_t fd, int64_t request, int64_t arg)
 {
     cpu_set_errno(0);
 
-    if (fd == STDIN || fd == STDOUT || fd == STDERR) {
-        if (ttyfh != VFS_INVALID_HANDLE) {
-            return vfs_ioctl(ttyfh, request, arg);
-        }   
+    vfs_handle_t h = get_handle(fd);
+    if (h == VFS_INVALID_HANDLE) {
+        cpu_set_errno(EBADF);
+        return -1;
     }
 
+    int64_t ret = vfs_ioctl(h, request, arg);
+    vfs_close(h);
+
     /* This can return error code for bash's error message: cannot set
      * terminal process group
      * TODO: Need to consider how to support this?
      */
-    cpu_set_errno(EINVAL);
-    return -1;
+    if (ret < 0) cpu_set_errno(EINVAL);
+    return ret;
 }
 
 int64_t k_fstatat(int64_t dirfh, const char *path, int64_t statbuf, int64_t flags)
@@ -579,6 +555,7 @@ int64_t k_fstatat(int64_t dirfh, const char *path, int64_t statbuf, int64_t flag
     vfs_tnode_t *node = vfs_path_to_node(full_path, NO_CREATE, 0);
 
     if (node != NULL) {
+        /* Removed tnodes are not freed, so the stat is read without lock */
         vfs_stat_t *st = (vfs_stat_t*)statbuf;
         memcpy(st, &(node->st), sizeof(vfs_stat_t));
         klogd("k_fstatat: success with dirfh 0x%x and path %s(%s), size %d\n",
@@ -595,29 +572,32 @@ int64_t k_fstatat(int64_t dirfh, const char *path, int64_t statbuf, int64_t flag
 
 int64_t k_fstat(int64_t handle, int64_t statbuf)
 {
-    if (handle == STDIN || handle == STDOUT || handle == STDERR) {
+    cpu_set_errno(0);
+
+    vfs_handle_t fd = get_handle(handle);
+
+    if (fd == ttyfh && fd != VFS_INVALID_HANDLE) {
         /*
          * Set the file stat buffer to zero. If we do nothing here, maybe it
          * will cause crash in some apps, e.g., cat in coreutils.
          */
+        vfs_close(fd);
         vfs_stat_t *st = (vfs_stat_t*)statbuf;
         memset(st, 0, sizeof(vfs_stat_t));
         klogd("k_fstat: success with file handle 0x%x\n", handle);
         return 0;
     }
- 
-    vfs_node_desc_t *fd = vfs_handle_to_fd(handle);
-    cpu_set_errno(0);
 
-    if (fd != NULL) {
+    if (fd != VFS_INVALID_HANDLE) {
         vfs_stat_t *st = (vfs_stat_t*)statbuf;
-        memcpy(st, &(fd->tnode->st), sizeof(vfs_stat_t));
+        memcpy(st, &fd->tnode->st, sizeof(vfs_stat_t));
+        vfs_close(fd);
         klogd("k_fstat: success with file handle 0x%x and size %d\n",
               handle, st->st_size);
         return 0;
     } else {
         kloge("k_fstat: fail with file handle 0x%x\n", handle);
-        cpu_set_errno(EINVAL);
+        cpu_set_errno(EBADF);
         return -1;
     }
 }
@@ -670,8 +650,8 @@ int64_t k_getpid()
     cpu_set_errno(0);
 
     if (t != NULL) {
-        klogd("k_getpid: task #%d\n", t->tid);
-        if (t->tid >= 1) return t->tid;
+        klogd("k_getpid: task #%d of process #%d\n", t->tid, t->pid);
+        if (t->pid >= 1) return t->pid;
     }
 
     cpu_set_errno(EINVAL);
@@ -715,7 +695,7 @@ int64_t k_chdir(char *dir)
     size_t k = 0;
     size_t len = strlen(dir);
 
-    strcpy(fullpath, t->cwd);
+    strcpy(fullpath, t->files->cwd);
 
     /* Note that "i" will loop to last character "\0" */
     for (size_t i = 0; i < len; i++) {
@@ -751,14 +731,14 @@ int64_t k_chdir(char *dir)
     }
 
     klogd("k_chdir: current \"%s\", target \"%s\" and change to \"%s\"",
-          t->cwd, dir, fullpath);
+          t->files->cwd, dir, fullpath);
 
     if (vfs_path_to_node(fullpath, NO_CREATE, 0) == NULL) {
         cpu_set_errno(ENOENT);
         goto err_exit;
     }
 
-    strcpy(t->cwd, fullpath);
+    strcpy(t->files->cwd, fullpath);
     return 0;
 err_exit:
     return -1; 
@@ -767,13 +747,13 @@ err_exit:
 int64_t k_readdir(int64_t handle, uint64_t buff)
 {
     dirent_t *de = (dirent_t*)buff;
-    vfs_node_desc_t *fd = vfs_handle_to_fd(handle);
+    vfs_handle_t fd = get_handle(handle);
     int64_t errno = 0;
 
     cpu_set_errno(errno);
 
-    if (fd == NULL) {
-        errno = EINVAL;
+    if (fd == VFS_INVALID_HANDLE) {
+        errno = EBADF;
         goto err_exit; 
     }
 
@@ -806,9 +786,11 @@ int64_t k_readdir(int64_t handle, uint64_t buff)
     de->d_off = 0;
     de->d_reclen = sizeof(dirent_t);
     de->d_type = DT_UNKNOWN;
- 
+
+    vfs_close(fd);
     return 0;
 err_exit:
+    if (fd != VFS_INVALID_HANDLE) vfs_close(fd);
     cpu_set_errno(errno);
     return -1; 
 }
@@ -853,8 +835,26 @@ int64_t k_pipe(int64_t *fh)
     vfs_create("/dev/pipe/1", VFS_NODE_CHAR_DEVICE);
 
     /* fh[0] is the reading port, fh[1] is the writing port */
-    fh[0] = vfs_open("/dev/pipe/1", VFS_MODE_READ);
-    fh[1] = vfs_open("/dev/pipe/1", VFS_MODE_WRITE);
+    vfs_handle_t rh = vfs_open("/dev/pipe/1", VFS_MODE_READ);
+    vfs_handle_t wh = vfs_open("/dev/pipe/1", VFS_MODE_WRITE);
+    if (rh == VFS_INVALID_HANDLE || wh == VFS_INVALID_HANDLE) {
+        if (rh != VFS_INVALID_HANDLE) vfs_close(rh);
+        if (wh != VFS_INVALID_HANDLE) vfs_close(wh);
+        cpu_set_errno(ENFILE);
+        goto err_exit;
+    }
+
+    fh[0] = fd_install(&t->files->fdt, rh, 0, 0);
+    if (fh[0] < 0) {
+        vfs_close(wh);
+        goto err_exit;
+    }
+    fh[1] = fd_install(&t->files->fdt, wh, 0, 0);
+    if (fh[1] < 0) {
+        fd_close(&t->files->fdt, fh[0]);
+        cpu_set_errno(EMFILE);
+        goto err_exit;
+    }
 
     klogd("k_pipe: return reading port %d and writing port %d\n", fh[0], fh[1]);
 
@@ -889,16 +889,224 @@ int64_t k_fork()
     if (tid_child == TID_MAX) {
         cpu_set_errno(ECHILD);
         return -1;
-    } else if (t->tid == sched_get_tid()) {
-        /*
-         * This should be parent process and returns child task id, but
-         * currently it returns parent task id
-         */
-        return tid_child;
-    } else {
-        /* This should be child process and returns 0 */
+    }
+
+    /* Child returns 0 from a copy of the syscall frame, see task_fork() */
+    return tid_child;
+err_exit:
+    return -1;
+}
+
+/*
+ * Create a thread which shares address space, open files and current
+ * directory with the caller. It starts from "entry" with "arg0" and "arg1" as
+ * the first two parameters, and "stack" (if not zero) as the stack top.
+ */
+int64_t k_clone(uint64_t entry, uint64_t arg0, uint64_t arg1, uint64_t stack)
+{
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (t->tid < 1) {
+        cpu_set_errno(ESRCH);
+        goto err_exit;
+    }
+
+    if (entry == 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    /* The stack must be a canonical user address mapped by the caller */
+    if (stack != 0 && (t->addrspace == NULL
+        || !task_user_stack_valid(t->addrspace, stack & ~0xFULL)))
+    {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    lock_lock(&sched_lock);
+    task_t *tc = task_clone(t, entry, arg0, arg1, stack);
+    lock_release(&sched_lock);
+
+    if (tc == NULL) {
+        cpu_set_errno(EAGAIN);
+        goto err_exit;
+    }
+
+    klogd("k_clone: task #%d creates thread #%d\n", t->tid, tc->tid);
+
+    sched_add(tc);
+
+    return tc->tid;
+
+err_exit:
+    return -1;
+}
+
+/*
+ * Create a child which runs on the address space and user stack of the caller
+ * until it calls execve or exits, and the caller is blocked until then. The
+ * child returns 0 to user mode from a copy of the syscall frame of caller.
+ */
+int64_t k_vfork()
+{
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (t->tid < 1) {
+        cpu_set_errno(ESRCH);
+        goto err_exit;
+    }
+
+    task_id_t tid = sched_vfork();
+    if (tid == TID_MAX) {
+        cpu_set_errno(EAGAIN);
+        goto err_exit;
+    }
+
+    klogd("k_vfork: task #%d resumes after vfork child #%d\n", t->tid, tid);
+
+    return tid;
+
+err_exit:
+    return -1;
+}
+
+/*
+ * Create a child from an executable directly, with file "actions" applied
+ * in order before it runs. Return tid of the child.
+ */
+int64_t k_spawn(const char *path, const char *argv[], const char *envp[],
+                const spawn_action_t *actions, int64_t num)
+{
+    char *cwd = NULL;
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (path == NULL || num < 0 || num > SPAWN_ACTION_MAX
+        || (num > 0 && actions == NULL))
+    {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    for (int64_t i = 0; i < num; i++) {
+        if (actions[i].type != SPAWN_ACTION_DUP
+            && actions[i].type != SPAWN_ACTION_CLOSE)
+        {
+            cpu_set_errno(EINVAL);
+            goto err_exit;
+        }
+    }
+
+    cwd = t->files->cwd;
+
+    task_t *tc = sched_spawn(path, argv, envp, cwd, actions, num);
+    if (tc == NULL) {
+        cpu_set_errno(ENOENT);
+        goto err_exit;
+    }
+
+    klogd("k_spawn: task #%d spawns #%d from \"%s\"\n", t->tid, tc->tid, path);
+
+    return tc->tid;
+
+err_exit:
+    return -1;
+}
+
+/*
+ * Copy scheduler statistics of a CPU or task ("which" is SCHEDSTAT_CPU or
+ * SCHEDSTAT_TASK) into "buf". The first CPU or task whose id is not less than
+ * "id" is returned, so all of them can be walked by increasing "id".
+ */
+int64_t k_schedstat(int64_t which, int64_t id, void *buf)
+{
+    cpu_set_errno(0);
+
+    if (buf == NULL || id < 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    if (which == SCHEDSTAT_CPU) {
+        sched_stat_t st;
+        if (id >= CPU_MAX) {
+            cpu_set_errno(ESRCH);
+            goto err_exit;
+        }
+        uint16_t cpu_id = sched_get_cpu_stat(id, &st);
+        if (cpu_id == CPU_MAX) {
+            cpu_set_errno(ESRCH);
+            goto err_exit;
+        }
+        memcpy(buf, &st, sizeof(st));
+        return cpu_id;
+    } else if (which == SCHEDSTAT_TASK) {
+        task_stat_t st;
+        task_id_t tid = sched_get_task_stat(id, &st);
+        if (tid == TID_NONE) {
+            cpu_set_errno(ESRCH);
+            goto err_exit;
+        }
+        memcpy(buf, &st, sizeof(st));
+        return tid;
+    }
+
+    cpu_set_errno(EINVAL);
+
+err_exit:
+    return -1;
+}
+
+/*
+ * Copy lock statistics of the first acquisition site whose index is not less
+ * than "id" into "buf", and return its index. Statistics are cleared if
+ * "buf" is NULL. Only available if ENABLE_LOCKSTAT is defined.
+ */
+int64_t k_lockstat(int64_t id, void *buf)
+{
+    cpu_set_errno(0);
+
+#ifdef ENABLE_LOCKSTAT
+    if (buf == NULL) {
+        lockstat_reset();
         return 0;
     }
+
+    lockstat_t st;
+    id = lockstat_get(id, &st);
+    if (id < 0) {
+        cpu_set_errno(ESRCH);
+        goto err_exit;
+    }
+
+    memcpy(buf, &st, sizeof(st));
+    return id;
+#else
+    (void)id;
+    (void)buf;
+
+    cpu_set_errno(ENOSYS);
+    goto err_exit;
+#endif
+
 err_exit:
     return -1;
 }
@@ -911,54 +1119,77 @@ int64_t k_getppid()
 
 int64_t k_fcntl(int64_t fd, int64_t request, int64_t arg)
 {
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
     klogd("k_fcntl: fd 0x%x, request 0x%x, arg 0x%x\n", fd, request, arg);
-    cpu_set_errno(ENOSYS);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    fdtable_t *fdt = &t->files->fdt;
+    vfs_handle_t h = VFS_INVALID_HANDLE;
+
+    switch (request) {
+    case F_DUPFD:
+    case F_DUPFD_CLOEXEC:
+        if (arg < 0 || arg >= FDTABLE_MAX) {
+            cpu_set_errno(EINVAL);
+            goto err_exit;
+        }
+        h = fd_get(fdt, fd);
+        if (h == VFS_INVALID_HANDLE) {
+            cpu_set_errno(EBADF);
+            goto err_exit;
+        }
+        return fd_install(fdt, h, arg,
+                          (request == F_DUPFD_CLOEXEC) ? FD_CLOEXEC : 0);
+    case F_GETFD:
+        return fd_get_flags(fdt, fd);
+    case F_SETFD:
+        return fd_set_flags(fdt, fd, arg & FD_CLOEXEC);
+    default:
+        cpu_set_errno(ENOSYS);
+        break;
+    }
+
+err_exit:
     return -1; 
 }
 
 int64_t k_waitpid(int64_t pid, int64_t *status, int64_t flags)
 {
     task_t *t = sched_get_current_task();
-    if ((int32_t)pid == (int32_t)(-1) && t != NULL) {
-        klogv("k_waitpid: tid %d waits pid 0x%x status 0x%x flags 0x%x\n",
-              t->tid, pid, status, flags);
+    int64_t code = 0;
 
-        cpu_set_errno(0);
+    if ((int32_t)pid == (int32_t)(-1)) pid = -1;
 
-        bool all_dead = true;
-        size_t len = vec_length(&(t->child_list));
-
-        for (size_t i = 0; i < len; i++) {
-            task_id_t tid_child = vec_at(&(t->child_list), i);
-            task_status_t status_child = sched_get_task_status(tid_child);
-            if (status_child == TASK_DEAD) {
-                klogw("     tid %d : child tid %d DEAD\n", t->tid, tid_child);
-                if (status != NULL) {
-                    *status = (int64_t)NULL;
-                    return tid_child;
-                }
-            } else if (status_child != TASK_UNKNOWN) {
-                all_dead = false;
-                klogv("     tid %d : child tid %d ACTIVE\n", t->tid, tid_child);
-            }
-        }
-  
-        if (!all_dead) {
-            sched_sleep(200);
-            klogv("k_waitpid: tid %d waiting pid 0x%x returns with "
-                  "active children\n", t->tid, pid);
-            return 0;
-        } else {
-            klogd("k_waitpid: tid %d waiting pid 0x%x returns without "
-                  "children\n", t->tid, pid);
-            cpu_set_errno(ECHILD);
-            return -1;
-        }
-    } else {
+    if (t == NULL || (pid <= 0 && pid != -1)) {
         klogd("k_waitpid: waiting pid 0x%x with invalid parameters\n", pid);
         cpu_set_errno(ECHILD);
         return -1;
     }
+
+    klogv("k_waitpid: tid %d waits pid 0x%x status 0x%x flags 0x%x\n",
+          t->tid, pid, status, flags);
+
+    /* Block on the wait queue of current task until a child exits */
+    int64_t tid = sched_waitpid(pid, &code, (flags & WNOHANG) != 0);
+    if (tid < 0) {
+        klogd("k_waitpid: tid %d waiting pid 0x%x returns without "
+              "children\n", t->tid, pid);
+        cpu_set_errno(ECHILD);
+        return -1;
+    }
+
+    if (tid > 0 && status != NULL) {
+        *status = 0x200 | (code & 0xFF);   /* Exited normally */
+    }
+
+    cpu_set_errno(0);
+    return tid;
 }
 
 void k_exit(int64_t status)
@@ -990,9 +1221,9 @@ int k_getcwd(char *buffer, size_t size)
         goto err_exit;
     }
 
-    size_t len = strlen(t->cwd);
+    size_t len = strlen(t->files->cwd);
     if (len < size - 1) {
-        strcpy(buffer, t->cwd);
+        strcpy(buffer, t->files->cwd);
     } else {
         cpu_set_errno(ENAMETOOLONG);
         goto err_exit;
@@ -1017,9 +1248,9 @@ int64_t k_execve(const char *path, const char *argv[], const char *envp[])
 {
     char *cwd = NULL;
     task_t *t = sched_get_current_task();
-    if (t != NULL) cwd = t->cwd;
+    if (t != NULL) cwd = t->files->cwd;
 
-    if (sched_execve(path, argv, envp, cwd) != NULL) {
+    if (sched_execve(path, argv, envp, cwd, true) != NULL) {
         sched_exit(0);
         cpu_set_errno(0);
         return 0;
@@ -1035,8 +1266,8 @@ int k_getclock(void *_, int64_t which, vfs_timespec_t *out) {
     int64_t ret = -1; 
     cpu_set_errno(0);
 
-    uint64_t now_sec = hpet_get_nanos() / 1000000000;
-    uint64_t now_ns = hpet_get_nanos();
+    uint64_t now_ns = ktime_get_ns();
+    uint64_t now_sec = now_ns / 1000000000;
 
     time_t boot_time = cmos_boot_time();
 
@@ -1097,6 +1328,10 @@ void k_uname(void)
 {
 }
 
+/*
+ * Make "newfh" refer to the open file of "fh", closing what "newfh" referred
+ * to before. Only O_CLOEXEC is allowed in "flags". Return "newfh".
+ */
 int64_t k_dup3(int64_t fh, int64_t newfh, int64_t flags)
 {
     task_t *t = sched_get_current_task();
@@ -1107,31 +1342,225 @@ int64_t k_dup3(int64_t fh, int64_t newfh, int64_t flags)
         return -1;
     }
 
-    klogd("k_dup3: tid %d fh %d <- newfh %d, flags 0x%x\n",
+    klogd("k_dup3: tid %d fh %d -> newfh %d, flags 0x%x\n",
           t->tid, fh, newfh, flags);
 
-    lock_lock(&vfs_lock);
-    file_dup_t dup = {.fh = fh, .newfh = newfh};
-    vec_push_back(&t->dup_list, dup);
-    lock_release(&vfs_lock);
+    if (fh == newfh || (flags & ~O_CLOEXEC) != 0) {
+        cpu_set_errno(EINVAL);
+        return -1;
+    }
+
+    return fd_dup(&t->files->fdt, fh, newfh,
+                  (flags & O_CLOEXEC) ? FD_CLOEXEC : 0);
+}
+
+int64_t k_sched_setaffinity(int64_t tid, size_t size, const uint64_t *mask)
+{
+    task_t *t = sched_get_current_task();
+    cpumask_t cpumask = {0};
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (mask == NULL || size == 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    if (tid == 0) tid = t->tid;
+
+    memcpy(&cpumask, mask, MIN(size, sizeof(cpumask_t)));
+    /* Errno is ESRCH or EINVAL */
+    if (sched_set_affinity(tid, &cpumask) < 0) goto err_exit;
+
+    /* Leave current CPU at once if it is not allowed any more */
+    if (tid == (int64_t)t->tid && !cpumask_test(&cpumask, t->last_cpu)) {
+        sched_yield();
+    }
 
     return 0;
+
+err_exit:
+    return -1;
 }
 
-/* TODO: need to add futex implementation */
-int64_t k_futex_wait(int64_t *ptr, vfs_timespec_t *tv, int64_t expected)
+/*
+ * Set scheduling policy of a task ("tid" is 0 for the caller). Real-time
+ * policies need a priority from SCHED_RT_PRIO_MIN to SCHED_RT_PRIO_MAX, and
+ * SCHED_OTHER needs 0.
+ */
+int64_t k_sched_setscheduler(int64_t tid, int64_t policy, int64_t priority)
 {
-    klogi("k_futex_wait: time spec (%d, %d) with ptr 0x%x, val %d and "
-          "expected %d\n", tv->tv_sec, tv->tv_nsec, ptr, *ptr, expected);
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (policy == SCHED_OTHER) {
+        if (priority != 0) {
+            cpu_set_errno(EINVAL);
+            goto err_exit;
+        }
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (priority < SCHED_RT_PRIO_MIN || priority > SCHED_RT_PRIO_MAX) {
+            cpu_set_errno(EINVAL);
+            goto err_exit;
+        }
+    } else {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    if (tid == 0) tid = t->tid;
+
+    if (!sched_set_policy(tid, policy, priority)) {
+        cpu_set_errno(ESRCH);
+        goto err_exit;
+    }
 
     return 0;
+
+err_exit:
+    return -1;
+}
+
+/* Return the size of mask in bytes */
+int64_t k_sched_getaffinity(int64_t tid, size_t size, uint64_t *mask)
+{
+    task_t *t = sched_get_current_task();
+    cpumask_t cpumask = {0};
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (mask == NULL || size == 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    if (tid == 0) tid = t->tid;
+
+    if (!sched_get_affinity(tid, &cpumask)) {
+        cpu_set_errno(ESRCH);
+        goto err_exit;
+    }
+
+    size = MIN(size, sizeof(cpumask_t));
+    memcpy(mask, &cpumask, size);
+
+    return size;
+
+err_exit:
+    return -1;
+}
+
+int64_t k_futex_wait(int64_t *ptr, vfs_timespec_t *tv, int64_t expected)
+{
+    task_t *t = sched_get_current_task();
+    uint64_t timeout = 0;
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (ptr == NULL || ((uint64_t)ptr & 0x7) != 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    /* The value is read in kernel, so it must be mapped user memory */
+    if (t->addrspace == NULL
+        || !task_user_range_valid(t->addrspace, (uint64_t)ptr,
+                                  sizeof(int64_t), VMM_FLAGS_USERMODE_RO))
+    {
+        cpu_set_errno(EFAULT);
+        goto err_exit;
+    }
+
+    /* Timeout is relative and a NULL time spec means waiting forever */
+    if (tv != NULL) {
+        if (tv->tv_sec < 0 || tv->tv_nsec < 0 || tv->tv_nsec >= 1000000000) {
+            cpu_set_errno(EINVAL);
+            goto err_exit;
+        }
+        timeout = tv->tv_sec * 1000000000ULL + tv->tv_nsec;
+        if (timeout == 0) timeout = 1;
+    }
+
+    if (debug_info) {
+        klogd("k_futex_wait: task #%d waits on ptr 0x%x with val %d, "
+              "expected %d and timeout %d ns\n",
+              t->tid, ptr, *ptr, expected, timeout);
+    }
+
+    return futex_wait(t, ptr, expected, timeout);
+
+err_exit:
+    return -1;
 }
 
-int64_t k_futex_wake(int64_t *ptr)
+/* Wake at most "num" tasks, or all tasks if "num" is not positive */
+int64_t k_futex_wake(int64_t *ptr, int64_t num)
 {
-    klogi("k_futex_wake: ptr 0x%x and val %d\n", ptr, *ptr);
+    task_t *t = sched_get_current_task();
+    cpu_set_errno(0);
+
+    if (t == NULL) {
+        cpu_set_errno(ENODEV);
+        goto err_exit;
+    }
+
+    if (ptr == NULL || ((uint64_t)ptr & 0x7) != 0) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    return futex_wake(t, ptr, (num > 0) ? num : FUTEX_WAKE_ALL);
+
+err_exit:
+    return -1;
+}
+
+/*
+ * Sleep for the relative time in "req". The sleep is ended by a timer, so
+ * it is never interrupted and "rem" is always zero.
+ */
+int64_t k_nanosleep(const vfs_timespec_t *req, vfs_timespec_t *rem)
+{
+    cpu_set_errno(0);
+
+    if (req == NULL || req->tv_sec < 0 || req->tv_nsec < 0
+        || req->tv_nsec >= 1000000000) {
+        cpu_set_errno(EINVAL);
+        goto err_exit;
+    }
+
+    uint64_t deadline = ktime_get_ns()
+                        + req->tv_sec * 1000000000ULL + req->tv_nsec;
+    while (ktime_get_ns() < deadline) {
+        sched_sleep_until(deadline);
+    }
+
+    if (rem != NULL) {
+        rem->tv_sec = 0;
+        rem->tv_nsec = 0;
+    }
 
     return 0;
+
+err_exit:
+    return -1;
 }
 
 syscall_ptr_t syscall_funcs[] = {
@@ -1172,9 +1601,15 @@ syscall_ptr_t syscall_funcs[] = {
     [SYSCALL_MEMINFO]       = (syscall_ptr_t)k_meminfo,         /* 34 */
     [SYSCALL_PIPE]          = (syscall_ptr_t)k_pipe,
     [SYSCALL_UNLINK]        = (syscall_ptr_t)k_unlink,
-    (syscall_ptr_t)k_not_implemented,
-    (syscall_ptr_t)k_not_implemented,
-    (syscall_ptr_t)k_not_implemented,
+    [SYSCALL_CLONE]         = (syscall_ptr_t)k_clone,
+    [SYSCALL_SETAFFINITY]   = (syscall_ptr_t)k_sched_setaffinity,   /* 38 */
+    [SYSCALL_GETAFFINITY]   = (syscall_ptr_t)k_sched_getaffinity,
+    [SYSCALL_SPAWN]         = (syscall_ptr_t)k_spawn,           /* 40 */
+    [SYSCALL_VFORK]         = (syscall_ptr_t)k_vfork,
+    [SYSCALL_SCHEDSTAT]     = (syscall_ptr_t)k_schedstat,
+    [SYSCALL_SETSCHED]      = (syscall_ptr_t)k_sched_setscheduler,
+    [SYSCALL_LOCKSTAT]      = (syscall_ptr_t)k_lockstat,
+    [SYSCALL_NANOSLEEP]     = (syscall_ptr_t)k_nanosleep,
     (syscall_ptr_t)k_not_implemented,
     (syscall_ptr_t)k_not_implemented
 };
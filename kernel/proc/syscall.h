@@ -37,6 +37,15 @@
 #define SYSCALL_MEMINFO     34
 #define SYSCALL_PIPE        35
 #define SYSCALL_UNLINK      36
+#define SYSCALL_CLONE       37
+#define SYSCALL_SETAFFINITY 38
+#define SYSCALL_GETAFFINITY 39
+#define SYSCALL_SPAWN       40
+#define SYSCALL_VFORK       41
+#define SYSCALL_SCHEDSTAT   42
+#define SYSCALL_SETSCHED    43
+#define SYSCALL_LOCKSTAT    44
+#define SYSCALL_NANOSLEEP   45
 
 /* Standard I/O devices */
 #define STDIN               0
@@ -72,6 +81,12 @@
 #define O_CLOEXEC           0x4000
 #define O_PATH              0x8000
 
+/* Commands of fcntl */
+#define F_DUPFD             0
+#define F_GETFD             1
+#define F_SETFD             2
+#define F_DUPFD_CLOEXEC     1030
+
 /* EFLAGS bits */
 #define X86_EFLAGS_CF   0x00000001 /* Carry Flag */
 #define X86_EFLAGS_PF   0x00000004 /* Parity Flag */
@@ -1,38 +1,54 @@
 %include "sys/cpu_macros.mac"
 
+; Offsets in cpu_t (see sys/smp.h)
+%define CPU_ERRNO       0x0
+%define CPU_USER_RSP    0x8
+%define CPU_KERNEL_RSP  0x10
+
 global syscall_handler
-extern k_print_log
 
+;
+; GS base points to the per-CPU structure only in kernel mode, so the entry
+; swaps it in and the exit swaps the user one back. Interrupt entries do the
+; same with swapgs_if_user. Interrupts are masked by SFMASK until the swap.
+;
 syscall_handler:
-    push r15                ; store r15 in user stack
-    mov r15, rsp            ; save process stack to r15
+    swapgs
 
-    ; push information (gs, cs, rip, rflags, rip)
-    ; but the below data are not used in current implementation
-    push qword 0x3b         ; user data segment
-    push r15                ; saved stack
-    push r11                ; saved rflags
-    push qword 0x43         ; user code segment 
-    push rcx                ; current RIP
+    mov [gs:CPU_USER_RSP], rsp      ; save process stack
+    mov rsp, [gs:CPU_KERNEL_RSP]    ; switch to kernel stack of current task
+
+    ; push the frame as an interrupt from user mode does (see task_regs_t)
+    push qword 0x3b                 ; user data segment
+    push qword [gs:CPU_USER_RSP]    ; saved stack
+    push r11                        ; saved rflags
+    push qword 0x43                 ; user code segment
+    push rcx                        ; current RIP
 
     ; push all registers
     push_all
 
+    ; Frame is saved on the stack of this task, it can be switched out now
+    sti
+
     mov rcx, r10
 
     extern syscall_funcs
     call [rax * 8 + syscall_funcs]
 
+    cli
+
     ; pop all registers except rax which is used for storing return value
     pop_all_syscall
+    add rsp, 8                      ; skip rax
 
-    swapgs
+    mov rdx, qword [gs:CPU_ERRNO]   ; return errno in rdx
 
-    mov rdx, qword [gs:0x0]  ; return errno in rdx
-    mov rsp, r15             ; back to user stack
-    pop r15                  ; pop r15 from user stack
+    pop rcx                         ; RIP
+    add rsp, 8                      ; skip code segment
+    pop r11                         ; rflags
+    pop rsp                         ; back to user stack
 
     swapgs
 
     o64 sysret
-
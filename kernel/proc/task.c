@@ -20,19 +20,59 @@
 
 #include <proc/task.h>
 #include <proc/sched.h>
+#include <proc/tid.h>
 #include <base/kmalloc.h>
 #include <base/klog.h>
 #include <sys/cpu.h>
 #include <sys/hpet.h>
 #include <sys/apic.h>
+#include <sys/fpu.h>
+#include <sys/vdso.h>
 
-static task_id_t curr_tid = 1;
+
+static task_files_t *create_files(task_files_t *src)
+{
+    task_files_t *files = kmalloc(sizeof(task_files_t));
+    if (files == NULL) return NULL;
+
+    memset(files, 0, sizeof(task_files_t));
+    files->refcount = 1;
+    files->lock = lock_new();
+    fdtable_init(&files->fdt);
+
+    if (src != NULL) {
+        fdtable_copy(&files->fdt, &src->fdt, false);
+        strcpy(files->cwd, src->cwd);
+    } else {
+        strcpy(files->cwd, "/");
+    }
+
+    return files;
+}
+
+/* Drop the reference to open files, and close them if it is the last one */
+void task_put_files(task_t *t)
+{
+    task_files_t *files = t->files;
+    if (files == NULL) return;
+
+    t->files = NULL;
+
+    lock_lock(&files->lock);
+    bool files_shared = (--files->refcount > 0);
+    lock_release(&files->lock);
+    if (!files_shared) {
+        fdtable_close_all(&files->fdt);
+        kmfree(files);
+    }
+}
 
 task_t *task_make(
     const char *name, void (*entry)(task_id_t), task_priority_t priority,
     task_mode_t mode, addrspace_t *pas)
 {
-    if (curr_tid == TID_MAX) {
+    task_id_t tid = tid_alloc();
+    if (tid == TID_NONE) {
         klogw("Could not allocate tid\n");
         return NULL;
     }
@@ -40,7 +80,8 @@ task_t *task_make(
     task_t *ntask = kmalloc(sizeof(task_t));
     memset(ntask, 0, sizeof(task_t));
 
-    ntask->tid = curr_tid;
+    ntask->tid = tid;
+    ntask->pid = tid;
 
     task_regs_t *ntask_regs = NULL;
     addrspace_t *as = create_addrspace();
@@ -76,7 +117,7 @@ task_t *task_make(
         m.np = NUM_PAGES(STACK_SIZE);
         m.flags = VMM_FLAGS_DEFAULT | VMM_FLAGS_USERMODE; 
 
-        vec_push_back(&ntask->mmap_list, m);
+        vec_push_back(&as->mmap_list, m);
 
         ntask_regs = ntask->ustack_top - sizeof(task_regs_t);
 
@@ -107,23 +148,22 @@ task_t *task_make(
     ntask_regs->rsp = (uint64_t)ntask->tstack_top;
     ntask_regs->rflags = DEFAULT_RFLAGS;
     ntask_regs->rip = (uint64_t)entry;
-    ntask_regs->rdi = curr_tid;
+    ntask_regs->rdi = tid;
 
     ntask->mode = mode;
     ntask->tstack_top = ntask_regs;
     ntask->ptid = TID_MAX;
     ntask->priority = priority;
     ntask->last_tick = 0;
+    cpumask_setall(&ntask->cpumask);
     ntask->status = TASK_READY;
+    ntask->files = create_files(NULL);
 
-    strcpy(ntask->cwd, "/");
     strncpy(ntask->name, name, sizeof(ntask->name));
 
     klogi("TASK: Create tid %d with name \"%s\" (task 0x%x)\n",
           ntask->tid, name, ntask);
 
-    curr_tid++;
-
     if (mode == TASK_USER_MODE) {
         vmm_unmap(pas, (uint64_t)ntask->ustack_limit, NUM_PAGES(STACK_SIZE));
     }
@@ -138,6 +178,8 @@ task_t *task_make(
             VMM_FLAGS_MMIO);
 #endif
 
+    if (mode == TASK_USER_MODE) vdso_map(ntask->addrspace, ntask->tid);
+
     return ntask;
 }
 
@@ -174,64 +216,71 @@ task_t *task_fork(task_t *tp)
 {
     task_debug(tp, false);
 
+    task_id_t tid = tid_alloc();
+    if (tid == TID_NONE) return NULL;
+
     task_t *tc = (task_t*)kmalloc(sizeof(task_t));
     if (tc == NULL) goto norm_exit;
 
     memcpy(tc, tp, sizeof(task_t));
-    memset(&tc->mmap_list, 0, sizeof(tc->mmap_list));
     memset(&tc->child_list, 0, sizeof(tc->child_list));
+    memset(&tc->wait_child, 0, sizeof(tc->wait_child));
+    tc->exit_code = 0;
+    tc->vfork_ptid = TID_NONE;
+    tc->vfork_ctid = TID_NONE;
+    tc->run_start = 0;
+    tc->runtime = 0;
+    tc->nr_switches = 0;
+    tc->wakeup_time = 0;
+    tc->sleep_timer = hrtimer_new(NULL);
 
     tc->addrspace = create_addrspace();
+    fpu_copy(tc, tp);
+    tc->files = create_files(tp->files);
 
-    size_t len = vec_length(&(tp->mmap_list));
+    size_t len = vec_length(&(tp->addrspace->mmap_list));
     klogi("task_fork: totally %d memory blocks (parent #%d, child #%d)\n",
-          len, tp->tid, curr_tid);
+          len, tp->tid, tid);
     for (size_t i = 0; i < len; i++) {
-        mem_map_t m = vec_at(&(tp->mmap_list), i);
+        mem_map_t m = vec_at(&(tp->addrspace->mmap_list), i);
         uint64_t ptr = VIRT_TO_PHYS(kmalloc(m.np * PAGE_SIZE));
         memcpy((void*)PHYS_TO_VIRT(ptr), (void*)PHYS_TO_VIRT(m.paddr),
                m.np * PAGE_SIZE);
         if ((uint64_t)tp->ustack_limit == (uint64_t)m.vaddr) {
             klogi("task_fork: #%d (parent #%d) new user stack 0x%x and "
                   "map to 0x%x with top 0x%x\n",
-                  curr_tid, tp->tid, ptr, m.vaddr, m.vaddr + STACK_SIZE);
+                  tid, tp->tid, ptr, m.vaddr, m.vaddr + STACK_SIZE);
         }
         if ((uint64_t)tp->kstack_limit == (uint64_t)m.vaddr) {
             klogi("task_fork: #%d (parent #%d) new kern stack 0x%x and "
                   "map to 0x%x with top 0x%x\n",
-                  curr_tid, tp->tid, ptr, m.vaddr, m.vaddr + STACK_SIZE);
+                  tid, tp->tid, ptr, m.vaddr, m.vaddr + STACK_SIZE);
         }
         vmm_map(tc->addrspace, m.vaddr, ptr, m.np, m.flags);
 
         m.paddr = ptr;
-        vec_push_back(&tc->mmap_list, m);
+        vec_push_back(&tc->addrspace->mmap_list, m);
     }
 
-    tc->tid = curr_tid;
+    tc->tid = tid;
     tc->ptid = tp->tid;
+    tc->pid = tid;
 
     tc->kstack_limit = kmalloc(STACK_SIZE);
-    memcpy(tc->kstack_limit, tp->kstack_limit, STACK_SIZE);
+    tc->kstack_top = tc->kstack_limit + STACK_SIZE;
 
-    uint64_t offset = 0;
-
-    offset = (uint64_t)tc->kstack_top - (uint64_t)tp->kstack_limit;
-    tc->kstack_top = (void*)((uint64_t)tc->kstack_limit + offset);
-
-    if ((uint64_t)tc->tstack_top >= (uint64_t)tp->kstack_limit
-        && (uint64_t)tc->tstack_top <= (uint64_t)(tp->kstack_limit + STACK_SIZE))
-    {
-        offset = (uint64_t)tc->tstack_top - (uint64_t)tp->kstack_limit;
-        tc->tstack_top = (void*)((uint64_t)tc->kstack_limit + offset);
- 
-        task_regs_t *tr = (task_regs_t*)tc->tstack_top;
-
-        offset = (uint64_t)tr->rsp - (uint64_t)tp->kstack_limit;
-        tr->rsp = (uint64_t)tc->kstack_limit + offset;
+    /*
+     * Kernel frames of parent hold addresses in its own kernel stack, so the
+     * child does not return through them. It returns 0 to user mode from a
+     * copy of the registers saved at syscall entry.
+     */
+    task_regs_t *tc_regs = task_syscall_regs(tc);
+    memcpy(tc_regs, task_syscall_regs(tp), sizeof(task_regs_t));
+    tc_regs->rax = 0;
+    tc_regs->rdx = 0;
 
-        offset = (uint64_t)tr->rbp - (uint64_t)tp->kstack_limit;
-        tr->rbp = (uint64_t)tc->kstack_limit + offset;
-    }
+    tc->tstack_top = tc_regs;
+    tc->tstack_limit = tc->kstack_limit;
 
     task_debug(tc, false);
 
@@ -249,26 +298,262 @@ task_t *task_fork(task_t *tp)
             1, VMM_FLAGS_MMIO);
 #endif
 
+    vdso_map(tc->addrspace, tc->tid);
+
     klogd("TASK: child tid %d and parent tid %d\n", tc->tid, tp->tid);
     vec_push_back(&tp->child_list, tc->tid);
 
-    curr_tid++;
-
 norm_exit:
     return tc;
 }
 
+/*
+ * Check that "len" bytes at user address "addr" are inside one block of "as"
+ * which is mapped with all of "flags"
+ */
+bool task_user_range_valid(addrspace_t *as, uint64_t addr, size_t len,
+                           uint64_t flags)
+{
+    bool valid = false;
+
+    if (len == 0 || addr + len < addr || addr + len > MEM_USER_LIMIT) {
+        return false;
+    }
+
+    lock_lock(&as->lock);
+    for (size_t i = 0; i < vec_length(&as->mmap_list); i++) {
+        mem_map_t m = vec_at(&as->mmap_list, i);
+        if ((m.flags & flags) == flags && addr >= m.vaddr
+            && addr + len <= m.vaddr + m.np * PAGE_SIZE)
+        {
+            valid = true;
+            break;
+        }
+    }
+    lock_release(&as->lock);
+
+    return valid;
+}
+
+/* Check that "stack" is the top of a writable user block of "as" */
+bool task_user_stack_valid(addrspace_t *as, uint64_t stack)
+{
+    if (stack < sizeof(uint64_t)) return false;
+
+    return task_user_range_valid(as, stack - sizeof(uint64_t),
+                                 sizeof(uint64_t), VMM_FLAGS_USERMODE);
+}
+
+/*
+ * Create a thread of task "tp". The thread shares address space, open-file
+ * table and current directory with "tp", and has its own stacks and fs_base.
+ * It starts from "entry" with the first two parameters "arg0" and "arg1". If
+ * "stack" is zero, a new user stack will be allocated, otherwise it must be
+ * checked by task_user_stack_valid().
+ */
+task_t *task_clone(task_t *tp, uint64_t entry, uint64_t arg0, uint64_t arg1,
+                   uint64_t stack)
+{
+    if (tp->mode != TASK_USER_MODE || tp->addrspace == NULL) {
+        return NULL;
+    }
+
+    task_id_t tid = tid_alloc();
+    if (tid == TID_NONE) {
+        klogw("Could not allocate tid\n");
+        return NULL;
+    }
+
+    task_t *tc = kmalloc(sizeof(task_t));
+    memset(tc, 0, sizeof(task_t));
+
+    tc->tid = tid;
+    tc->pid = tp->pid;
+
+    tc->kstack_limit = kmalloc(STACK_SIZE);
+    tc->kstack_top = tc->kstack_limit + STACK_SIZE;
+
+    if (stack == 0) {
+        tc->ustack_limit = (void*)VIRT_TO_PHYS(kmalloc(STACK_SIZE));
+        tc->ustack_top = tc->ustack_limit + STACK_SIZE;
+
+        vmm_map(tp->addrspace, (uint64_t)tc->ustack_limit,
+                (uint64_t)tc->ustack_limit, NUM_PAGES(STACK_SIZE),
+                VMM_FLAGS_DEFAULT | VMM_FLAGS_USERMODE);
+
+        mem_map_t m;
+
+        m.vaddr = (uint64_t)tc->ustack_limit;
+        m.paddr = (uint64_t)tc->ustack_limit;
+        m.np = NUM_PAGES(STACK_SIZE);
+        m.flags = VMM_FLAGS_DEFAULT | VMM_FLAGS_USERMODE;
+
+        lock_lock(&tp->addrspace->lock);
+        vec_push_back(&tp->addrspace->mmap_list, m);
+        lock_release(&tp->addrspace->lock);
+
+        stack = (uint64_t)tc->ustack_top;
+    }
+
+    /* Align stack as if the entry is called */
+    stack = (stack & ~0xFULL) - sizeof(uint64_t);
+
+    /*
+     * The initial registers are kept on the kernel stack of the thread, as
+     * the user stack can be written by other threads before the first switch.
+     */
+    task_regs_t *tc_regs = task_syscall_regs(tc);
+    memset(tc_regs, 0, sizeof(task_regs_t));
+
+    tc_regs->cs = DEFAULT_UMODE_CODE;
+    tc_regs->ss = DEFAULT_UMODE_DATA;
+    tc_regs->rsp = stack;
+    tc_regs->rflags = DEFAULT_RFLAGS;
+    tc_regs->rip = entry;
+    tc_regs->rdi = arg0;
+    tc_regs->rsi = arg1;
+
+    tc->tstack_top = tc_regs;
+    tc->tstack_limit = tc->kstack_limit;
+
+    lock_lock(&tp->addrspace->lock);
+    tp->addrspace->refcount++;
+    lock_release(&tp->addrspace->lock);
+    tc->addrspace = tp->addrspace;
+
+    lock_lock(&tp->files->lock);
+    tp->files->refcount++;
+    lock_release(&tp->files->lock);
+    tc->files = tp->files;
+
+    tc->mode = TASK_USER_MODE;
+    /* Threads are detached, they are never reported by waitpid */
+    tc->ptid = TID_NONE;
+    tc->priority = tp->priority;
+    tc->policy = tp->policy;
+    tc->rt_priority = tp->rt_priority;
+    tc->rt_ticks = tp->rt_ticks;
+    tc->cpumask = tp->cpumask;
+    tc->last_cpu = tp->last_cpu;
+    tc->status = TASK_READY;
+    tc->fs_base = 0;
+
+    strncpy(tc->name, tp->name, sizeof(tc->name));
+
+    klogi("TASK: Clone tid %d from tid %d with entry 0x%x and stack 0x%x\n",
+          tc->tid, tp->tid, entry, stack);
+
+    return tc;
+}
+
+/*
+ * Create a child of task "tp" for vfork. The child borrows address space and
+ * user stack of "tp" and returns 0 to user mode from the syscall registers of
+ * "tp". It has its own copy of open-file table, so redirections made before
+ * execve do not affect "tp".
+ */
+task_t *task_vfork(task_t *tp)
+{
+    if (tp->mode != TASK_USER_MODE || tp->addrspace == NULL) {
+        return NULL;
+    }
+
+    task_id_t tid = tid_alloc();
+    if (tid == TID_NONE) {
+        klogw("Could not allocate tid\n");
+        return NULL;
+    }
+
+    task_t *tc = kmalloc(sizeof(task_t));
+    memset(tc, 0, sizeof(task_t));
+
+    tc->tid = tid;
+    tc->pid = tid;
+
+    tc->kstack_limit = kmalloc(STACK_SIZE);
+    tc->kstack_top = tc->kstack_limit + STACK_SIZE;
+
+    /* User stack is borrowed, it must not be freed with the child */
+    tc->ustack_limit = NULL;
+    tc->ustack_top = NULL;
+
+    task_regs_t *tc_regs = task_syscall_regs(tc);
+    memcpy(tc_regs, task_syscall_regs(tp), sizeof(task_regs_t));
+    tc_regs->rax = 0;
+    tc_regs->rdx = 0;
+
+    tc->tstack_top = tc_regs;
+    tc->tstack_limit = tc->kstack_limit;
+
+    lock_lock(&tp->addrspace->lock);
+    tp->addrspace->refcount++;
+    lock_release(&tp->addrspace->lock);
+    tc->addrspace = tp->addrspace;
+
+    tc->files = create_files(tp->files);
+
+    tc->mode = TASK_USER_MODE;
+    tc->ptid = tp->tid;
+    tc->vfork_ptid = tp->tid;
+    tc->priority = tp->priority;
+    tc->policy = tp->policy;
+    tc->rt_priority = tp->rt_priority;
+    tc->rt_ticks = tp->rt_ticks;
+    tc->cpumask = tp->cpumask;
+    tc->last_cpu = tp->last_cpu;
+    tc->status = TASK_READY;
+    tc->fs_base = tp->fs_base;
+
+    strncpy(tc->name, tp->name, sizeof(tc->name));
+
+    klogi("TASK: Vfork tid %d from tid %d with rip 0x%x and rsp 0x%x\n",
+          tc->tid, tp->tid, tc_regs->rip, tc_regs->rsp);
+
+    vec_push_back(&tp->child_list, tc->tid);
+
+    return tc;
+}
+
 void task_free(task_t *t)
 {
-    size_t mmap_num = vec_length(&t->mmap_list);
-    for (size_t i = 0; i < mmap_num; i++) {
-        mem_map_t m = vec_at(&t->mmap_list, i); 
-        vmm_unmap(t->addrspace, m.vaddr, m.np);
-        kmfree((void*)PHYS_TO_VIRT(m.paddr));
+    addrspace_t *as = t->addrspace;
+    size_t mmap_num = 0;
+    bool as_shared = false;
+
+    hrtimer_cancel(&t->sleep_timer);
+
+    lock_lock(&as->lock);
+    as_shared = (--as->refcount > 0);
+    if (as_shared && t->ustack_limit != NULL) {
+        /* Other threads are still alive, only free the user stack */
+        for (size_t i = 0; i < vec_length(&as->mmap_list); i++) {
+            mem_map_t m = vec_at(&as->mmap_list, i);
+            if (m.vaddr == (uint64_t)t->ustack_limit) {
+                vmm_unmap(as, m.vaddr, m.np);
+                kmfree((void*)PHYS_TO_VIRT(m.paddr));
+                vec_erase(&as->mmap_list, i);
+                mmap_num++;
+                break;
+            }
+        }
+    }
+    lock_release(&as->lock);
+
+    if (!as_shared) {
+        mmap_num = vec_length(&as->mmap_list);
+        for (size_t i = 0; i < mmap_num; i++) {
+            mem_map_t m = vec_at(&as->mmap_list, i); 
+            vmm_unmap(as, m.vaddr, m.np);
+            kmfree((void*)PHYS_TO_VIRT(m.paddr));
+        }
+        vec_erase_all(&as->mmap_list);
+        vdso_unmap(as);
     }
-    vec_erase_all(&t->mmap_list);
     vec_erase_all(&t->child_list);
-    vec_erase_all(&t->dup_list);
+    vec_erase_all(&t->wait_child.tasks);
+
+    /* Tasks which have run released the files in sched_exit() */
+    task_put_files(t);
 
     klogi("task_idle: dead task tid %d free mmap number %d\n",
           t->tid, mmap_num);
@@ -279,18 +564,22 @@ void task_free(task_t *t)
     }
     kmfree((void*)t->kstack_limit);
 
-    size_t mem_num = vec_length(&t->addrspace->mem_list);
-    for (size_t i = 0; i < mem_num; i++) {
-        /*
-         * Maybe it was already freed in unmap(), but it is also
-         * OK freed here because pmm_free will not crash.
-         */
-        uint64_t m = vec_at(&t->addrspace->mem_list, i); 
-        pmm_free(m, 8, __func__, __LINE__);
-    }
-    vec_erase_all(&t->addrspace->mem_list);
+    if (!as_shared) {
+        size_t mem_num = vec_length(&as->mem_list);
+        for (size_t i = 0; i < mem_num; i++) {
+            /*
+             * Maybe it was already freed in unmap(), but it is also
+             * OK freed here because pmm_free will not crash.
+             */
+            uint64_t m = vec_at(&as->mem_list, i); 
+            pmm_free(m, 8, __func__, __LINE__);
+        }
+        vec_erase_all(&as->mem_list);
 
-    kmfree((void*)t->addrspace->PML4);
-    kmfree((void*)t->addrspace);
+        kmfree((void*)as->PML4);
+        kmfree((void*)as);
+    }
+    fpu_free(t);
+    tid_free(t->tid);
     kmfree(t);
 }
@@ -40,6 +40,10 @@
 #include <sys/smp.h>
 #include <sys/mm.h>
 #include <fs/vfs.h>
+#include <fs/fdtable.h>
+#include <proc/waitqueue.h>
+#include <proc/rcu.h>
+#include <sys/hrtimer.h>
 
 #define DEFAULT_KMODE_CODE      0b00101000 /* 0x28 */
 #define DEFAULT_KMODE_DATA      0b00110000 /* 0x30 */
@@ -154,6 +158,7 @@ typedef enum {
     TASK_READY,
     TASK_RUNNING,
     TASK_SLEEPING,
+    TASK_ZOMBIE,
     TASK_DEAD,
     TASK_UNKNOWN
 } task_status_t;
@@ -196,10 +201,13 @@ typedef struct {
     uint64_t        timestamp;
 } event_t;
 
+/* Open-file table and current directory, shared by threads of a process */
 typedef struct {
-    vfs_handle_t    fh;
-    vfs_handle_t    newfh;
-} file_dup_t;
+    int64_t         refcount;
+    lock_t          lock;
+    fdtable_t       fdt;
+    char            cwd[VFS_MAX_PATH_LEN];
+} task_files_t;
  
 typedef struct task_t {
     void            *tstack_top;
@@ -213,31 +221,63 @@ typedef struct task_t {
 
     task_id_t       tid;
     task_id_t       ptid;
+    task_id_t       pid;            /* Process ID, shared by its threads */
     task_priority_t priority;
+    uint8_t         policy;         /* SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+    uint8_t         rt_priority;    /* Real-time priority, 0 for SCHED_OTHER */
+    uint8_t         rt_ticks;       /* Ticks left in time slice of SCHED_RR */
+    cpumask_t       cpumask;
+    uint16_t        last_cpu;
+    bool            queued;         /* In the run queue of "last_cpu" */
     uint64_t        last_tick;
     uint64_t        wakeup_time;
+    hrtimer_t       sleep_timer;    /* Fires at "wakeup_time" */
     event_t         wakeup_event;
+    uint64_t        ready_time;     /* Became runnable at, in nanoseconds */
+    uint64_t        run_start;      /* Switched in at, in nanoseconds */
+    uint64_t        runtime;        /* Total time on CPU, in nanoseconds */
+    uint64_t        nr_switches;    /* Times switched in */
     task_status_t   status;
     task_mode_t     mode;
 
     auxval_t        aux;
     vec_struct(task_id_t)  child_list;
-    vec_struct(file_dup_t) dup_list;
+    waitqueue_t     wait_child;     /* Parent waits here for child exit */
+    int64_t         exit_code;
+    task_id_t       vfork_ptid;     /* Parent blocked in vfork, or none */
+    task_id_t       vfork_ctid;     /* Child of vfork using the user stack */
+    rcu_head_t      rcu;            /* Reaped after a grace period */
 
     int64_t         errno;
 
     addrspace_t     *addrspace;
-    vec_struct(mem_map_t) mmap_list;
+    task_files_t    *files;
     uint64_t        fs_base;
 
-    char            cwd[VFS_MAX_PATH_LEN];
+    void            *fpu_area;      /* NULL if FPU was never used */
+    uint16_t        fpu_cpu;        /* CPU whose registers hold the state */
+    uint8_t         fpu_counter;    /* Time slices in which FPU is used */
+
     char            name[64];
 } task_t;
 
+/* User registers saved by syscall_handler on top of the kernel stack */
+static inline task_regs_t *task_syscall_regs(task_t *t)
+{
+    return (task_regs_t*)(t->kstack_limit + STACK_SIZE) - 1;
+}
+
 task_t* task_make(
     const char *name, void (*entry)(task_id_t), task_priority_t priority,
     task_mode_t mode, addrspace_t *pas);
 
 task_t *task_fork(task_t *tp);
+bool task_user_range_valid(addrspace_t *as, uint64_t addr, size_t len,
+                           uint64_t flags);
+bool task_user_stack_valid(addrspace_t *as, uint64_t stack);
+task_t *task_clone(task_t *tp, uint64_t entry, uint64_t arg0, uint64_t arg1,
+                   uint64_t stack);
+task_t *task_vfork(task_t *tp);
 void task_debug(task_t *t, bool force);
 void task_free(task_t *t);
+void task_put_files(task_t *t);
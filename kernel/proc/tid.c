@@ -0,0 +1,109 @@
+/**-----------------------------------------------------------------------------
+
+ @file    tid.c
+ @brief   Implementation of task id allocator and task lookup table
+ @details
+ @verbatim
+
+  Allocation searches the bitmap from the last allocated id, so a freed id is
+  not reused immediately. Leaves of the lookup table are allocated together
+  with the first id in their range and never freed, so tid_publish() does not
+  allocate memory and it can be called in context switch.
+
+  Lookup does not take any lock: entries are written by atomic stores and
+  read by atomic loads. A task is unpublished before it is passed to RCU,
+  and it is freed after a grace period, so a task found in an RCU read-side
+  section (or with sched_lock held) stays valid until the section ends.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+
+#include <base/kmalloc.h>
+#include <base/klog.h>
+#include <base/lock.h>
+#include <proc/tid.h>
+
+static lock_t tid_lock = lock_new();
+static uint64_t tid_bitmap[TID_LIMIT / 64] = {0};
+static task_id_t tid_last = TID_NONE;
+static task_t **tid_map[TID_TOP_SIZE] = {0};
+
+#define tid_test(id)    ((tid_bitmap[(id) / 64] >> ((id) % 64)) & 1)
+
+/* Return TID_NONE if all ids are used */
+task_id_t tid_alloc(void)
+{
+    task_id_t tid = TID_NONE;
+
+    lock_lock(&tid_lock);
+
+    for (size_t n = 0; n < TID_LIMIT; n++) {
+        task_id_t id = (tid_last + 1 + n) % TID_LIMIT;
+        if (id == TID_NONE || tid_test(id)) continue;
+        tid = id;
+        break;
+    }
+
+    if (tid != TID_NONE) {
+        size_t top = tid >> TID_LEAF_BITS;
+        if (tid_map[top] == NULL) {
+            task_t **leaf = kmalloc(TID_LEAF_SIZE * sizeof(task_t*));
+            memset(leaf, 0, TID_LEAF_SIZE * sizeof(task_t*));
+            __atomic_store_n(&tid_map[top], leaf, __ATOMIC_RELEASE);
+        }
+        tid_bitmap[tid / 64] |= 1ULL << (tid % 64);
+        tid_last = tid;
+    } else {
+        klogw("TID: all %d task ids are used\n", TID_LIMIT);
+    }
+
+    lock_release(&tid_lock);
+
+    return tid;
+}
+
+void tid_free(task_id_t tid)
+{
+    if (tid == TID_NONE || tid >= TID_LIMIT) return;
+
+    lock_lock(&tid_lock);
+    tid_bitmap[tid / 64] &= ~(1ULL << (tid % 64));
+    lock_release(&tid_lock);
+}
+
+/* Make the task visible to tid_lookup() */
+void tid_publish(task_t *t)
+{
+    if (t->tid == TID_NONE || t->tid >= TID_LIMIT) return;
+
+    task_t **leaf = tid_map[t->tid >> TID_LEAF_BITS];
+    __atomic_store_n(&leaf[t->tid & (TID_LEAF_SIZE - 1)], t,
+                     __ATOMIC_RELEASE);
+}
+
+/* Remove the entry only if it still points to the task */
+void tid_unpublish(task_t *t)
+{
+    if (t->tid == TID_NONE || t->tid >= TID_LIMIT) return;
+
+    task_t **leaf = tid_map[t->tid >> TID_LEAF_BITS];
+    task_t *expected = t;
+    __atomic_compare_exchange_n(&leaf[t->tid & (TID_LEAF_SIZE - 1)],
+                                &expected, NULL, false,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+task_t *tid_lookup(task_id_t tid)
+{
+    if (tid == TID_NONE || tid >= TID_LIMIT) return NULL;
+
+    task_t **leaf = __atomic_load_n(&tid_map[tid >> TID_LEAF_BITS],
+                                    __ATOMIC_ACQUIRE);
+    if (leaf == NULL) return NULL;
+
+    return __atomic_load_n(&leaf[tid & (TID_LEAF_SIZE - 1)],
+                           __ATOMIC_ACQUIRE);
+}
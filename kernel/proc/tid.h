@@ -0,0 +1,30 @@
+/**-----------------------------------------------------------------------------
+
+ @file    tid.h
+ @brief   Definition of task id allocator and task lookup table
+ @details
+ @verbatim
+
+  Task ids are allocated from a bitmap and recycled after tasks are freed.
+  A two-level radix table maps a task id to its task structure.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <proc/task.h>
+
+#define TID_LEAF_BITS           9
+#define TID_LEAF_SIZE           (1 << TID_LEAF_BITS)
+#define TID_TOP_SIZE            128
+#define TID_LIMIT               (TID_TOP_SIZE * TID_LEAF_SIZE)
+
+task_id_t tid_alloc(void);
+void tid_free(task_id_t tid);
+void tid_publish(task_t *t);
+void tid_unpublish(task_t *t);
+task_t *tid_lookup(task_id_t tid);
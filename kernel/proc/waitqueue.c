@@ -0,0 +1,100 @@
+/**-----------------------------------------------------------------------------
+
+ @file    waitqueue.c
+ @brief   Implementation of wait queue related functions
+ @details
+ @verbatim
+
+  The task is put into the queue and marked as sleeping in prepare stage, so
+  a wakeup which happens between releasing the object lock and the context
+  switch will not be lost. The scheduler keeps the READY status set by waker.
+
+  If timeout is given, the task is also woken by scheduler when wakeup time
+  is reached. In this case it is still in the queue and removes itself.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <proc/waitqueue.h>
+#include <proc/sched.h>
+#include <sys/ktime.h>
+
+void waitqueue_prepare(waitqueue_t *wq, uint64_t timeout)
+{
+    lock_lock(&wq->lock);
+
+    task_t *t = sched_prepare_sleep(
+        (timeout > 0) ? ktime_get_ns() + timeout : 0);
+    if (t != NULL) {
+        vec_push_back(&wq->tasks, t);
+    }
+
+    lock_release(&wq->lock);
+}
+
+/* Return false if the task is woken because of timeout */
+bool waitqueue_wait(waitqueue_t *wq, event_para_t *para)
+{
+    task_t *t = sched_get_current_task();
+    bool woken = true;
+
+    if (t == NULL) return false;
+
+    sched_yield();
+
+    lock_lock(&wq->lock);
+    for (size_t i = 0; i < vec_length(&wq->tasks); i++) {
+        if (vec_at(&wq->tasks, i) == t) {
+            vec_erase(&wq->tasks, i);
+            woken = false;
+            break;
+        }
+    }
+    lock_release(&wq->lock);
+
+    if (woken && para != NULL) {
+        *para = t->wakeup_event.para;
+    }
+
+    return woken;
+}
+
+bool waitqueue_wake_one(waitqueue_t *wq, event_para_t para)
+{
+    task_t *t = NULL;
+
+    lock_lock(&wq->lock);
+    if (vec_length(&wq->tasks) > 0) {
+        t = vec_at(&wq->tasks, 0);
+        vec_erase(&wq->tasks, 0);
+        sched_wakeup(t, para);
+    }
+    lock_release(&wq->lock);
+
+    return (t != NULL);
+}
+
+size_t waitqueue_wake_all(waitqueue_t *wq, event_para_t para)
+{
+    size_t num = 0;
+
+    lock_lock(&wq->lock);
+    num = vec_length(&wq->tasks);
+    for (size_t i = 0; i < num; i++) {
+        sched_wakeup(vec_at(&wq->tasks, i), para);
+    }
+    wq->tasks.len = 0;
+    lock_release(&wq->lock);
+
+    return num;
+}
+
+bool waitqueue_empty(waitqueue_t *wq)
+{
+    lock_lock(&wq->lock);
+    bool empty = (vec_length(&wq->tasks) == 0);
+    lock_release(&wq->lock);
+
+    return empty;
+}
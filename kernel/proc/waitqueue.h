@@ -0,0 +1,48 @@
+/**-----------------------------------------------------------------------------
+
+ @file    waitqueue.h
+ @brief   Definition of wait queue related data structures and functions
+ @details
+ @verbatim
+
+  A wait queue holds the tasks which are blocked on one object, e.g., a pipe or
+  an event type. Waking up only touches the tasks in the queue instead of
+  scanning the whole task list.
+
+  Usage (no lost wakeup as long as the condition is checked under obj lock):
+
+    lock_lock(&obj_lock);
+    while (!condition) {
+        waitqueue_prepare(&wq, 0);
+        lock_release(&obj_lock);
+        waitqueue_wait(&wq, &para);
+        lock_lock(&obj_lock);
+    }
+    lock_release(&obj_lock);
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <base/lock.h>
+#include <base/vector.h>
+
+/* Forward declarations, task.h includes this file for per-task queues */
+typedef struct task_t task_t;
+typedef uint64_t event_para_t;
+
+typedef struct {
+    lock_t lock;
+    vec_struct(task_t*) tasks;
+} waitqueue_t;
+
+void waitqueue_prepare(waitqueue_t *wq, uint64_t timeout);
+bool waitqueue_wait(waitqueue_t *wq, event_para_t *para);
+bool waitqueue_wake_one(waitqueue_t *wq, event_para_t para);
+size_t waitqueue_wake_all(waitqueue_t *wq, event_para_t para);
+bool waitqueue_empty(waitqueue_t *wq);
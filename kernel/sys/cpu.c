@@ -8,6 +8,8 @@
    Important CPU initializations are:
    * Write Combining : Write this bit to speed up framebuffer read/write speed.
    * SSE & SSE2      : We should enable them for SIMD operations.
+   * XSAVE           : Save and restore FPU/SSE/AVX state of tasks.
+   * MONITOR/MWAIT   : Wait in idle CPUs for wakeup by memory store.
 
  @endverbatim
 
@@ -16,6 +18,8 @@
 #include <libc/string.h>
 
 #include <sys/cpu.h>
+#include <sys/fpu.h>
+#include <sys/idle.h>
 #include <base/klog.h>
 
 static bool cpu_initialized = false;
@@ -127,6 +131,9 @@ void cpu_init()
     vcr4 |= 1 << 10; 
     write_cr("cr4", vcr4);
 
+    fpu_init();
+    idle_init();
+
     uint32_t x, y, na;
     cpuid(0, 0, &na, &y, &na, &na);
 
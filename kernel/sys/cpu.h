@@ -15,6 +15,7 @@
 #include <stdbool.h>
 
 #define MSR_PAT             0x0277
+#define MSR_TSC_DEADLINE    0x06E0
 
 #define MSR_FS_BASE         0xC0000100
 #define MSR_GS_BASE         0xC0000101
@@ -101,6 +102,16 @@ static inline uint64_t read_msr(uint32_t msr)
     return val;
 }
 
+/* Time stamp counter, not serialized */
+static inline uint64_t read_tsc(void)
+{
+    uint32_t low, high;
+
+    asm volatile("rdtsc" : "=a"(low), "=d"(high));
+
+    return ((uint64_t)high << 32) | low;
+}
+
 static inline void write_msr(uint32_t msr, uint64_t val)
 {
     uint32_t low = val & UINT32_MAX;
@@ -250,5 +261,38 @@ static const cpuid_feature_t CPUID_FEATURE_APIC = {
     .reg = CPUID_REG_EDX,
     .mask = 1 << 9 };
 
+static const cpuid_feature_t CPUID_FEATURE_MONITOR = {
+    .func = 0x00000001,
+    .reg = CPUID_REG_ECX,
+    .mask = 1 << 3 };
+
+static const cpuid_feature_t CPUID_FEATURE_TSC_DEADLINE = {
+    .func = 0x00000001,
+    .reg = CPUID_REG_ECX,
+    .mask = 1 << 24 };
+
+static const cpuid_feature_t CPUID_FEATURE_XSAVE = {
+    .func = 0x00000001,
+    .reg = CPUID_REG_ECX,
+    .mask = 1 << 26 };
+
+static const cpuid_feature_t CPUID_FEATURE_AVX = {
+    .func = 0x00000001,
+    .reg = CPUID_REG_ECX,
+    .mask = 1 << 28 };
+
+static const cpuid_feature_t CPUID_FEATURE_INVARIANT_TSC = {
+    .func = 0x80000007,
+    .reg = CPUID_REG_EDX,
+    .mask = 1 << 8 };
+
+static const cpuid_feature_t CPUID_FEATURE_XSAVEOPT = {
+    .func = 0x0000000D,
+    .param = 1,
+    .reg = CPUID_REG_EAX,
+    .mask = 1 << 0 };
+
+void cpuid(uint32_t func, uint32_t param, uint32_t* eax, uint32_t* ebx,
+           uint32_t* ecx, uint32_t* edx);
 bool cpuid_check_feature(cpuid_feature_t feature);
 
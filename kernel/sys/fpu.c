@@ -0,0 +1,228 @@
+/**-----------------------------------------------------------------------------
+
+ @file    fpu.c
+ @brief   Implementation of FPU/SSE/AVX state management functions
+ @details
+ @verbatim
+
+  FPU state is saved when a task is switched out if it has used FPU in this
+  time slice, and it is restored lazily: CR0.TS is set when switching in, so
+  the first FPU instruction of the task raises #NM (exception 7) and the
+  handler loads its state. Tasks which never touch FPU have no save area and
+  pay nothing except setting CR0.TS.
+
+  The registers still hold the state of last owner on each CPU, so the state
+  is not reloaded if the owner runs again on the same CPU. A task which keeps
+  using FPU in consecutive time slices is restored eagerly to avoid the trap.
+  The counter is 8 bits and wraps, so the task goes back to lazy mode every
+  256 slices and the policy is measured again.
+
+  XSAVEOPT is used when available. It skips the components which are in init
+  state or not modified since last XRSTOR of the same area.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+
+#include <base/klog.h>
+#include <base/kmalloc.h>
+#include <proc/sched.h>
+#include <sys/cpu.h>
+#include <sys/fpu.h>
+#include <sys/isr_base.h>
+#include <sys/smp.h>
+
+static bool fpu_xsave = false;
+static bool fpu_xsaveopt = false;
+static uint64_t fpu_xcr0 = 0;
+static size_t fpu_area_size = FPU_AREA_LEGACY_SIZE;
+
+/* Task whose state is in the registers of each CPU */
+static task_t *fpu_owner[CPU_MAX] = {0};
+
+static inline void fpu_set_ts(void)
+{
+    uint64_t vcr0;
+
+    read_cr("cr0", &vcr0);
+    if (!(vcr0 & CR0_TS)) {
+        write_cr("cr0", vcr0 | CR0_TS);
+    }
+}
+
+static inline bool fpu_ts_set(void)
+{
+    uint64_t vcr0;
+
+    read_cr("cr0", &vcr0);
+    return (vcr0 & CR0_TS) != 0;
+}
+
+static inline void fpu_save(void *area)
+{
+    if (fpu_xsaveopt) {
+        asm volatile("xsaveopt64 (%0)"
+                     : : "r"(area), "a"(UINT32_MAX), "d"(UINT32_MAX)
+                     : "memory");
+    } else if (fpu_xsave) {
+        asm volatile("xsave64 (%0)"
+                     : : "r"(area), "a"(UINT32_MAX), "d"(UINT32_MAX)
+                     : "memory");
+    } else {
+        asm volatile("fxsave64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+static inline void fpu_restore(void *area)
+{
+    if (fpu_xsave) {
+        asm volatile("xrstor64 (%0)"
+                     : : "r"(area), "a"(UINT32_MAX), "d"(UINT32_MAX)
+                     : "memory");
+    } else {
+        asm volatile("fxrstor64 (%0)" : : "r"(area) : "memory");
+    }
+}
+
+/* Make the registers of current CPU hold the state of task "t" */
+static void fpu_load(task_t *t, uint16_t cpu_id)
+{
+    asm volatile("clts");
+
+    if (fpu_owner[cpu_id] == t && t->fpu_cpu == cpu_id) return;
+
+    fpu_restore(t->fpu_area);
+    fpu_owner[cpu_id] = t;
+    t->fpu_cpu = cpu_id;
+}
+
+/* Area kept in init state by header, default control words are still needed */
+static void *fpu_alloc_area(void)
+{
+    /* kmalloc() returns page aligned memory which meets 64-byte alignment */
+    uint8_t *area = kmalloc(fpu_area_size);
+
+    memset(area, 0, fpu_area_size);
+    *(uint16_t*)&area[0] = 0x037F;      /* FCW */
+    *(uint32_t*)&area[24] = 0x1F80;     /* MXCSR */
+
+    return area;
+}
+
+/* Device Not Available exception: first FPU instruction in a time slice */
+static void fpu_trap_handler(void)
+{
+    cpu_t *cpu = smp_get_current_cpu(false);
+    task_t *t = sched_get_current_task();
+
+    if (cpu == NULL || t == NULL) {
+        asm volatile("clts");
+        return;
+    }
+
+    if (t->fpu_area == NULL) {
+        t->fpu_area = fpu_alloc_area();
+        t->fpu_cpu = CPU_MAX;
+    }
+
+    fpu_load(t, cpu->cpu_id);
+    t->fpu_counter++;
+}
+
+/* Initialize FPU for current CPU */
+void fpu_init(void)
+{
+    uint32_t eax, ebx, ecx, edx;
+
+    if (cpuid_check_feature(CPUID_FEATURE_XSAVE)) {
+        uint64_t vcr4;
+
+        read_cr("cr4", &vcr4);
+        vcr4 |= CR4_OSXSAVE;
+        write_cr("cr4", vcr4);
+
+        /* Supported user state components */
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_xcr0 = XCR0_X87 | XCR0_SSE;
+        if (cpuid_check_feature(CPUID_FEATURE_AVX) && (eax & XCR0_AVX)) {
+            fpu_xcr0 |= XCR0_AVX;
+            if ((eax & XCR0_AVX512) == XCR0_AVX512) {
+                fpu_xcr0 |= XCR0_AVX512;
+            }
+        }
+
+        asm volatile("xsetbv"
+                     : : "c"(0), "a"((uint32_t)fpu_xcr0),
+                         "d"((uint32_t)(fpu_xcr0 >> 32)));
+
+        /* EBX is the area size of components enabled in XCR0 */
+        cpuid(0xD, 0, &eax, &ebx, &ecx, &edx);
+        fpu_area_size = ebx;
+        fpu_xsave = true;
+        fpu_xsaveopt = cpuid_check_feature(CPUID_FEATURE_XSAVEOPT);
+    }
+
+    exc_register_handler(7, fpu_trap_handler);
+
+    /* Kernel does not use FPU, so the first user instruction traps */
+    fpu_set_ts();
+
+    klogi("FPU: %s with xcr0 0x%x and %d bytes area\n",
+          fpu_xsaveopt ? "XSAVEOPT" : (fpu_xsave ? "XSAVE" : "FXSAVE"),
+          fpu_xcr0, fpu_area_size);
+}
+
+/* Save the state if task "t" used FPU in the time slice which ends now */
+void fpu_switch_out(task_t *t, uint16_t cpu_id)
+{
+    if (t->fpu_area == NULL || fpu_owner[cpu_id] != t || fpu_ts_set()) return;
+
+    fpu_save(t->fpu_area);
+}
+
+void fpu_switch_in(task_t *t, uint16_t cpu_id)
+{
+    if (t->fpu_area == NULL) {
+        fpu_set_ts();
+        return;
+    }
+
+    if (t->fpu_counter > FPU_EAGER_THRESHOLD) {
+        fpu_load(t, cpu_id);
+        t->fpu_counter++;
+    } else if (fpu_owner[cpu_id] == t && t->fpu_cpu == cpu_id) {
+        /* Registers are still valid */
+        asm volatile("clts");
+    } else {
+        fpu_set_ts();
+    }
+}
+
+/* Called for fork, the state of "src" must be saved already */
+void fpu_copy(task_t *dst, const task_t *src)
+{
+    dst->fpu_area = NULL;
+    dst->fpu_cpu = CPU_MAX;
+    dst->fpu_counter = 0;
+
+    if (src->fpu_area != NULL) {
+        dst->fpu_area = kmalloc(fpu_area_size);
+        memcpy(dst->fpu_area, src->fpu_area, fpu_area_size);
+    }
+}
+
+void fpu_free(task_t *t)
+{
+    for (size_t k = 0; k < CPU_MAX; k++) {
+        task_t *owner = t;
+        __atomic_compare_exchange_n(&fpu_owner[k], &owner, NULL, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    if (t->fpu_area != NULL) {
+        kmfree(t->fpu_area);
+        t->fpu_area = NULL;
+    }
+}
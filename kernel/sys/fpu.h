@@ -0,0 +1,39 @@
+/**-----------------------------------------------------------------------------
+
+ @file    fpu.h
+ @brief   Definition of FPU/SSE/AVX state management functions
+ @details
+ @verbatim
+
+  Every task which uses FPU or SIMD instructions owns a save area. The area
+  uses XSAVE format when it is supported, or FXSAVE format otherwise.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define CR0_TS                  (1 << 3)
+#define CR4_OSXSAVE             (1 << 18)
+
+#define XCR0_X87                (1 << 0)
+#define XCR0_SSE                (1 << 1)
+#define XCR0_AVX                (1 << 2)
+#define XCR0_AVX512             (0b111 << 5)
+
+#define FPU_AREA_LEGACY_SIZE    512
+
+/* Restore eagerly after the task used FPU in this number of time slices */
+#define FPU_EAGER_THRESHOLD     5
+
+typedef struct task_t task_t;
+
+void fpu_init(void);
+void fpu_switch_out(task_t *t, uint16_t cpu_id);
+void fpu_switch_in(task_t *t, uint16_t cpu_id);
+void fpu_copy(task_t *dst, const task_t *src);
+void fpu_free(task_t *t);
@@ -0,0 +1,242 @@
+/**-----------------------------------------------------------------------------
+
+ @file    hrtimer.c
+ @brief   Implementation of high-resolution timer related functions
+ @details
+ @verbatim
+
+  The periodic APIC tick is replaced by a one-shot timer which is always
+  programmed for the earliest of the next scheduler tick and the first timer
+  in the heap of the CPU, so the scheduler still gets a tick every
+  HRTIMER_TICK_NS. If the CPU supports it and ktime uses the TSC, the timer
+  runs in TSC-deadline mode, otherwise the interval is converted to counts
+  of the local APIC timer.
+
+  hrtimer_interrupt() is called at the beginning of the timer interrupt. It
+  pops the expired timers and calls their functions with the heap lock
+  released, remembering the running one so hrtimer_cancel() can wait for it.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <sys/hrtimer.h>
+#include <sys/ktime.h>
+#include <sys/timer.h>
+#include <sys/cpu.h>
+#include <sys/smp.h>
+#include <base/lock.h>
+#include <base/vector.h>
+#include <base/klog.h>
+
+typedef struct {
+    lock_t      lock;
+    vec_struct(hrtimer_t*) heap;    /* Min-heap ordered by expiry time */
+    hrtimer_t   *running;           /* Timer whose function is running */
+    uint64_t    next_tick;          /* Time of next scheduler tick */
+    uint64_t    programmed;         /* Time programmed into the timer */
+    bool        tsc_deadline;
+} __attribute__((aligned(64))) hrtimer_base_t;
+
+static hrtimer_base_t hrtimer_bases[CPU_MAX] = {0};
+
+static hrtimer_base_t *hrtimer_this_base(void)
+{
+    return &hrtimer_bases[this_cpu_read(cpu_id)];
+}
+
+static void hrtimer_heap_set(hrtimer_base_t *b, size_t i, hrtimer_t *t)
+{
+    vec_at(&b->heap, i) = t;
+    t->slot = i + 1;
+}
+
+static void hrtimer_sift_up(hrtimer_base_t *b, size_t i)
+{
+    hrtimer_t *t = vec_at(&b->heap, i);
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        hrtimer_t *p = vec_at(&b->heap, parent);
+        if (p->expires <= t->expires) break;
+        hrtimer_heap_set(b, i, p);
+        i = parent;
+    }
+    hrtimer_heap_set(b, i, t);
+}
+
+static void hrtimer_sift_down(hrtimer_base_t *b, size_t i)
+{
+    size_t n = vec_length(&b->heap);
+    hrtimer_t *t = vec_at(&b->heap, i);
+
+    while (true) {
+        size_t child = i * 2 + 1;
+        if (child >= n) break;
+        if (child + 1 < n && vec_at(&b->heap, child + 1)->expires
+                             < vec_at(&b->heap, child)->expires) {
+            child++;
+        }
+        if (t->expires <= vec_at(&b->heap, child)->expires) break;
+        hrtimer_heap_set(b, i, vec_at(&b->heap, child));
+        i = child;
+    }
+    hrtimer_heap_set(b, i, t);
+}
+
+/* Heap lock must be held */
+static void hrtimer_heap_remove(hrtimer_base_t *b, hrtimer_t *t)
+{
+    size_t i = t->slot - 1;
+    size_t last = vec_length(&b->heap) - 1;
+    hrtimer_t *moved = vec_at(&b->heap, last);
+
+    vec_erase(&b->heap, last);
+    t->slot = 0;
+
+    if (i != last) {
+        hrtimer_heap_set(b, i, moved);
+        hrtimer_sift_up(b, i);
+        hrtimer_sift_down(b, moved->slot - 1);
+    }
+}
+
+/* Program the local timer, heap lock must be held by the owning CPU */
+static void hrtimer_program(hrtimer_base_t *b, uint64_t now)
+{
+    uint64_t next = b->next_tick;
+
+    if (vec_length(&b->heap) > 0 && vec_at(&b->heap, 0)->expires < next) {
+        next = vec_at(&b->heap, 0)->expires;
+    }
+
+    uint64_t delta = (next > now) ? next - now : 0;
+    if (delta < HRTIMER_MIN_NS) delta = HRTIMER_MIN_NS;
+
+    b->programmed = now + delta;
+
+    if (b->tsc_deadline) {
+        write_msr(MSR_TSC_DEADLINE, read_tsc() + ktime_ns_to_cycles(delta));
+    } else {
+        apic_timer_arm(delta);
+    }
+}
+
+void hrtimer_start(hrtimer_t *timer, uint64_t expires)
+{
+    if (timer->slot != 0) hrtimer_try_cancel(timer);
+
+    hrtimer_base_t *b = hrtimer_this_base();
+
+    lock_lock(&b->lock);
+
+    timer->expires = expires;
+    timer->cpu = this_cpu_read(cpu_id);
+    vec_push_back(&b->heap, timer);
+    hrtimer_sift_up(b, vec_length(&b->heap) - 1);
+
+    /* Fire earlier than programmed */
+    if (expires < b->programmed) hrtimer_program(b, ktime_get_ns());
+
+    lock_release(&b->lock);
+}
+
+/* Return true if the timer was queued, its function will not be called */
+bool hrtimer_try_cancel(hrtimer_t *timer)
+{
+    bool ret = false;
+
+    if (__atomic_load_n(&timer->slot, __ATOMIC_RELAXED) == 0) return false;
+
+    hrtimer_base_t *b = &hrtimer_bases[timer->cpu];
+
+    lock_lock(&b->lock);
+    if (timer->slot != 0) {
+        hrtimer_heap_remove(b, timer);
+        ret = true;
+    }
+    lock_release(&b->lock);
+
+    return ret;
+}
+
+/* Cancel the timer and wait for its running function */
+void hrtimer_cancel(hrtimer_t *timer)
+{
+    hrtimer_try_cancel(timer);
+
+    hrtimer_base_t *b = &hrtimer_bases[timer->cpu];
+    while (__atomic_load_n(&b->running, __ATOMIC_ACQUIRE) == timer) {
+        asm volatile("pause");
+    }
+}
+
+bool hrtimer_is_queued(hrtimer_t *timer)
+{
+    return __atomic_load_n(&timer->slot, __ATOMIC_RELAXED) != 0;
+}
+
+/*
+ * Run expired timers of current CPU and program the next event. Called in
+ * the timer interrupt, return true if the scheduler tick is due.
+ */
+bool hrtimer_interrupt(void)
+{
+    hrtimer_base_t *b = hrtimer_this_base();
+    uint64_t now = ktime_get_ns();
+    bool tick = false;
+
+    lock_lock(&b->lock);
+
+    if (now >= b->next_tick) {
+        tick = true;
+        b->next_tick += HRTIMER_TICK_NS;
+        if (b->next_tick <= now) b->next_tick = now + HRTIMER_TICK_NS;
+    }
+
+    while (vec_length(&b->heap) > 0 && vec_at(&b->heap, 0)->expires <= now) {
+        hrtimer_t *t = vec_at(&b->heap, 0);
+        hrtimer_heap_remove(b, t);
+        __atomic_store_n(&b->running, t, __ATOMIC_RELAXED);
+        lock_release(&b->lock);
+
+        t->func(t);
+
+        lock_lock(&b->lock);
+        __atomic_store_n(&b->running, NULL, __ATOMIC_RELEASE);
+    }
+
+    hrtimer_program(b, ktime_get_ns());
+
+    lock_release(&b->lock);
+
+    return tick;
+}
+
+/* Switch the local APIC timer of current CPU to one-shot and start ticks */
+void hrtimer_cpu_init(void)
+{
+    hrtimer_base_t *b = hrtimer_this_base();
+
+    b->lock = lock_new();
+    b->running = NULL;
+    b->tsc_deadline = ktime_is_tsc()
+                      && cpuid_check_feature(CPUID_FEATURE_TSC_DEADLINE);
+
+    if (b->tsc_deadline) {
+        apic_timer_set_mode(APIC_TIMER_MODE_TSC_DEADLINE);
+        /* The mode must be set before the deadline MSR is written */
+        asm volatile("mfence" : : : "memory");
+    } else {
+        apic_timer_set_mode(APIC_TIMER_MODE_ONESHOT);
+    }
+
+    lock_lock(&b->lock);
+    uint64_t now = ktime_get_ns();
+    b->next_tick = now + HRTIMER_TICK_NS;
+    hrtimer_program(b, now);
+    lock_release(&b->lock);
+
+    klogi("HRTIMER: CPU %d uses %s timer\n", this_cpu_read(cpu_id),
+          b->tsc_deadline ? "TSC-deadline" : "one-shot APIC");
+}
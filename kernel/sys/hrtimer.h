@@ -0,0 +1,50 @@
+/**-----------------------------------------------------------------------------
+
+ @file    hrtimer.h
+ @brief   Definition of high-resolution timer related functions
+ @details
+ @verbatim
+
+  A high-resolution timer calls its function once at an absolute time of
+  ktime_get_ns(). Every CPU keeps its timers in a min-heap of expiry times,
+  and the local APIC timer is programmed in one-shot (or TSC-deadline) mode
+  for the earliest of them and the next scheduler tick.
+
+  Timer functions run in the timer interrupt before the scheduler, with
+  interrupts disabled and no lock held, so they must not sleep. A timer may
+  be started again from its own function.
+
+    hrtimer_t t = hrtimer_new(func);
+    hrtimer_start(&t, ktime_get_ns() + MILLIS_TO_NANOS(10));
+
+  A timer is queued on the CPU which starts it. Starting and cancelling the
+  same timer must be serialized by the caller.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define HRTIMER_TICK_NS     1000000     /* Scheduler tick */
+#define HRTIMER_MIN_NS      1000        /* Shortest interval to program */
+
+typedef struct hrtimer_t {
+    uint64_t expires;               /* Time of ktime_get_ns() */
+    void     (*func)(struct hrtimer_t *timer);
+    uint16_t cpu;                   /* CPU whose heap holds the timer */
+    size_t   slot;                  /* Heap index plus 1, or 0 if idle */
+} hrtimer_t;
+
+#define hrtimer_new(f)      (hrtimer_t){.func = (f), .slot = 0}
+
+void hrtimer_start(hrtimer_t *timer, uint64_t expires);
+bool hrtimer_try_cancel(hrtimer_t *timer);
+void hrtimer_cancel(hrtimer_t *timer);
+bool hrtimer_is_queued(hrtimer_t *timer);
+void hrtimer_cpu_init(void);
+bool hrtimer_interrupt(void);
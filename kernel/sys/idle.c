@@ -0,0 +1,60 @@
+/**-----------------------------------------------------------------------------
+
+ @file    idle.c
+ @brief   Implementation of CPU idle driver functions
+ @details
+ @verbatim
+
+  MONITOR arms address monitoring on the cache line of the flag, and MWAIT
+  enters an implementation-dependent optimized state (C1 with hint 0) until
+  the line is written or an interrupt arrives. Interrupts are disabled while
+  checking the flag, and enabled by "sti" just before "mwait" or "hlt" whose
+  interrupt shadow makes the pair atomic.
+
+  If CPUID does not report MONITOR/MWAIT, "hlt" is used.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <base/klog.h>
+#include <sys/cpu.h>
+#include <sys/idle.h>
+
+static bool idle_mwait = false;
+
+void idle_init(void)
+{
+    idle_mwait = cpuid_check_feature(CPUID_FEATURE_MONITOR);
+
+    klogi("IDLE: %s is used for idle CPUs\n",
+          idle_mwait ? "MONITOR/MWAIT" : "HLT");
+}
+
+/* Whether a plain store to the flag wakes an idle CPU */
+bool idle_wake_by_store(void)
+{
+    return idle_mwait;
+}
+
+/* Wait until the flag is set or an interrupt arrives */
+void idle_wait(idle_flag_t *f)
+{
+    asm volatile("cli");
+
+    if (f->flag) {
+        asm volatile("sti");
+        return;
+    }
+
+    if (idle_mwait) {
+        asm volatile("monitor" : : "a"(f), "c"(0), "d"(0));
+        if (!f->flag) {
+            asm volatile("sti; mwait" : : "a"(0), "c"(0));
+        } else {
+            asm volatile("sti");
+        }
+    } else {
+        asm volatile("sti; hlt");
+    }
+}
@@ -0,0 +1,31 @@
+/**-----------------------------------------------------------------------------
+
+ @file    idle.h
+ @brief   Definition of CPU idle driver functions
+ @details
+ @verbatim
+
+  An idle CPU waits for a flag to be set. With MONITOR/MWAIT the CPU is woken
+  by a store to the cache line of the flag, otherwise it halts and needs an
+  interrupt to wake up.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define IDLE_LINE_SIZE      64
+
+/* Flag occupies a whole cache line so that only a wakeup touches it */
+typedef struct {
+    volatile bool flag;
+    uint8_t reserved[IDLE_LINE_SIZE - sizeof(bool)];
+} __attribute__((aligned(IDLE_LINE_SIZE))) idle_flag_t;
+
+void idle_init(void);
+bool idle_wake_by_store(void);
+void idle_wait(idle_flag_t *f);
@@ -83,6 +83,8 @@ void exc_handler_proc(uint64_t excno, task_regs_t *tr, uint64_t errcode)
 
     if (handler != 0) {
         handler();
+        if (excno < IRQ0) return;
+
         /* If the IRQ came from the Master PIC, it is sufficient to issue EOI
          * command only to the Master PIC; however if the IRQ came from the
          * Slave PIC, it is necessary to issue EOI to both PIC chips.
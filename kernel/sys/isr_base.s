@@ -41,9 +41,22 @@
     pop %rax
 .endm
 
+/*
+ * Swap GS bases if the frame with CS at "csoff(%rsp)" is from or returns to
+ * user mode, so GS base always points to the per-CPU structure in kernel.
+ * An NMI between the swap and iretq would still see the user GS base.
+ */
+.macro swapgs_if_user csoff
+    testq $3, \csoff(%rsp)
+    jz 1f
+    swapgs
+1:
+.endm
+
 .macro exc_noerrcode excno
 .global exc\excno
 exc\excno:
+    swapgs_if_user 8
     pushq (5 * 8)(%rsp)
     pushq (5 * 8)(%rsp)
     pushq (5 * 8)(%rsp)
@@ -64,6 +77,7 @@ exc\excno:
 .macro exc_errcode excno
 .global exc\excno
 exc\excno:
+    swapgs_if_user 16
     pushq (5 * 8)(%rsp)
     pushq (5 * 8)(%rsp)
     pushq (5 * 8)(%rsp)
@@ -77,12 +91,20 @@ exc\excno:
     movq (20 * 8)(%rsp), %rdx
 
     call exc_handler_proc
-    jmp .exc_end
+    jmp .exc_errcode_end
 .endm
 
 .exc_end:
     popam
     addq $40, %rsp
+    swapgs_if_user 8
+    iretq
+
+/* Also drop the error code below the frame of CPU */
+.exc_errcode_end:
+    popam
+    addq $48, %rsp
+    swapgs_if_user 8
     iretq
 
 exc_noerrcode   0
@@ -109,6 +131,7 @@ exc_errcode     30
 .macro irq_noerrcode irqno
 .global irq\irqno
 irq\irqno:
+    swapgs_if_user 8
     pushq (6 * 8)(%rsp)
     pushq (6 * 8)(%rsp)
     pushq (6 * 8)(%rsp)
@@ -0,0 +1,177 @@
+/**-----------------------------------------------------------------------------
+
+ @file    ktime.c
+ @brief   Implementation of kernel clocksource related functions
+ @details
+ @verbatim
+
+  The (base, mult, shift) tuple is protected by a sequence lock, so readers
+  on any CPU take no lock and never write shared memory.
+
+  The rate measured at boot only covers a short interval. The BSP refines
+  it from its timer tick by ktime_update() every KTIME_UPDATE_MS, using all
+  the HPET time since calibration started. The tuple is rebased to the
+  current time at each update, so the clock stays continuous and monotonic.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <sys/ktime.h>
+#include <sys/hpet.h>
+#include <sys/cpu.h>
+#include <sys/vdso.h>
+#include <base/seqlock.h>
+#include <base/klog.h>
+#include <base/time.h>
+
+static seqlock_t ktime_seq = seqlock_new();
+static ktime_clock_t ktime_clock = {0};
+static bool ktime_tsc = false;
+
+/* Start of calibration, and the next time to refine the rate */
+static uint64_t cal_tsc = 0;
+static uint64_t cal_ns = 0;
+static uint64_t update_ticks = 0;
+static uint64_t next_update = 0;
+
+/* Read the TSC and the HPET as close as possible */
+static void ktime_sample(uint64_t *tsc, uint64_t *ns)
+{
+    uint64_t rflags;
+
+    asm volatile("pushfq; pop %0; cli" : "=r"(rflags) : : "memory");
+    *ns = hpet_get_nanos();
+    *tsc = read_tsc();
+    asm volatile("push %0; popfq" : : "r"(rflags) : "memory", "cc");
+}
+
+/* Scale both values down to keep (ns << KTIME_SHIFT) in 64 bits */
+static uint64_t ktime_calc_mult(uint64_t ns, uint64_t ticks)
+{
+    while (ns >= (1ULL << (63 - KTIME_SHIFT))) {
+        ns >>= 1;
+        ticks >>= 1;
+    }
+
+    if (ticks == 0) return 0;
+    return (ns << KTIME_SHIFT) / ticks;
+}
+
+static uint64_t ktime_tsc_to_ns(const ktime_clock_t *c, uint64_t tsc)
+{
+    /* TSC of another CPU may be a little behind the base */
+    int64_t delta = (int64_t)(tsc - c->tsc_base);
+    if (delta < 0) delta = 0;
+
+    return c->ns_base
+           + (uint64_t)(((unsigned __int128)delta * c->mult) >> c->shift);
+}
+
+uint64_t ktime_get_ns(void)
+{
+    if (!__atomic_load_n(&ktime_tsc, __ATOMIC_ACQUIRE)) {
+        return hpet_get_nanos();
+    }
+
+    ktime_clock_t c;
+    uint64_t seq, tsc;
+
+    do {
+        seq = seqlock_read_begin(&ktime_seq);
+        c = ktime_clock;
+        tsc = read_tsc();
+    } while (seqlock_read_retry(&ktime_seq, seq));
+
+    return ktime_tsc_to_ns(&c, tsc);
+}
+
+/* TSC cycles of a short interval, only valid if TSC is used */
+uint64_t ktime_ns_to_cycles(uint64_t ns)
+{
+    uint64_t mult = __atomic_load_n(&ktime_clock.mult, __ATOMIC_RELAXED);
+
+    if (mult == 0) return 0;
+    if (ns >= (1ULL << (63 - KTIME_SHIFT))) {
+        ns = (1ULL << (63 - KTIME_SHIFT)) - 1;
+    }
+
+    return (ns << KTIME_SHIFT) / mult;
+}
+
+bool ktime_is_tsc(void)
+{
+    return __atomic_load_n(&ktime_tsc, __ATOMIC_ACQUIRE);
+}
+
+/* Copy the clock parameters, return false if TSC is not used */
+bool ktime_get_clock(ktime_clock_t *c)
+{
+    if (!__atomic_load_n(&ktime_tsc, __ATOMIC_ACQUIRE)) return false;
+
+    uint64_t seq;
+    do {
+        seq = seqlock_read_begin(&ktime_seq);
+        *c = ktime_clock;
+    } while (seqlock_read_retry(&ktime_seq, seq));
+
+    return true;
+}
+
+/* Called by the BSP with interrupts disabled */
+void ktime_update(void)
+{
+    if (!ktime_tsc || read_tsc() < next_update) return;
+
+    uint64_t tsc, ns;
+    ktime_sample(&tsc, &ns);
+
+    uint64_t mult = ktime_calc_mult(ns - cal_ns, tsc - cal_tsc);
+    if (mult == 0) return;
+
+    seqlock_write_begin(&ktime_seq);
+    ktime_clock.ns_base = ktime_tsc_to_ns(&ktime_clock, tsc);
+    ktime_clock.tsc_base = tsc;
+    ktime_clock.mult = mult;
+    vdso_update_clock(&ktime_clock);
+    seqlock_write_end(&ktime_seq);
+
+    next_update = tsc + update_ticks;
+}
+
+void ktime_init(void)
+{
+    if (hpet == NULL || !cpuid_check_feature(CPUID_FEATURE_INVARIANT_TSC)) {
+        klogw("KTIME: No invariant TSC, use HPET as clocksource\n");
+        return;
+    }
+
+    uint64_t tsc, ns;
+
+    ktime_sample(&cal_tsc, &cal_ns);
+    do {
+        asm volatile("pause");
+        ktime_sample(&tsc, &ns);
+    } while (ns - cal_ns < MILLIS_TO_NANOS(KTIME_CALIBRATE_MS));
+
+    uint64_t mult = ktime_calc_mult(ns - cal_ns, tsc - cal_tsc);
+    if (mult == 0) {
+        kloge("KTIME: TSC calibration failed, use HPET as clocksource\n");
+        return;
+    }
+
+    uint64_t ticks_per_ms = (tsc - cal_tsc) * 1000000 / (ns - cal_ns);
+    update_ticks = ticks_per_ms * KTIME_UPDATE_MS;
+    next_update = tsc + update_ticks;
+
+    seqlock_write_begin(&ktime_seq);
+    ktime_clock.tsc_base = tsc;
+    ktime_clock.ns_base = ns;
+    ktime_clock.mult = mult;
+    ktime_clock.shift = KTIME_SHIFT;
+    seqlock_write_end(&ktime_seq);
+
+    __atomic_store_n(&ktime_tsc, true, __ATOMIC_RELEASE);
+
+    klogi("KTIME: TSC runs at %d kHz, used as clocksource\n", ticks_per_ms);
+}
@@ -0,0 +1,44 @@
+/**-----------------------------------------------------------------------------
+
+ @file    ktime.h
+ @brief   Definition of kernel clocksource related functions
+ @details
+ @verbatim
+
+  ktime_get_ns() returns nanoseconds of a monotonic clock. If the CPU has an
+  invariant TSC, i.e., one which runs at a constant rate in all power states,
+  the TSC is calibrated against the HPET at boot and the time is computed by
+  a few instructions of TSC arithmetic:
+
+    ns = ns_base + ((tsc - tsc_base) * mult) >> shift
+
+  Otherwise ktime_get_ns() reads the HPET, as hpet_get_nanos() does.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define KTIME_SHIFT             32
+#define KTIME_CALIBRATE_MS      10      /* Calibration time at boot */
+#define KTIME_UPDATE_MS         1000    /* Interval of rate refinement */
+
+typedef struct {
+    uint64_t tsc_base;
+    uint64_t ns_base;               /* Time at tsc_base */
+    uint64_t mult;                  /* Nanoseconds per tick << shift */
+    uint64_t shift;
+} ktime_clock_t;
+
+void ktime_init(void);
+void ktime_update(void);
+bool ktime_is_tsc(void);
+bool ktime_get_clock(ktime_clock_t *c);
+uint64_t ktime_get_ns(void);
+uint64_t ktime_ns_to_cycles(uint64_t ns);
+
+#define ktime_get_ms()          (ktime_get_ns() / 1000000ULL)
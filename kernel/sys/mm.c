@@ -481,6 +481,7 @@ addrspace_t *create_addrspace(void)
     } 
     memset(as->PML4, 0, PAGE_SIZE * 8); 
     as->lock = lock_new();
+    as->refcount = 1;
 
     size_t len = vec_length(&mmap_list);
     for (size_t i = 0; i < len; i++) {
@@ -28,6 +28,7 @@
 #define BMP_PAGES_PER_BYTE      8
 
 #define MEM_VIRT_OFFSET         0xffff800000000000
+#define MEM_USER_LIMIT          0x0000800000000000  /* End of lower half */
 
 #define VIRT_TO_PHYS(a)         (((uint64_t)(a)) - MEM_VIRT_OFFSET)
 #define PHYS_TO_VIRT(a)         (((uint64_t)(a)) + MEM_VIRT_OFFSET)
@@ -75,12 +76,16 @@ uint64_t pmm_get_total_memory(void);
 #define VMM_FLAGS_DEFAULT       (VMM_FLAG_PRESENT | VMM_FLAG_READWRITE)
 #define VMM_FLAGS_MMIO          (VMM_FLAGS_DEFAULT | VMM_FLAG_CACHE_DISABLE)
 #define VMM_FLAGS_USERMODE      (VMM_FLAGS_DEFAULT | VMM_FLAG_USER)
+#define VMM_FLAGS_USERMODE_RO   (VMM_FLAG_PRESENT | VMM_FLAG_USER)
 
 #define PAGE_TABLE_ENTRIES      512
 
 typedef struct {
     uint64_t *PML4;
     vec_struct(uint64_t) mem_list;
+    vec_struct(mem_map_t) mmap_list;    /* User memory blocks */
+    int64_t   refcount;                 /* Tasks sharing this space */
+    void      *vdso_task;               /* Task page of vDSO, or NULL */
     lock_t    lock;
 } addrspace_t;
 
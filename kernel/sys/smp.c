@@ -39,9 +39,7 @@ static volatile int* ap_boot_counter = (volatile int*)PHYS_TO_VIRT(SMP_AP_BOOT_C
 
 static smp_info_t* smp_info = NULL;
 
-static bool smp_initialized = false;
-
-static lock_t smp_lock = {0};
+bool smp_initialized = false;
 
 const smp_info_t* smp_get_info()
 {
@@ -56,38 +54,39 @@ const smp_info_t* smp_get_info()
 cpu_t* smp_get_current_cpu(bool force_read)
 {
     if (smp_initialized || force_read) {
-        cpu_t *cpu = (cpu_t*)read_msr(MSR_KERN_GS_BASE);
-        if (cpu == NULL) cpu = (cpu_t*)read_msr(MSR_GS_BASE);
-        return cpu;
+        return this_cpu_read(self);
     } else {
         return NULL;
     }
 }
 
+/*
+ * Point GS base of current CPU to its per-CPU structure. The kernel GS base
+ * holds the user one, which is swapped in when returning to user mode.
+ */
+static void smp_set_current_cpu(cpu_t *cpuinfo)
+{
+    cpuinfo->self = cpuinfo;
+    write_msr(MSR_GS_BASE, (uint64_t)cpuinfo);
+    write_msr(MSR_KERN_GS_BASE, 0);
+}
+
 /* This is the only function in this module which will be called very
- * oftenly in syscall functions.
+ * oftenly in syscall functions. The field belongs to current CPU only, so
+ * no lock is needed.
  */
 bool cpu_set_errno(int64_t val)
 {
-    lock_lock(&smp_lock);
-    if (smp_initialized) {
-        cpu_t *cpu = (cpu_t*)read_msr(MSR_KERN_GS_BASE);
-        if (cpu == NULL) cpu = (cpu_t*)read_msr(MSR_GS_BASE);
-        if (cpu != NULL) {
-            cpu->errno = val;
-            lock_release(&smp_lock);
-            return true;
-        }
-    }
-    lock_release(&smp_lock);
-    return false;
+    if (!smp_initialized) return false;
+
+    this_cpu_write(errno, val);
+    return true;
 }
 
 void cpu_debug(void)
 {
     if (smp_initialized) {
-        cpu_t *cpu = (cpu_t*)read_msr(MSR_KERN_GS_BASE);
-        if (cpu == NULL) cpu = (cpu_t*)read_msr(MSR_GS_BASE);
+        cpu_t *cpu = this_cpu_read(self);
         if (cpu != NULL) {
             klogd("CPU: total_num %d, current id %d, kernel stack 0x%x\n",
                   smp_info->num_cpus, cpu->cpu_id, cpu->tss.rsp0);
@@ -115,8 +114,7 @@ _Noreturn void smp_ap_entrypoint(cpu_t* cpuinfo)
     init_tss(cpuinfo);
  
     /* put cpu information in gs */
-    write_msr(MSR_GS_BASE, (uint64_t)cpuinfo);
-    write_msr(MSR_KERN_GS_BASE, (uint64_t)cpuinfo);
+    smp_set_current_cpu(cpuinfo);
 
     /* enable the apic */
     apic_enable();
@@ -189,8 +187,7 @@ void smp_init()
         if (apic_read_reg(APIC_REG_ID) == lapics[i]->apic_id) {
             klogi("SMP: core %d is BSP\n", lapics[i]->proc_id);
             smp_info->cpus[smp_info->num_cpus].is_bsp = true;
-            write_msr(MSR_GS_BASE, (uint64_t)&(smp_info->cpus[smp_info->num_cpus]));
-            write_msr(MSR_KERN_GS_BASE, (uint64_t)&(smp_info->cpus[smp_info->num_cpus]));
+            smp_set_current_cpu(&(smp_info->cpus[smp_info->num_cpus]));
             for (uint64_t dl = 0; dl < 100; dl++) asm volatile ("nop;");
             init_tss(&(smp_info->cpus[smp_info->num_cpus]));
             smp_info->num_cpus++;
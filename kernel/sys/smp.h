@@ -8,6 +8,16 @@
   Symmetric Multiprocessing (or SMP) is one method of having multiple
   processors in one computer system.
 
+  In kernel mode the GS base of a CPU points to its cpu_t structure, so
+  per-CPU fields are accessed by one gs-relative instruction with
+  this_cpu_read() and this_cpu_write(). It is not affected by task migration
+  between CPUs. In user mode the pointer is only kept in the kernel GS base,
+  and every entry from and exit to user mode does swapgs.
+
+  The preempt count of a CPU is raised while a lock taken by
+  lock_lock_noirq() is held, and the scheduler does not switch the running
+  task out of the CPU until it drops to zero.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -15,8 +25,11 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <libc/string.h>
+
 #define SMP_TRAMPOLINE_BLOB_ADDR        0x1000
 #define SMP_AP_BOOT_COUNTER_ADDR        0xff0
 
@@ -28,6 +41,17 @@
 
 #define CPU_MAX                         256
 
+/* Bitmap of CPUs which is indexed by cpu_id */
+typedef struct {
+    uint64_t bits[CPU_MAX / 64];
+} cpumask_t;
+
+#define cpumask_test(m, c)      (((m)->bits[(c) / 64] >> ((c) % 64)) & 1)
+#define cpumask_set(m, c)       ((m)->bits[(c) / 64] |= (1ULL << ((c) % 64)))
+#define cpumask_clear(m, c)     ((m)->bits[(c) / 64] &= ~(1ULL << ((c) % 64)))
+#define cpumask_setall(m)       memset((m), 0xFF, sizeof(cpumask_t))
+#define cpumask_clearall(m)     memset((m), 0, sizeof(cpumask_t))
+
 /* TODO: If stack size is set to PAGE_SIZE * 32, there will be some #PF
  * exceptions in userspace apps (specifically in hansh). From the contexts, it
  * seems that the stack is corrupted. But we do not know the reason. In the
@@ -62,20 +86,55 @@ typedef struct [[gnu::packed]] {
  * gs register (other kernels can use fs). This structure contains a temporary
  * stack for the syscall, an address to store the process stack temporarily.
  */
-typedef struct [[gnu::packed]] {
-    int64_t errno;
+typedef struct [[gnu::packed]] cpu_t {
+    int64_t errno;                  /* Must be the first, see syscall_handler */
+    uint64_t user_rsp;              /* Offset 8, user stack in syscall entry */
+    uint64_t kernel_rsp;            /* Offset 16, kernel stack top of task */
     tss_t tss;
     uint16_t cpu_id;
     uint16_t lapic_id;
     bool is_bsp;
     uint8_t reserved_1[3];
+    struct cpu_t *self;
+    struct task_t *curr_task;
+    uint32_t preempt_count;         /* Held noirq locks, no switch if not 0 */
 } cpu_t;
 
+#define this_cpu_read(field)                                        \
+    ({                                                              \
+        typeof(((cpu_t*)0)->field) __val;                           \
+        asm volatile("mov %%gs:%c1, %0"                             \
+                     : "=r"(__val)                                  \
+                     : "i"(offsetof(cpu_t, field)));                \
+        __val;                                                      \
+    })
+
+#define this_cpu_write(field, val)                                  \
+    ({                                                              \
+        typeof(((cpu_t*)0)->field) __val = (val);                   \
+        asm volatile("mov %0, %%gs:%c1"                             \
+                     :                                              \
+                     : "r"(__val), "i"(offsetof(cpu_t, field))      \
+                     : "memory");                                   \
+    })
+
+/* Atomic against interrupts on this CPU, not against other CPUs */
+#define this_cpu_add(field, val)                                    \
+    ({                                                              \
+        typeof(((cpu_t*)0)->field) __val = (val);                   \
+        asm volatile("add %0, %%gs:%c1"                             \
+                     :                                              \
+                     : "r"(__val), "i"(offsetof(cpu_t, field))      \
+                     : "memory", "cc");                             \
+    })
+
 typedef struct {
     cpu_t cpus[CPU_MAX];
     uint16_t num_cpus;
 } smp_info_t;
 
+extern bool smp_initialized;
+
 void smp_init(void);
 const smp_info_t* smp_get_info(void);
 cpu_t* smp_get_current_cpu(bool force_read);
@@ -20,7 +20,11 @@
 
   TSC-Deadline mode:
   - Similar with one-shot mode but using CPU's time stamp counter instead
-    to get higher precision.
+    to get higher precision. The IRQ is generated when the TSC reaches the
+    value written to MSR_TSC_DEADLINE.
+
+  The scheduler tick and high-resolution timers program the timer in
+  one-shot or TSC-deadline mode, see hrtimer.c.
 
  @endverbatim
    Ref: https://wiki.osdev.org/APIC_timer
@@ -78,10 +82,25 @@ void apic_timer_set_mode(apic_timer_mode_t mode)
 {
     uint32_t val = apic_read_reg(APIC_REG_TIMER_LVT);
 
+    val &= ~(APIC_TIMER_FLAG_PERIODIC | APIC_TIMER_FLAG_TSC_DEADLINE);
+
     if(mode == APIC_TIMER_MODE_PERIODIC)
         apic_write_reg(APIC_REG_TIMER_LVT, val | APIC_TIMER_FLAG_PERIODIC);
+    else if (mode == APIC_TIMER_MODE_TSC_DEADLINE)
+        apic_write_reg(APIC_REG_TIMER_LVT, val | APIC_TIMER_FLAG_TSC_DEADLINE);
     else
-        apic_write_reg(APIC_REG_TIMER_LVT, val & ~(APIC_TIMER_FLAG_PERIODIC));
+        apic_write_reg(APIC_REG_TIMER_LVT, val);
+}
+
+/* Fire once after "nanos" in one-shot mode */
+void apic_timer_arm(uint64_t nanos)
+{
+    uint64_t count = (base_freq / divisor) * nanos / 1000000000;
+
+    if (count == 0) count = 1;
+    if (count > UINT32_MAX) count = UINT32_MAX;
+
+    apic_write_reg(APIC_REG_TIMER_ICR, count);
 }
 
 void apic_timer_enable(void)
@@ -28,11 +28,13 @@
 #define APIC_REG_TIMER_DCR          0x3e0
 
 #define APIC_TIMER_FLAG_PERIODIC    (1 << 17)
+#define APIC_TIMER_FLAG_TSC_DEADLINE (1 << 18)
 #define APIC_TIMER_FLAG_MASKED      (1 << 16)
 
 typedef enum {
     APIC_TIMER_MODE_PERIODIC,
-    APIC_TIMER_MODE_ONESHOT
+    APIC_TIMER_MODE_ONESHOT,
+    APIC_TIMER_MODE_TSC_DEADLINE
 } apic_timer_mode_t;
 
 void apic_timer_init(void);
@@ -43,5 +45,6 @@ void apic_timer_set_handler(void (*h)(void*));
 void apic_timer_set_frequency(uint64_t freq);
 void apic_timer_set_period(time_t tv);
 void apic_timer_set_mode(apic_timer_mode_t mode);
+void apic_timer_arm(uint64_t nanos);
 uint8_t apic_timer_get_vector(void);
 
@@ -0,0 +1,188 @@
+/**-----------------------------------------------------------------------------
+
+ @file    vdso.c
+ @brief   Implementation of virtual dynamic shared object (vDSO) functions
+ @details
+ @verbatim
+
+  Functions of the vDSO are placed in the ".vdso.text" section, which the
+  linker script puts between "vdso_start" and "vdso_end", and the section is
+  copied to the code page at boot. The code runs in user mode at another
+  address, so it must not call any kernel function or use any kernel data:
+  it only reaches the data pages by their fixed addresses, and tests clock
+  IDs by bit masks instead of a switch which may become a jump table.
+
+  The clock parameters are copied from ktime.c by vdso_update_clock() while
+  the writer holds the sequence lock of ktime, and user readers follow the
+  same protocol as seqlock.h on "seq" of the data page.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#include <libc/string.h>
+
+#include <sys/vdso.h>
+#include <sys/cmos.h>
+#include <sys/panic.h>
+#include <base/kmalloc.h>
+#include <base/klog.h>
+#include <fs/vfs.h>
+#include <proc/syscall.h>
+
+#define VDSO_TEXT   __attribute__((section(".vdso.text"), noinline, used))
+
+/* Clocks which vdso_clock_gettime() answers without a system call */
+#define VDSO_CLOCKS_REALTIME    ((1 << CLOCK_REALTIME)                     \
+                                 | (1 << CLOCK_REALTIME_COARSE))
+#define VDSO_CLOCKS_MONOTONIC   ((1 << CLOCK_MONOTONIC)                    \
+                                 | (1 << CLOCK_MONOTONIC_RAW)              \
+                                 | (1 << CLOCK_MONOTONIC_COARSE)           \
+                                 | (1 << CLOCK_BOOTTIME))
+
+extern uint8_t vdso_start[], vdso_end[];
+
+static vdso_data_t *vdso_data = NULL;
+static void *vdso_code = NULL;
+
+VDSO_TEXT int64_t vdso_clock_gettime(int64_t which, vfs_timespec_t *out)
+{
+    const vdso_data_t *vd = (const vdso_data_t*)VDSO_DATA_ADDR;
+    uint64_t mask = (which >= 0 && which < 64) ? (1ULL << which) : 0;
+
+    if (__atomic_load_n(&vd->tsc, __ATOMIC_RELAXED)
+        && (mask & (VDSO_CLOCKS_REALTIME | VDSO_CLOCKS_MONOTONIC))) {
+        uint64_t seq, tsc, tsc_base, ns_base, mult, shift, boot_time;
+
+        do {
+            while ((seq = __atomic_load_n(&vd->seq, __ATOMIC_ACQUIRE)) & 1) {
+                asm volatile("pause");
+            }
+            tsc_base = vd->tsc_base;
+            ns_base = vd->ns_base;
+            mult = vd->mult;
+            shift = vd->shift;
+            boot_time = vd->boot_time;
+
+            uint32_t low, high;
+            asm volatile("rdtsc" : "=a"(low), "=d"(high));
+            tsc = ((uint64_t)high << 32) | low;
+
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (__atomic_load_n(&vd->seq, __ATOMIC_RELAXED) != seq);
+
+        int64_t delta = (int64_t)(tsc - tsc_base);
+        if (delta < 0) delta = 0;
+
+        uint64_t now_ns = ns_base
+            + (uint64_t)(((unsigned __int128)delta * mult) >> shift);
+        uint64_t now_sec = now_ns / 1000000000;
+
+        /* Same values as k_getclock() */
+        if (mask & VDSO_CLOCKS_REALTIME) {
+            out->tv_sec = now_sec + boot_time;
+            out->tv_nsec = now_ns + boot_time * 1000000000;
+        } else {
+            out->tv_sec = now_sec;
+            out->tv_nsec = now_ns;
+        }
+        return 0;
+    }
+
+    int64_t ret;
+    register uint64_t rdx asm("rdx") = (uint64_t)out;
+    asm volatile("syscall"
+                 : "=a"(ret), "+r"(rdx)
+                 : "a"(SYSCALL_GETCLOCK), "D"(0), "S"(which)
+                 : "rcx", "r11", "memory");
+    return ret;
+}
+
+VDSO_TEXT int64_t vdso_getpid(void)
+{
+    const vdso_task_t *vt = (const vdso_task_t*)VDSO_TASK_ADDR;
+
+    return __atomic_load_n(&vt->tid, __ATOMIC_RELAXED);
+}
+
+/* Called with the sequence lock of ktime held */
+void vdso_update_clock(const ktime_clock_t *c)
+{
+    if (vdso_data == NULL) return;
+
+    uint64_t seq = vdso_data->seq;
+
+    __atomic_store_n(&vdso_data->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    vdso_data->tsc_base = c->tsc_base;
+    vdso_data->ns_base = c->ns_base;
+    vdso_data->mult = c->mult;
+    vdso_data->shift = c->shift;
+
+    __atomic_store_n(&vdso_data->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&vdso_data->tsc, 1, __ATOMIC_RELEASE);
+}
+
+void vdso_map(addrspace_t *as, uint64_t tid)
+{
+    if (vdso_data == NULL || as == NULL) return;
+
+    vdso_task_t *vt = kmalloc(PAGE_SIZE);
+    memset(vt, 0, PAGE_SIZE);
+    vt->tid = tid;
+    as->vdso_task = vt;
+
+    vmm_map(as, VDSO_CODE_ADDR, VIRT_TO_PHYS(vdso_code), 1,
+            VMM_FLAGS_USERMODE_RO);
+    vmm_map(as, VDSO_DATA_ADDR, VIRT_TO_PHYS(vdso_data), 1,
+            VMM_FLAGS_USERMODE_RO);
+    vmm_map(as, VDSO_TASK_ADDR, VIRT_TO_PHYS(vt), 1, VMM_FLAGS_USERMODE_RO);
+}
+
+void vdso_set_tid(addrspace_t *as, uint64_t tid)
+{
+    if (as == NULL || as->vdso_task == NULL) return;
+
+    __atomic_store_n(&((vdso_task_t*)as->vdso_task)->tid, tid,
+                     __ATOMIC_RELAXED);
+}
+
+void vdso_unmap(addrspace_t *as)
+{
+    if (as == NULL || as->vdso_task == NULL) return;
+
+    vmm_unmap(as, VDSO_CODE_ADDR, 3);
+    kmfree(as->vdso_task);
+    as->vdso_task = NULL;
+}
+
+void vdso_init(void)
+{
+    size_t size = vdso_end - vdso_start;
+    if (size > PAGE_SIZE) {
+        kpanic("vDSO code is %d bytes, more than a page\n", size);
+    }
+
+    vdso_code = kmalloc(PAGE_SIZE);
+    memset(vdso_code, 0, PAGE_SIZE);
+    memcpy(vdso_code, vdso_start, size);
+
+    vdso_data_t *vd = kmalloc(PAGE_SIZE);
+    memset(vd, 0, PAGE_SIZE);
+
+    vd->clock_gettime = VDSO_CODE_ADDR
+        + ((uint64_t)vdso_clock_gettime - (uint64_t)vdso_start);
+    vd->getpid = VDSO_CODE_ADDR
+        + ((uint64_t)vdso_getpid - (uint64_t)vdso_start);
+    vd->boot_time = cmos_boot_time();
+
+    vdso_data = vd;
+
+    /* Later changes are copied by ktime itself */
+    ktime_clock_t c;
+    if (ktime_get_clock(&c)) vdso_update_clock(&c);
+
+    klogi("vDSO: %d bytes of code, clock %s\n", size,
+          vd->tsc ? "from TSC" : "by system call");
+}
@@ -0,0 +1,63 @@
+/**-----------------------------------------------------------------------------
+
+ @file    vdso.h
+ @brief   Definition of virtual dynamic shared object (vDSO) related functions
+ @details
+ @verbatim
+
+  The vDSO lets user tasks read the clock and their task ID without a system
+  call. Three read-only pages are mapped at fixed addresses into every user
+  address space:
+
+    VDSO_CODE_ADDR  Code of vdso_clock_gettime() and vdso_getpid()
+    VDSO_DATA_ADDR  Entries of the functions above, the clock parameters
+                    of ktime.h and the boot time, shared by all tasks
+    VDSO_TASK_ADDR  Process ID of the tasks running on the address space
+
+  The entries are the first fields of the data page, and they are the only
+  fields which libc depends on. If the clock is not computed from the TSC,
+  vdso_clock_gettime() falls back to the system call.
+
+  Threads share the address space and the process ID, which is the tid of
+  the first task of the process, so vdso_getpid() returns the same as the
+  getpid system call. A child of vfork is a new process which borrows the
+  address space, and the ID is set to the child until it calls execve or
+  exits.
+
+ @endverbatim
+
+ **-----------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <sys/mm.h>
+#include <sys/ktime.h>
+
+#define VDSO_CODE_ADDR      0x7FFFFFFFC000
+#define VDSO_DATA_ADDR      0x7FFFFFFFD000
+#define VDSO_TASK_ADDR      0x7FFFFFFFE000
+
+typedef struct {
+    uint64_t clock_gettime;         /* Entries in user address space */
+    uint64_t getpid;
+
+    uint64_t seq;                   /* Odd while the clock is updated */
+    uint64_t tsc;                   /* Clock is computed from TSC */
+    uint64_t tsc_base;
+    uint64_t ns_base;
+    uint64_t mult;
+    uint64_t shift;
+    uint64_t boot_time;             /* Seconds since epoch at boot */
+} vdso_data_t;
+
+typedef struct {
+    uint64_t tid;
+} vdso_task_t;
+
+void vdso_init(void);
+void vdso_update_clock(const ktime_clock_t *c);
+void vdso_map(addrspace_t *as, uint64_t tid);
+void vdso_set_tid(addrspace_t *as, uint64_t tid);
+void vdso_unmap(addrspace_t *as);
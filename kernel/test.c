@@ -7,6 +7,16 @@
 
   The file test functions in this file can be called in kmain() function.
 
+  sched_rt_test() measures the time from sched_wakeup() to the woken task
+  running, while CPU-bound tasks keep all CPUs busy. It runs once with the
+  sleeper in SCHED_OTHER and once in SCHED_FIFO, and must be called from a
+  task after the scheduler is started.
+
+  lock_bench() lets 1 to LOCK_BENCH_CPUS CPUs increase a shared counter
+  under one lock for a fixed time, with lock_lock() and lock_lock_noirq().
+  It reports throughput and the least and most acquisitions of a CPU, which
+  shows the fairness of the lock.
+
  @endverbatim
 
  **-----------------------------------------------------------------------------
@@ -15,6 +25,10 @@
 #include <fs/fat32.h>
 
 #include <base/klog.h>
+#include <base/lock.h>
+#include <proc/sched.h>
+#include <sys/ktime.h>
+#include <sys/smp.h>
 
 #include <test.h>
 
@@ -98,3 +112,205 @@ void file_test(void)
     }
 }
 
+#define RT_TEST_SAMPLES     200
+#define RT_TEST_PERIOD      2       /* Milliseconds between two wakeups */
+
+static volatile bool rt_test_running = false;
+static volatile int64_t rt_test_alive = 0;
+static volatile uint64_t rt_test_count = 0;
+static volatile uint64_t rt_test_sum = 0;
+static volatile uint64_t rt_test_max = 0;
+
+/* CPU-bound load which never sleeps */
+static void rt_test_hog(task_id_t tid)
+{
+    (void)tid;
+
+    while (rt_test_running) {
+        asm volatile("pause");
+    }
+
+    __atomic_sub_fetch(&rt_test_alive, 1, __ATOMIC_RELEASE);
+    sched_exit(0);
+}
+
+/*
+ * Sleep until woken by sched_rt_test() which passes the time of wakeup. It
+ * also wakes up by timeout, so it can leave after the test stops waking it.
+ */
+static void rt_test_sleeper(task_id_t tid)
+{
+    (void)tid;
+
+    while (rt_test_running) {
+        task_t *t = sched_prepare_sleep(
+            ktime_get_ns() + MILLIS_TO_NANOS(RT_TEST_PERIOD * 10));
+        sched_yield();
+
+        uint64_t now = ktime_get_ns();
+        uint64_t stamp = t->wakeup_event.para;
+        if (stamp == 0 || now < stamp) continue;
+
+        rt_test_sum += now - stamp;
+        if (now - stamp > rt_test_max) rt_test_max = now - stamp;
+        rt_test_count++;
+    }
+
+    __atomic_sub_fetch(&rt_test_alive, 1, __ATOMIC_RELEASE);
+    sched_exit(0);
+}
+
+static void rt_test_run(uint8_t policy, size_t nhogs)
+{
+    rt_test_count = 0;
+    rt_test_sum = 0;
+    rt_test_max = 0;
+    rt_test_running = true;
+
+    for (size_t i = 0; i < nhogs; i++) {
+        task_t *t = sched_new("rt_test_hog", rt_test_hog, false);
+        if (t == NULL) break;
+        __atomic_add_fetch(&rt_test_alive, 1, __ATOMIC_RELEASE);
+        sched_add(t);
+    }
+
+    task_t *ts = sched_new("rt_test_sleeper", rt_test_sleeper, false);
+    if (ts == NULL) {
+        rt_test_running = false;
+        goto wait_exit;
+    }
+    __atomic_add_fetch(&rt_test_alive, 1, __ATOMIC_RELEASE);
+    sched_add(ts);
+    sched_set_policy(ts->tid, policy,
+                     policy == SCHED_OTHER ? 0 : SCHED_RT_PRIO_MAX);
+
+    for (size_t n = 0; n < RT_TEST_SAMPLES * 10; n++) {
+        if (rt_test_count >= RT_TEST_SAMPLES) break;
+        sched_sleep(RT_TEST_PERIOD);
+        sched_wakeup(ts, ktime_get_ns());
+    }
+
+    /* The sleeper is not touched any more, it may exit and be freed */
+    rt_test_running = false;
+
+    if (rt_test_count > 0) {
+        klogi("RT test: %s wakeup latency avg %d us, max %d us "
+              "(%d samples, %d CPU-bound tasks)\n",
+              policy == SCHED_OTHER ? "SCHED_OTHER" : "SCHED_FIFO",
+              rt_test_sum / rt_test_count / 1000, rt_test_max / 1000,
+              rt_test_count, nhogs);
+    } else {
+        kloge("RT test: no wakeup of %s task is measured\n",
+              policy == SCHED_OTHER ? "SCHED_OTHER" : "SCHED_FIFO");
+    }
+
+wait_exit:
+    while (__atomic_load_n(&rt_test_alive, __ATOMIC_ACQUIRE) > 0) {
+        sched_sleep(RT_TEST_PERIOD);
+    }
+}
+
+void sched_rt_test(void)
+{
+    size_t nhogs = sched_get_cpu_num() * 2;
+
+    rt_test_run(SCHED_OTHER, nhogs);
+    rt_test_run(SCHED_FIFO, nhogs);
+}
+
+#define LOCK_BENCH_CPUS     8
+#define LOCK_BENCH_TIME     200     /* Milliseconds of each round */
+#define LOCK_BENCH_BATCH    64      /* Acquisitions between time checks */
+
+static lock_t lock_bench_lock = lock_new();
+static volatile bool lock_bench_noirq = false;
+static volatile uint64_t lock_bench_start = 0;
+static volatile uint64_t lock_bench_end = 0;
+static volatile uint64_t lock_bench_counter = 0;
+static volatile uint64_t lock_bench_counts[LOCK_BENCH_CPUS] = {0};
+static volatile int64_t lock_bench_next = 0;
+static volatile int64_t lock_bench_alive = 0;
+
+static void lock_bench_worker(task_id_t tid)
+{
+    (void)tid;
+
+    int64_t idx = __atomic_fetch_add(&lock_bench_next, 1, __ATOMIC_RELAXED);
+    uint64_t n = 0;
+
+    while (ktime_get_ns() < lock_bench_start) {
+        asm volatile("pause");
+    }
+
+    while (ktime_get_ns() < lock_bench_end) {
+        for (size_t i = 0; i < LOCK_BENCH_BATCH; i++) {
+            if (lock_bench_noirq) {
+                lock_lock_noirq(&lock_bench_lock);
+                lock_bench_counter++;
+                lock_release_noirq(&lock_bench_lock);
+            } else {
+                lock_lock(&lock_bench_lock);
+                lock_bench_counter++;
+                lock_release(&lock_bench_lock);
+            }
+        }
+        n += LOCK_BENCH_BATCH;
+    }
+
+    lock_bench_counts[idx] = n;
+    __atomic_sub_fetch(&lock_bench_alive, 1, __ATOMIC_RELEASE);
+    sched_exit(0);
+}
+
+static void lock_bench_run(size_t ncpus, bool noirq)
+{
+    const smp_info_t *smp_info = smp_get_info();
+
+    lock_bench_noirq = noirq;
+    lock_bench_counter = 0;
+    lock_bench_next = 0;
+    lock_bench_start = ktime_get_ns() + MILLIS_TO_NANOS(20);
+    lock_bench_end = lock_bench_start + MILLIS_TO_NANOS(LOCK_BENCH_TIME);
+
+    for (size_t i = 0; i < ncpus; i++) {
+        lock_bench_counts[i] = 0;
+
+        task_t *t = sched_new("lock_bench", lock_bench_worker, false);
+        if (t == NULL) break;
+
+        /* One worker on each CPU, it is not queued yet */
+        cpumask_clearall(&t->cpumask);
+        cpumask_set(&t->cpumask, smp_info->cpus[i].cpu_id);
+
+        __atomic_add_fetch(&lock_bench_alive, 1, __ATOMIC_RELEASE);
+        sched_add(t);
+    }
+
+    while (__atomic_load_n(&lock_bench_alive, __ATOMIC_ACQUIRE) > 0) {
+        sched_sleep(10);
+    }
+
+    uint64_t total = 0, min = UINT64_MAX, max = 0;
+    for (size_t i = 0; i < ncpus; i++) {
+        total += lock_bench_counts[i];
+        if (lock_bench_counts[i] < min) min = lock_bench_counts[i];
+        if (lock_bench_counts[i] > max) max = lock_bench_counts[i];
+    }
+
+    klogi("LOCK bench: %d CPUs, %s, %d locks/ms, %d ns per lock, "
+          "CPU min %d max %d%s\n",
+          ncpus, noirq ? "noirq" : "irqsave", total / LOCK_BENCH_TIME,
+          total > 0 ? MILLIS_TO_NANOS(LOCK_BENCH_TIME) / total : 0,
+          min, max, lock_bench_counter == total ? "" : " (COUNTER MISMATCH)");
+}
+
+void lock_bench(void)
+{
+    const smp_info_t *smp_info = smp_get_info();
+    if (smp_info == NULL) return;
+
+    for (size_t n = 1; n <= LOCK_BENCH_CPUS && n <= smp_info->num_cpus; n++) {
+        lock_bench_run(n, false);
+        lock_bench_run(n, true);
+    }
+}
@@ -18,4 +18,6 @@
 
 void file_test(void);
 void dir_test(void);
+void sched_rt_test(void);
+void lock_bench(void);
 
@@ -41,6 +41,16 @@
                   : "rcx", "r11", "memory");                   \
 })
 
+#define SYSCALL5(NUM, ARG0, ARG1, ARG2, ARG3, ARG4) ({         \
+    register typeof(ARG3) arg3 asm("r10") = ARG3;              \
+    register typeof(ARG4) arg4 asm("r8")  = ARG4;              \
+    asm volatile ("syscall"                                    \
+                  : "=a"(ret), "=d"(errno)                     \
+                  : "a"(NUM), "D"(ARG0), "S"(ARG1), "d"(ARG2), \
+                    "r"(arg3), "r"(arg4)                       \
+                  : "rcx", "r11", "memory");                   \
+})
+
 #define SYSCALL6(NUM, ARG0, ARG1, ARG2, ARG3, ARG4, ARG5) ({   \
     register typeof(ARG3) arg3 asm("r10") = ARG3;              \
     register typeof(ARG4) arg4 asm("r8")  = ARG4;              \
@@ -89,6 +99,23 @@
 #define SYSCALL_MEMINFO     34
 #define SYSCALL_PIPE        35
 #define SYSCALL_UNLINK      36
+#define SYSCALL_CLONE       37
+#define SYSCALL_SETAFFINITY 38
+#define SYSCALL_GETAFFINITY 39
+#define SYSCALL_SPAWN       40
+#define SYSCALL_VFORK       41
+#define SYSCALL_SCHEDSTAT   42
+#define SYSCALL_SETSCHED    43
+#define SYSCALL_LOCKSTAT    44
+#define SYSCALL_NANOSLEEP   45
+
+/* Entries at the beginning of vDSO data page, same with vdso.h */
+#define VDSO_DATA_ADDR      0x7FFFFFFFD000
+
+typedef struct {
+    int64_t (*clock_gettime)(int64_t which, timespec_t *tp);
+    int64_t (*getpid)(void);
+} vdso_entry_t;
 
 void sys_libc_log(const char *message)
 {
@@ -193,6 +220,35 @@ int sys_exec(const char *path, char *const argv[])
     return ret;
 }
 
+int sys_spawn(const char *path, char *const argv[],
+              const spawn_action_t *actions, int num)
+{
+    int64_t ret;
+    int errno;
+    const char *envp[] = {
+        "TIME_STYLE=posix-long-iso",
+        "TERM=hanos",
+        NULL
+    };
+    SYSCALL5(SYSCALL_SPAWN, path, argv, envp, actions, (int64_t)num);
+    return ret;
+}
+
+/*
+ * The child runs on the stack of caller until it calls exec or exits and
+ * overwrites the frame of this function, so the return address is kept in
+ * a register which the kernel restores for both of them.
+ */
+__attribute__((naked)) int sys_vfork()
+{
+    asm volatile ("pop %%rdi\n\t"
+                  "mov %0, %%eax\n\t"
+                  "syscall\n\t"
+                  "push %%rdi\n\t"
+                  "ret"
+                  : : "i"(SYSCALL_VFORK));
+}
+
 void sys_exit(int status)
 {
     int ret, errno;
@@ -231,13 +287,39 @@ int sys_mkdirat(const char *path)
     return ret;
 }
 
-int sys_dup(int fd, int flags, int newfd)
+int sys_dup(int fd)
+{
+    int errno, ret;
+    SYSCALL3(SYSCALL_FCNTL, fd, F_DUPFD, 0);
+    return ret;
+}
+
+int sys_dup2(int fd, int newfd)
+{
+    int errno, ret;
+    if (fd == newfd) {
+        /* Only check whether "fd" is open */
+        SYSCALL3(SYSCALL_FCNTL, fd, F_GETFD, 0);
+        return (ret < 0) ? ret : newfd;
+    }
+    SYSCALL3(SYSCALL_DUP3, fd, newfd, 0);
+    return ret;
+}
+
+int sys_dup3(int fd, int newfd, int flags)
 {
     int errno, ret;
     SYSCALL3(SYSCALL_DUP3, fd, newfd, flags);
     return ret;
 }
 
+int sys_fcntl(int fd, int cmd, int arg)
+{
+    int errno, ret;
+    SYSCALL3(SYSCALL_FCNTL, fd, cmd, arg);
+    return ret;
+}
+
 int sys_fstat(int fd, stat_t *statbuf)
 {
     int errno, ret;
@@ -259,3 +341,85 @@ int sys_readdir(int fd, void *buffer)
     return ret;
 }
 
+int sys_futex_wait(int64_t *ptr, int64_t expected, const timespec_t *tv)
+{
+    int ret, errno;
+    SYSCALL3(SYSCALL_FUTEX_WAIT, ptr, tv, expected);
+    return ret;
+}
+
+int sys_futex_wake(int64_t *ptr, int num)
+{
+    int ret, errno;
+    SYSCALL2(SYSCALL_FUTEX_WAKE, ptr, num);
+    return ret;
+}
+
+/* Threads start from here and exit when the thread function returns */
+static void sys_clone_entry(void (*fn)(void *), void *arg)
+{
+    fn(arg);
+    sys_exit(0);
+}
+
+int sys_clone(void (*fn)(void *), void *arg, void *stack)
+{
+    int ret, errno;
+    SYSCALL4(SYSCALL_CLONE, sys_clone_entry, fn, arg, stack);
+    return ret;
+}
+
+int sys_sched_setaffinity(int tid, size_t size, const uint64_t *mask)
+{
+    int ret, errno;
+    SYSCALL3(SYSCALL_SETAFFINITY, tid, size, mask);
+    return ret;
+}
+
+int sys_sched_getaffinity(int tid, size_t size, uint64_t *mask)
+{
+    int ret, errno;
+    SYSCALL3(SYSCALL_GETAFFINITY, tid, size, mask);
+    return ret;
+}
+
+int sys_schedstat(int which, int id, void *buf)
+{
+    int ret, errno;
+    SYSCALL3(SYSCALL_SCHEDSTAT, which, id, buf);
+    return ret;
+}
+
+int sys_sched_setscheduler(int tid, int policy, int priority)
+{
+    int ret, errno;
+    SYSCALL3(SYSCALL_SETSCHED, tid, policy, priority);
+    return ret;
+}
+
+int sys_lockstat(int id, lockstat_t *buf)
+{
+    int ret, errno;
+    SYSCALL2(SYSCALL_LOCKSTAT, id, buf);
+    return ret;
+}
+
+int sys_nanosleep(const timespec_t *req, timespec_t *rem)
+{
+    int ret, errno;
+    SYSCALL2(SYSCALL_NANOSLEEP, req, rem);
+    return ret;
+}
+
+/* Both run in the vDSO page mapped by kernel without a system call */
+int sys_clock_gettime(int which, timespec_t *tp)
+{
+    const vdso_entry_t *vdso = (const vdso_entry_t*)VDSO_DATA_ADDR;
+    return vdso->clock_gettime(which, tp);
+}
+
+int sys_getpid()
+{
+    const vdso_entry_t *vdso = (const vdso_entry_t*)VDSO_DATA_ADDR;
+    return vdso->getpid();
+}
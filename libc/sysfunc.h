@@ -31,6 +31,89 @@
 #define O_CLOEXEC           0x4000
 #define O_PATH              0x8000
 
+/* Commands and flags of sys_fcntl */
+#define F_DUPFD             0
+#define F_GETFD             1
+#define F_SETFD             2
+#define F_DUPFD_CLOEXEC     1030
+#define FD_CLOEXEC          1
+
+/*
+ * File actions of sys_spawn, applied in the child before it runs. DUP makes
+ * "newfd" a copy of "fd" like sys_dup2, and CLOSE closes "fd".
+ */
+#define SPAWN_ACTION_DUP    1
+#define SPAWN_ACTION_CLOSE  2
+
+typedef struct {
+    int64_t type;
+    int64_t fd;
+    int64_t newfd;
+} spawn_action_t;
+
+/* Clocks of sys_clock_gettime, same with syscall.h */
+#define CLOCK_REALTIME              0
+#define CLOCK_MONOTONIC             1
+#define CLOCK_PROCESS_CPUTIME_ID    2
+#define CLOCK_THREAD_CPUTIME_ID     3
+#define CLOCK_MONOTONIC_RAW         4
+#define CLOCK_REALTIME_COARSE       5
+#define CLOCK_MONOTONIC_COARSE      6
+#define CLOCK_BOOTTIME              7
+
+/* Scheduling policies of sys_sched_setscheduler */
+#define SCHED_OTHER         0
+#define SCHED_FIFO          1
+#define SCHED_RR            2
+
+#define SCHED_RT_PRIO_MIN   1
+#define SCHED_RT_PRIO_MAX   32
+
+/* Scheduler statistics of sys_schedstat, in nanoseconds */
+#define SCHEDSTAT_CPU       0
+#define SCHEDSTAT_TASK      1
+#define SCHEDSTAT_BUCKETS   16
+
+#define SCHED_SWITCH_TICK       0
+#define SCHED_SWITCH_SLEEP      1
+#define SCHED_SWITCH_FORK       2
+#define SCHED_SWITCH_RESCHED    3
+#define SCHED_SWITCH_MODES      4
+
+typedef struct {
+    uint64_t switches[SCHED_SWITCH_MODES];
+    uint64_t idle_ns;
+    uint64_t rt_ns;
+    uint64_t rt_throttled;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t wait_count;
+    uint64_t wait_hist[SCHEDSTAT_BUCKETS];
+} __attribute__((aligned(64))) sched_stat_t;
+
+typedef struct {
+    uint64_t tid;
+    uint64_t ptid;
+    uint64_t cpu;
+    uint64_t status;
+    uint64_t runtime_ns;
+    uint64_t switches;
+    char     name[64];
+} task_stat_t;
+
+/* Lock statistics of a lock class at an acquisition site, in TSC cycles */
+typedef struct {
+    char     file[48];
+    uint64_t line;
+    char     class[48];
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spin_total;
+    uint64_t spin_max;
+    uint64_t hold_total;
+    uint64_t hold_max;
+} lockstat_t;
+
 typedef struct {
     char command[256];
     char desc[256];
@@ -47,14 +130,31 @@ int sys_close(int fd);
 int sys_read(int fd, void *buf, size_t count);
 int sys_write(int fd, const void *buf, size_t count);
 int sys_exec(const char *path, char *const argv[]);
+int sys_spawn(const char *path, char *const argv[],
+              const spawn_action_t *actions, int num);
+int sys_vfork() __attribute__((returns_twice));
 void sys_exit(int status);
 int sys_wait(int pid);
 void sys_panic(const char *message);
 void *sys_malloc(int size);
 int sys_mkdirat(const char *path);
-int sys_dup(int fd, int flags, int newfd);
+int sys_dup(int fd);
+int sys_dup2(int fd, int newfd);
+int sys_dup3(int fd, int newfd, int flags);
+int sys_fcntl(int fd, int cmd, int arg);
 int sys_fstat(int fd, stat_t *statbuf);
 int sys_stat(const char *path, stat_t *statbuf);
 int sys_readdir(int fd, void *buffer);
 int sys_pipe(int *fd);
 int sys_unlink(const char *path);
+int sys_futex_wait(int64_t *ptr, int64_t expected, const timespec_t *tv);
+int sys_futex_wake(int64_t *ptr, int num);
+int sys_clone(void (*fn)(void *), void *arg, void *stack);
+int sys_sched_setaffinity(int tid, size_t size, const uint64_t *mask);
+int sys_sched_getaffinity(int tid, size_t size, uint64_t *mask);
+int sys_schedstat(int which, int id, void *buf);
+int sys_sched_setscheduler(int tid, int policy, int priority);
+int sys_lockstat(int id, lockstat_t *buf);
+int sys_nanosleep(const timespec_t *req, timespec_t *rem);
+int sys_clock_gettime(int which, timespec_t *tp);
+int sys_getpid();
@@ -16,6 +16,7 @@
 #define MAXARGS 10
 
 #define CMD_MAX_LEN     100
+#define CMD_ARENA_SIZE  4096
 #define CMD_PROMPT      "\033[36m$ \033[0m"
 
 static command_help_t help_msg[] = { 
@@ -60,8 +61,29 @@ struct backcmd {
 };
 
 int fork1(void);  /* Fork but panics on failure. */
+int spawncmd(struct execcmd *ecmd, int fd, int newfd, int *p);
 struct cmd *parsecmd(char*);
 
+/*
+ * Parsed commands of one line. The line is parsed by a vfork child in the
+ * memory of shell, so commands are put here and the arena is reused by the
+ * next line instead of leaking pages.
+ */
+static char cmd_arena[CMD_ARENA_SIZE];
+static size_t cmd_arena_used = 0;
+
+void *cmdalloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (cmd_arena_used + size > CMD_ARENA_SIZE)
+        sys_panic("command too long");
+    p = &cmd_arena[cmd_arena_used];
+    cmd_arena_used += size;
+    return p;
+}
+
 /* Execute cmd.  Never returns. */
 void runcmd(struct cmd *cmd)
 {
@@ -101,29 +123,39 @@ void runcmd(struct cmd *cmd)
         if(sys_pipe(p) < 0)
             sys_panic("pipe");
         sys_libc_log("hansh: start to fork pipe processes for left and right tasks\n");
-        if(fork1() == 0) {
+        /* Simple commands are spawned with redirection directly */
+        if(pcmd->left->type == EXEC) {
+            spawncmd((struct execcmd*)pcmd->left, STDOUT, p[1], p);
+        } else if(fork1() == 0) {
             /* Child process */
-            sys_dup(STDOUT, 0, p[1]);
+            sys_dup2(p[1], STDOUT);
+            sys_close(p[0]);
+            sys_close(p[1]);
             runcmd(pcmd->left);
             /* Never run below code */
             sys_exit(0);
         }
-        if(fork1() == 0) {
+        if(pcmd->right->type == EXEC) {
+            spawncmd((struct execcmd*)pcmd->right, STDIN, p[0], p);
+        } else if(fork1() == 0) {
             /* Child process */
-            sys_dup(STDIN, 0, p[0]);
+            sys_dup2(p[0], STDIN);
+            sys_close(p[0]);
+            sys_close(p[1]);
             runcmd(pcmd->right);
             /* Never run below code */
             sys_exit(0);
         }
-        sys_wait(-1);
-        sys_wait(-1);
+        /* The reader sees end of file only after all writing ports close */
         sys_close(p[0]);
         sys_close(p[1]);
+        sys_wait(-1);
+        sys_wait(-1);
         break;
 
     case LIST:
         lcmd = (struct listcmd*)cmd;
-        if(fork1() == 0)
+        if(sys_vfork() == 0)
             runcmd(lcmd->left);
         sys_wait(-1);
         runcmd(lcmd->right);
@@ -189,7 +221,13 @@ void main(void)
 
         if(buf[0] == 0) continue;
 
-        if(fork1() == 0) {
+        /*
+         * The child borrows memory of shell until it calls exec or exits, and
+         * the shell is blocked until then. Parsing is done in the child since
+         * syntax errors exit the process.
+         */
+        cmd_arena_used = 0;
+        if(sys_vfork() == 0) {
             sys_libc_log("hansh: start to execute command\n");
             runcmd(parsecmd(buf));
             sys_exit(0);
@@ -212,13 +250,45 @@ int fork1(void)
     return pid;
 }
 
+/*
+ * Start a simple command without copying the shell. If "fd" is not negative,
+ * it is redirected to "newfd" in the child, and both ends of pipe "p" are
+ * closed there if it is not NULL. Return pid of the child.
+ */
+int spawncmd(struct execcmd *ecmd, int fd, int newfd, int *p)
+{
+    char pathname[CMD_MAX_LEN] = {0};
+    spawn_action_t actions[3] = {{SPAWN_ACTION_DUP, newfd, fd}};
+    int num = 0;
+    int pid;
+
+    if(fd >= 0) {
+        num = 1;
+        if(p != 0) {
+            actions[num++] = (spawn_action_t){SPAWN_ACTION_CLOSE, p[0], 0};
+            actions[num++] = (spawn_action_t){SPAWN_ACTION_CLOSE, p[1], 0};
+        }
+    }
+
+    if(ecmd->argv[0] == 0)
+        return -1;
+    if(ecmd->argv[0][0] != '/')
+        strcpy(pathname, "/bin/");
+    strcat(pathname, ecmd->argv[0]);
+
+    pid = sys_spawn(pathname, ecmd->argv, actions, num);
+    if(pid < 0)
+        fprintf(STDERR, "exec \"%s\" failed\n", ecmd->argv[0]);
+    return pid;
+}
+
 /**--------------------------------------------------------------------------**/
 
 struct cmd* execcmd(void)
 {
     struct execcmd *cmd;
 
-    cmd = sys_malloc(sizeof(*cmd));
+    cmd = cmdalloc(sizeof(*cmd));
     memset(cmd, 0, sizeof(*cmd));
     cmd->type = EXEC;
     return (struct cmd*)cmd;
@@ -229,7 +299,7 @@ struct cmd *redircmd(
 {
     struct redircmd *cmd;
 
-    cmd = sys_malloc(sizeof(*cmd));
+    cmd = cmdalloc(sizeof(*cmd));
     memset(cmd, 0, sizeof(*cmd));
     cmd->type = REDIR;
     cmd->cmd = subcmd;
@@ -244,7 +314,7 @@ struct cmd *pipecmd(struct cmd *left, struct cmd *right)
 {
     struct pipecmd *cmd;
 
-    cmd = sys_malloc(sizeof(*cmd));
+    cmd = cmdalloc(sizeof(*cmd));
     memset(cmd, 0, sizeof(*cmd));
     cmd->type = PIPE;
     cmd->left = left;
@@ -256,7 +326,7 @@ struct cmd *listcmd(struct cmd *left, struct cmd *right)
 {
     struct listcmd *cmd;
 
-    cmd = sys_malloc(sizeof(*cmd));
+    cmd = cmdalloc(sizeof(*cmd));
     memset(cmd, 0, sizeof(*cmd));
     cmd->type = LIST;
     cmd->left = left;
@@ -268,7 +338,7 @@ struct cmd *backcmd(struct cmd *subcmd)
 {
     struct backcmd *cmd;
 
-    cmd = sys_malloc(sizeof(*cmd));
+    cmd = cmdalloc(sizeof(*cmd));
     memset(cmd, 0, sizeof(*cmd));
     cmd->type = BACK;
     cmd->cmd = subcmd;
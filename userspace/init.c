@@ -17,19 +17,13 @@ int main(void)
     /* Loop to start shell program */
     for (;;) {
         printf("init: starting sh...type \"help\" for command list\n");
-        pid = sys_fork();
+        /* Shell is loaded as a child directly without copying init */
+        pid = sys_spawn("/bin/hansh", argv, NULL, 0);
         if(pid < 0) {
-            printf("init: fork failed\n");
+            printf("init: spawn sh failed\n");
             sys_exit(1);
-        } else if(pid == 0) {
-            /* This is child process */
-            sys_exec("/bin/hansh", argv);
-            printf("init: exec sh failed\n");
-            sys_exit(1);
-        } else {
-            /* This is parent process, note that child process id is pid. */
-            sys_wait(-1);
         }
+        sys_wait(pid);
     }
 }
 
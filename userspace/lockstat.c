@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libc/stdio.h>
+#include <libc/string.h>
+#include <libc/sysfunc.h>
+
+#define MAX_SITES   512
+#define MAX_CLASSES 64
+#define TOP_SITES   20
+#define TOP_CLASSES 10
+
+static command_help_t help_msg[] = {
+    {"<help> lockstat", "Rank lock classes and sites by spin time, "
+                        "\"-r\" clears statistics."},
+};
+
+typedef struct {
+    const char *class;
+    uint64_t acquired;
+    uint64_t contended;
+    uint64_t spin_total;
+    int      site;          /* Site with the most spin time */
+} class_sum_t;
+
+static lockstat_t sites[MAX_SITES];
+static class_sum_t classes[MAX_CLASSES];
+
+/* Sort by spin time, then by hold time, in descending order */
+static void sort_sites(int num)
+{
+    for (int i = 1; i < num; i++) {
+        lockstat_t st = sites[i];
+        int j = i - 1;
+        while (j >= 0 && (sites[j].spin_total < st.spin_total
+               || (sites[j].spin_total == st.spin_total
+                   && sites[j].hold_total < st.hold_total))) {
+            sites[j + 1] = sites[j];
+            j--;
+        }
+        sites[j + 1] = st;
+    }
+}
+
+/*
+ * Sum sites by lock class, "sites" must be sorted. Sites of locks without
+ * class are not merged, since they may take different locks.
+ */
+static int sum_classes(int num)
+{
+    int nclasses = 0;
+
+    for (int i = 0; i < num; i++) {
+        int k = nclasses;
+        if (sites[i].class[0] != '\0') {
+            for (k = 0; k < nclasses; k++) {
+                if (strcmp(classes[k].class, sites[i].class) == 0) break;
+            }
+        }
+        if (k == nclasses) {
+            if (nclasses == MAX_CLASSES) continue;
+            memset(&classes[k], 0, sizeof(class_sum_t));
+            classes[k].class = sites[i].class[0] ? sites[i].class : "-";
+            classes[k].site = i;
+            nclasses++;
+        }
+        classes[k].acquired += sites[i].acquired;
+        classes[k].contended += sites[i].contended;
+        classes[k].spin_total += sites[i].spin_total;
+    }
+
+    return nclasses;
+}
+
+int main(int argc, char *argv[])
+{
+    int num = 0, id;
+
+    if (argc > 1 && strcmp(argv[1], "-r") == 0) {
+        if (sys_lockstat(-1, NULL) < 0) {
+            printf("lockstat: not supported, define ENABLE_LOCKSTAT\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    for (id = 0; num < MAX_SITES
+         && (id = sys_lockstat(id, &sites[num])) >= 0; id++) {
+        num++;
+    }
+
+    if (num == 0) {
+        printf("lockstat: no statistics, define ENABLE_LOCKSTAT\n");
+        return 1;
+    }
+
+    sort_sites(num);
+
+    printf("Sites by spin time (kilo TSC cycles):\n");
+    printf("ACQUIRED\tCONTEND\tSPIN\tMAX\tHOLD\tMAX\tSITE\tCLASS\n");
+    for (int i = 0; i < num && i < TOP_SITES; i++) {
+        lockstat_t *st = &sites[i];
+        printf("%d\t%d\t%d\t%d\t%d\t%d\t%s:%d\t%s\n",
+               (int)st->acquired, (int)st->contended,
+               (int)(st->spin_total / 1000), (int)(st->spin_max / 1000),
+               (int)(st->hold_total / 1000), (int)(st->hold_max / 1000),
+               st->file, (int)st->line, st->class[0] ? st->class : "-");
+    }
+
+    int nclasses = sum_classes(num);
+
+    printf("\nLock classes by spin time (kilo TSC cycles):\n");
+    printf("ACQUIRED\tCONTEND\tSPIN\tCLASS\tWORST SITE\n");
+    for (int i = 0; i < nclasses && i < TOP_CLASSES; i++) {
+        int best = i;
+        for (int k = i + 1; k < nclasses; k++) {
+            if (classes[k].spin_total > classes[best].spin_total) best = k;
+        }
+        class_sum_t t = classes[i];
+        classes[i] = classes[best];
+        classes[best] = t;
+
+        printf("%d\t%d\t%d\t%s\t%s:%d\n",
+               (int)classes[i].acquired, (int)classes[i].contended,
+               (int)(classes[i].spin_total / 1000), classes[i].class,
+               sites[classes[i].site].file, (int)sites[classes[i].site].line);
+    }
+
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libc/stdio.h>
+#include <libc/string.h>
+#include <libc/sysfunc.h>
+
+static command_help_t help_msg[] = {
+    {"<help> schedstat", "Print scheduler statistics of CPUs and tasks."},
+};
+
+static const char *status_name[] = {
+    "ready", "running", "sleeping", "zombie", "dead", "unknown"
+};
+
+void print_cpu(int cpu, const sched_stat_t *st)
+{
+    int i;
+
+    printf("CPU %d: switches tick %d sleep %d fork %d resched %d, idle %d ms\n",
+           cpu, (int)st->switches[SCHED_SWITCH_TICK],
+           (int)st->switches[SCHED_SWITCH_SLEEP],
+           (int)st->switches[SCHED_SWITCH_FORK],
+           (int)st->switches[SCHED_SWITCH_RESCHED],
+           (int)(st->idle_ns / 1000000));
+    printf("  real-time: %d ms, throttled %d times\n",
+           (int)(st->rt_ns / 1000000), (int)st->rt_throttled);
+
+    if (st->wait_count == 0) {
+        printf("  run-queue wait: none\n");
+        return;
+    }
+
+    printf("  run-queue wait: %d times, avg %d us, max %d us\n",
+           (int)st->wait_count, (int)(st->wait_ns / st->wait_count / 1000),
+           (int)(st->wait_max_ns / 1000));
+
+    for (i = 0; i < SCHEDSTAT_BUCKETS; i++) {
+        if (st->wait_hist[i] == 0) continue;
+        if (i == 0) {
+            printf("  < 2 us: %d\n", (int)st->wait_hist[i]);
+        } else if (i == SCHEDSTAT_BUCKETS - 1) {
+            printf("  >= %d us: %d\n", 1 << i, (int)st->wait_hist[i]);
+        } else {
+            printf("  %d - %d us: %d\n", 1 << i, 1 << (i + 1),
+                   (int)st->wait_hist[i]);
+        }
+    }
+}
+
+void print_task(const task_stat_t *st)
+{
+    const char *status = status_name[5];
+
+    if (st->status < 5) status = status_name[st->status];
+
+    printf("%d\t%d\t%d\t%s\t%d\t%d\t%s\n",
+           (int)st->tid, (int)st->ptid, (int)st->cpu, status,
+           (int)(st->runtime_ns / 1000), (int)st->switches, st->name);
+}
+
+int main(int argc, char *argv[])
+{
+    sched_stat_t cst;
+    task_stat_t tst;
+    int id;
+
+    for (id = 0; (id = sys_schedstat(SCHEDSTAT_CPU, id, &cst)) >= 0; id++) {
+        print_cpu(id, &cst);
+    }
+
+    printf("TID\tPTID\tCPU\tSTATUS\tRUN(us)\tSWITCH\tNAME\n");
+    for (id = 1; (id = sys_schedstat(SCHEDSTAT_TASK, id, &tst)) > 0; id++) {
+        print_task(&tst);
+    }
+
+    return 0;
+}